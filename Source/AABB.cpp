@@ -37,15 +37,19 @@ namespace Pooraytracer {
 
 	bool AABB::Hit(const Ray& ray, Interval t) const
 	{
-		const vec3& origin = ray.origin;
-		const vec3& direction = ray.direction;
+		return Hit(RayQuery(ray), t);
+	}
+
+	bool AABB::Hit(const RayQuery& query, Interval t) const
+	{
+		const vec3& origin = query.origin;
+		const vec3& invDirection = query.invDirection;
 
 		for (int i = 0; i < 3; ++i) {
 			const Interval& axis = GetAxisInterval(i);
-			const double invDircetion = 1.0 / direction[i];
 
-			double t0 = (axis.min - origin[i]) * invDircetion;
-			double t1 = (axis.max - origin[i]) * invDircetion;
+			Real t0 = (axis.min - origin[i]) * invDirection[i];
+			Real t1 = (axis.max - origin[i]) * invDirection[i];
 
 			if (t0 < t1) {
 				if (t0 > t.min) t.min = t0;
@@ -73,9 +77,23 @@ namespace Pooraytracer {
 		}
 	}
 
+	Real AABB::SurfaceArea() const
+	{
+		if (x.min > x.max || y.min > y.max || z.min > z.max) {
+			return 0.0;
+		}
+		Real dx = x.Length(), dy = y.Length(), dz = z.Length();
+		return 2.0 * (dx * dy + dy * dz + dz * dx);
+	}
+
+	vec3 AABB::Centroid() const
+	{
+		return vec3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+	}
+
 	void AABB::PadToMinimus()
 	{
-		double delta = 0.0001;
+		Real delta = 0.0001;
 		if (x.Length() < delta) x = x.Expand(delta);
 		if (y.Length() < delta) y = y.Expand(delta);
 		if (z.Length() < delta) z = z.Expand(delta);
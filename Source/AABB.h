@@ -1,12 +1,12 @@
 #pragma once
 
 #include "Interval.h"
-#include <glm/vec3.hpp>
+#include "Real.h"
 
 namespace Pooraytracer {
 
 	class Ray;
-	using vec3 = glm::dvec3;
+	class RayQuery;
 
 	// Axis-Aligned Bounding Box
 	class AABB {
@@ -20,7 +20,10 @@ namespace Pooraytracer {
 
 		const Interval& GetAxisInterval(int axis) const;
 		bool Hit(const Ray& ray, Interval t) const;
+		bool Hit(const RayQuery& query, Interval t) const;
 		int LongestAxis() const;
+		Real SurfaceArea() const;
+		vec3 Centroid() const;
 
 		static const AABB empty, universe;
 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+namespace Pooraytracer {
+
+	// Scene-lifetime allocator: objects are placed one after another in large blocks, and the
+	// blocks are returned all at once when the arena is destroyed. Destructors still run when the
+	// last shared_ptr goes, but freeing is a no-op, so the arena has to outlive every object made
+	// from it. Not thread-safe; meant for loading and single-threaded builds.
+	// Only the objects themselves and their control blocks live here. The arrays they own (vertex
+	// buffers, triangles, BVH node vectors, texture pixels) are one heap allocation each already
+	// and stay there: a monotonic arena would strand every reallocation of a growing vector.
+	class Arena : public std::pmr::memory_resource {
+	public:
+		explicit Arena(size_t initialBlockBytes = 1 << 20) :blocks(initialBlockBytes, &upstream) {}
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		template <typename T, typename... Args>
+		std::shared_ptr<T> MakeShared(Args&&... args) {
+			// The control block lives next to the object.
+			return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(this), std::forward<Args>(args)...);
+		}
+
+		size_t GetUsedBytes() const { return usedBytes; }			// handed out to objects
+		size_t GetReservedBytes() const { return upstream.reservedBytes; }	// taken from the system
+
+	private:
+		class CountingResource : public std::pmr::memory_resource {
+		public:
+			size_t reservedBytes = 0;
+		private:
+			void* do_allocate(size_t bytes, size_t alignment) override {
+				reservedBytes += bytes;
+				return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+			}
+			void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+				reservedBytes -= bytes;
+				std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+			}
+			bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+		};
+
+		void* do_allocate(size_t bytes, size_t alignment) override {
+			usedBytes += bytes;
+			return blocks.allocate(bytes, alignment);
+		}
+		void do_deallocate(void*, size_t, size_t) override {}
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+		CountingResource upstream;
+		std::pmr::monotonic_buffer_resource blocks;
+		size_t usedBytes = 0;
+	};
+
+	// make_shared from `arena`, or from the heap without one.
+	template <typename T, typename... Args>
+	std::shared_ptr<T> MakeShared(Arena* arena, Args&&... args)
+	{
+		if (arena) {
+			return arena->MakeShared<T>(std::forward<Args>(args)...);
+		}
+		return std::make_shared<T>(std::forward<Args>(args)...);
+	}
+}
\ No newline at end of file
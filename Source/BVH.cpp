@@ -1,10 +1,28 @@
 #include "BVH.h"
 #include <algorithm>
 #include "Logger.h"
+#include "SAH.h"
 
 namespace Pooraytracer {
-	BVHNode::BVHNode(HittableList list) : BVHNode(list.objects, 0, list.objects.size()) {}
-	BVHNode::BVHNode(std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end)
+	static const char* SplitMethodName(BVHSplitMethod splitMethod)
+	{
+		switch (splitMethod)
+		{
+		case BVHSplitMethod::SAH: return "SAH";
+		case BVHSplitMethod::SpatialSAH: return "SpatialSAH";
+		default: return "Median";
+		}
+	}
+
+	BVHNode::BVHNode(HittableList list, BVHSplitMethod splitMethod, Arena* arena) : BVHNode(list.objects, 0, list.objects.size(), splitMethod, arena)
+	{
+		LOGI("BVH ({}) over {} objects, SAH cost: {:.3f}", SplitMethodName(splitMethod), list.objects.size(), SAHCost());
+	}
+	BVHNode::BVHNode(shared_ptr<Mesh> mesh, BVHSplitMethod splitMethod, Arena* arena) : BVHNode(mesh->objects, 0, mesh->objects.size(), splitMethod, arena)
+	{
+		LOGD("Mesh {} BVH ({}) over {} triangles, SAH cost: {:.3f}", mesh->name, SplitMethodName(splitMethod), mesh->objects.size(), SAHCost());
+	}
+	BVHNode::BVHNode(std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end, BVHSplitMethod splitMethod, Arena* arena)
 	{
 		// Build the bounding box of the span of source objects.
 		bbox = AABB::empty;
@@ -13,7 +31,19 @@ namespace Pooraytracer {
 		{
 			bbox = AABB(bbox, objects[objectIdx]->BoundingBox());
 		}
-		int axis = bbox.LongestAxis();
+
+		// A pointer tree cannot share primitives between leaves, so spatial splits fall back to plain SAH.
+		if (splitMethod == BVHSplitMethod::SAH || splitMethod == BVHSplitMethod::SpatialSAH) {
+			BuildSAH(objects, start, end, arena);
+		}
+		else {
+			BuildMedian(objects, start, end, arena);
+		}
+	}
+
+	void BVHNode::BuildMedian(std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end, Arena* arena)
+	{
+		axis = bbox.LongestAxis();
 
 		auto comparator = (axis == 0) ? BoxAxisXCompare : (axis == 1) ? BoxAxisYCompare : BoxAxisZCompare;
 
@@ -30,41 +60,148 @@ namespace Pooraytracer {
 		else {
 			std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
 			auto mid = start + objectSpan / 2;
-			left = make_shared<BVHNode>(objects, start, mid);
-			right = make_shared<BVHNode>(objects, mid, end);
-			std::shared_ptr<BVHNode> leftNode = std::dynamic_pointer_cast<BVHNode>(left);
-			std::shared_ptr<BVHNode> rightNode = std::dynamic_pointer_cast<BVHNode>(right);
+			auto leftChild = MakeShared<BVHNode>(arena, objects, start, mid, BVHSplitMethod::Median, arena);
+			auto rightChild = MakeShared<BVHNode>(arena, objects, mid, end, BVHSplitMethod::Median, arena);
+			area = leftChild->area + rightChild->area;
+			leftNode = leftChild.get();
+			rightNode = rightChild.get();
+			left = leftChild;
+			right = rightChild;
+		}
+	}
 
-			if (leftNode && rightNode) {
-				area = leftNode->area + rightNode->area;
-			}
-			else {
-				area = 0.0;
-				for (size_t objectIdx = start; objectIdx < end; ++objectIdx) {
-					area += objects[objectIdx]->GetArea();
-				}
+	void BVHNode::BuildSAH(std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end, Arena* arena)
+	{
+		size_t objectSpan = end - start;
+		auto first = std::begin(objects) + start;
+		auto last = std::begin(objects) + end;
+
+		AABB centroidBounds = AABB::empty;
+		for (auto it = first; it != last; ++it) {
+			vec3 centroid = (*it)->BoundingBox().Centroid();
+			centroidBounds = AABB(centroidBounds, AABB(centroid, centroid));
+		}
+
+		SAHSplit split;
+		if (objectSpan > 1) {
+			split = FindSAHSplit(first, last, bbox, centroidBounds,
+				[](const shared_ptr<Hittable>& object) { return object->BoundingBox(); });
+		}
+
+		// Make a leaf when it is cheaper than the best split, unless it would be too large.
+		if (objectSpan == 1 || (objectSpan <= maxLeafPrimitives && SAHLeafCost(objectSpan) <= split.cost)) {
+			primitives.assign(first, last);
+			for (const auto& primitive : primitives) {
+				area += primitive->GetArea();
 			}
+			return;
 		}
+
+		size_t mid = start + objectSpan / 2; // all centroids coincide: split by count
+		axis = bbox.LongestAxis();
+		if (split.axis >= 0) {
+			axis = split.axis;
+			auto midIt = std::partition(first, last, [&](const shared_ptr<Hittable>& object) {
+				return SAHBinIndex(centroidBounds, split.axis, object->BoundingBox().Centroid()) <= split.bin;
+				});
+			mid = start + std::distance(first, midIt);
+		}
+		auto leftChild = MakeShared<BVHNode>(arena, objects, start, mid, BVHSplitMethod::SAH, arena);
+		auto rightChild = MakeShared<BVHNode>(arena, objects, mid, end, BVHSplitMethod::SAH, arena);
+		area = leftChild->area + rightChild->area;
+		leftNode = leftChild.get();
+		rightNode = rightChild.get();
+		left = leftChild;
+		right = rightChild;
 	}
-	BVHNode::BVHNode(shared_ptr<Mesh> mesh) :BVHNode(mesh->objects, 0, mesh->objects.size()) {}
 
 	bool BVHNode::Hit(const Ray& ray, Interval domain, HitRecord& record) const
 	{
-		if (!bbox.Hit(ray, domain))
+		return HitNode(ray, RayQuery(ray), domain, record);
+	}
+	bool BVHNode::HitNode(const Ray& ray, const RayQuery& query, Interval domain, HitRecord& record) const
+	{
+		if (!bbox.Hit(query, domain))
 		{
 			return false;
 		}
-		bool bHitLeft = left->Hit(ray, domain, record);
-		bool bHitRight = right->Hit(ray, Interval(domain.min, bHitLeft ? record.time : domain.max), record);
+		if (!primitives.empty()) {
+			bool bHitAnything = false;
+			Real closest = domain.max;
+			for (const auto& primitive : primitives) {
+				if (primitive->Hit(ray, Interval(domain.min, closest), record)) {
+					bHitAnything = true;
+					closest = record.time;
+				}
+			}
+			return bHitAnything;
+		}
+		// Visit the child on the near side of the split first, so the far one is often culled by the closer hit.
+		auto hitChild = [&](const Hittable& child, const BVHNode* childNode, Interval childDomain) {
+			return childNode ? childNode->HitNode(ray, query, childDomain, record) : child.Hit(ray, childDomain, record);
+			};
+		bool bLeftFirst = ray.direction[axis] >= 0.0;
+		bool bHitNear = bLeftFirst ? hitChild(*left, leftNode, domain) : hitChild(*right, rightNode, domain);
+		Interval farDomain(domain.min, bHitNear ? record.time : domain.max);
+		bool bHitFar = bLeftFirst ? hitChild(*right, rightNode, farDomain) : hitChild(*left, leftNode, farDomain);
 
-		return bHitLeft || bHitRight;
+		return bHitNear || bHitFar;
+	}
+	bool BVHNode::Occluded(const Ray& ray, Interval domain) const
+	{
+		return OccludedNode(ray, RayQuery(ray), domain);
+	}
+	bool BVHNode::OccludedNode(const Ray& ray, const RayQuery& query, Interval domain) const
+	{
+		if (!bbox.Hit(query, domain))
+		{
+			return false;
+		}
+		if (!primitives.empty()) {
+			for (const auto& primitive : primitives) {
+				if (primitive->Occluded(ray, domain)) {
+					return true;
+				}
+			}
+			return false;
+		}
+		auto occludedChild = [&](const Hittable& child, const BVHNode* childNode) {
+			return childNode ? childNode->OccludedNode(ray, query, domain) : child.Occluded(ray, domain);
+			};
+		return occludedChild(*left, leftNode) || occludedChild(*right, rightNode);
 	}
-	void BVHNode::Sample(const point3& origin, HitRecord& samplePointRecord, double& pdf) const
+	void BVHNode::Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const
 	{
-		double p = std::sqrt(RandomDouble()) * GetArea();
-		TraverseSample(origin, make_shared<const BVHNode>(*this), p, samplePointRecord, pdf);
+		Real p = std::sqrt(RandomDouble()) * GetArea();
+		// Non-owning: the walk only needs `this` as a node, not a copy of it.
+		TraverseSample(origin, shared_ptr<const Hittable>(shared_ptr<const Hittable>(), this), p, samplePointRecord, pdf);
 		pdf /= GetArea();
 	}
+	double BVHNode::SAHCost() const
+	{
+		return SAHCostSum() / bbox.SurfaceArea();
+	}
+	double BVHNode::SAHCostSum() const
+	{
+		// A primitive is tested every time the node referencing it is entered;
+		// nested BVHs (e.g. per-mesh trees under the world tree) contribute their own cost.
+		auto childCost = [this](const shared_ptr<Hittable>& child) {
+			if (auto childNode = std::dynamic_pointer_cast<BVHNode>(child)) {
+				return childNode->SAHCostSum();
+			}
+			return SAHIntersectionCost * bbox.SurfaceArea();
+			};
+
+		double cost = 0.0;
+		if (!primitives.empty()) {
+			for (const auto& primitive : primitives) {
+				cost += childCost(primitive);
+			}
+			return cost;
+		}
+		cost = SAHTraversalCost * bbox.SurfaceArea();
+		return cost + childCost(left) + childCost(right);
+	}
 	bool BVHNode::BoxCompare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b, int axisIdx)
 	{
 		auto aAxisInterval = a->BoundingBox().GetAxisInterval(axisIdx);
@@ -83,7 +220,7 @@ namespace Pooraytracer {
 	{
 		return BoxCompare(a, b, 2);
 	}
-	void BVHNode::TraverseSample(const point3& origin, const shared_ptr<const Hittable> node, float p, HitRecord& samplePointRecord, double& pdf) const {
+	void BVHNode::TraverseSample(const point3& origin, const shared_ptr<const Hittable> node, float p, HitRecord& samplePointRecord, Real& pdf) const {
 
 		const shared_ptr<const BVHNode> bvhNode = std::dynamic_pointer_cast<const BVHNode>(node);
 		if (!bvhNode) {
@@ -91,6 +228,15 @@ namespace Pooraytracer {
 			pdf *= node->GetArea();
 			return;
 		}
+		if (!bvhNode->primitives.empty()) {
+			for (const auto& primitive : bvhNode->primitives) {
+				if (p < primitive->GetArea() || primitive == bvhNode->primitives.back()) {
+					TraverseSample(origin, primitive, p, samplePointRecord, pdf);
+					return;
+				}
+				p -= primitive->GetArea();
+			}
+		}
 		if (p < bvhNode->left->GetArea()) {
 			TraverseSample(origin, bvhNode->left, p, samplePointRecord, pdf);
 		}
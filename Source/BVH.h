@@ -1,5 +1,6 @@
 #pragma once
 #include "AABB.h"
+#include "Arena.h"
 #include "Hittable.h"
 #include "HittableList.h"
 #include "Triangle.h"
@@ -8,29 +9,52 @@
 
 namespace Pooraytracer {
 
+	enum class BVHSplitMethod
+	{
+		Median,		// sort by bounding box min on the longest axis, split at the midpoint
+		SAH,		// binned surface area heuristic, also decides the leaf size
+		SpatialSAH	// SAH with spatial splits (SBVH): references may be clipped and duplicated, LinearBVH only
+	};
+
 	class BVHNode :public Hittable {
 
 	public:
-		BVHNode(HittableList list);
-		BVHNode(shared_ptr<Mesh> mesh);
-		BVHNode(std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end);
+		// Inner nodes are allocated from `arena` when given, which then has to outlive the tree.
+		BVHNode(HittableList list, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, Arena* arena = nullptr);
+		BVHNode(shared_ptr<Mesh> mesh, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, Arena* arena = nullptr);
+		BVHNode(std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, Arena* arena = nullptr);
 		bool Hit(const Ray& ray, Interval domain, HitRecord& record) const override;
+		bool Occluded(const Ray& ray, Interval domain) const override;
 		AABB BoundingBox() const override { return bbox; }
-		double GetArea() const override { return area; }
-		void Sample(const point3& origin, HitRecord& samplePointRecord, double& pdf) const override;
+		Real GetArea() const override { return area; }
+		void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const override;
+		// Expected cost of a ray query against this tree, normalized by the root surface area.
+		double SAHCost() const;
 
 	public:
 		AABB bbox;
+		static constexpr size_t maxLeafPrimitives = 4;
 
 	private:
+		friend class LinearBVH;
 		shared_ptr<Hittable> left;
 		shared_ptr<Hittable> right;
+		// The children again when they are nodes, so traversal can pass them the root's RayQuery.
+		const BVHNode* leftNode = nullptr;
+		const BVHNode* rightNode = nullptr;
+		std::vector<shared_ptr<Hittable>> primitives; // non-empty only for SAH leaves
+		int axis = 0;	// split axis, decides which child a ray visits first
 		static bool BoxCompare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b, int axisIdx);
 		static bool BoxAxisXCompare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b);
 		static bool BoxAxisYCompare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b);
 		static bool BoxAxisZCompare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b);
-		void TraverseSample(const point3& origin, const shared_ptr<const Hittable> node, float p, HitRecord& samplePointRecord, double& pdf) const;
-		double area = 0.0;
+		void BuildMedian(std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end, Arena* arena);
+		void BuildSAH(std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end, Arena* arena);
+		double SAHCostSum() const;
+		bool HitNode(const Ray& ray, const RayQuery& query, Interval domain, HitRecord& record) const;
+		bool OccludedNode(const Ray& ray, const RayQuery& query, Interval domain) const;
+		void TraverseSample(const point3& origin, const shared_ptr<const Hittable> node, float p, HitRecord& samplePointRecord, Real& pdf) const;
+		Real area = 0.0;
 	};
 
 }
\ No newline at end of file
@@ -10,9 +10,17 @@
 #include "Logger.h"
 #include "Material.h"
 #include "RandomNumberGenerator.h"
-
+#include "StreamedGeometry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <type_traits>
 
 namespace Pooraytracer {
 
@@ -43,53 +51,372 @@ namespace Pooraytracer {
 		}
 		*/
 
-		int process = imageHeight;
-		int times = imageHeight / threadNums;
-		std::vector<std::thread> threads(threadNums);
+		// Tiles of packetTileSize x packetTileSize pixels: each sample's primary rays are traced as one packet.
+		// Sample r of the pass goes to the pixels that take more than r samples in it.
+		auto castPacketsMultiThread = [&](uint32_t yMin, uint32_t yMax) {
+			RayPacket packet;
+			auto hits = std::make_unique<RayPacketHits>();
+			uint32_t pixels[RayPacket::maxRays];
+			for (uint32_t tileY = yMin; tileY < yMax; tileY += packetTileSize) {
+				uint32_t tileYMax = std::min(tileY + packetTileSize, yMax);
+				for (uint32_t tileX = 0; tileX < imageWidth; tileX += packetTileSize) {
+					uint32_t tileXMax = std::min(tileX + packetTileSize, static_cast<uint32_t>(imageWidth));
+					for (uint32_t sample = 0; ; ++sample) {
+						packet.rayNums = 0;
+						for (uint32_t j = tileY; j < tileYMax; ++j) {
+							for (uint32_t i = tileX; i < tileXMax; ++i) {
+								uint32_t pixel = i + j * imageWidth;
+								if (sample < passSampleNums[pixel]) {
+									pixels[packet.rayNums] = pixel;
+									packet.rays[packet.rayNums++] = GetRay(i, j, pixelStats[pixel].sampleNums);
+								}
+							}
+						}
+						if (packet.rayNums == 0) {
+							break;
+						}
+						packet.Setup();
+						hits->Reset(packet.rayNums, Infinity);
+						world.HitPacket(packet, Interval(0.0, Infinity), *hits);
+
+						for (int r = 0; r < packet.rayNums; ++r) {
+							PixelStats& stats = pixelStats[pixels[r]];
+							color pixelColor = background;
+							if (hits->bUpdated[r]) {
+								ThreadSampleStream().StartPixelSample(sampler.get(), pixels[r], stats.sampleNums);
+								hits->records[r].SetShadingAttributes(packet.rays[r]);
+								pixelColor = ShadeHit(packet.rays[r], hits->records[r], maxDepth, world, lights);
+							}
+							stats.AddSample(pixelColor);
+						}
+					}
+				}
+			}
+			};
 		auto castRayMultiThread = [&](uint32_t yMin, uint32_t yMax) {
-			for (uint32_t j = yMin; j < yMax && j < imageHeight; j++) {
-				int m = j * imageWidth;
+			for (uint32_t j = yMin; j < yMax; j++) {
 				for (uint32_t i = 0; i < imageWidth; i++) {
-					Ray ray = GetRay(i, j);
-					for (int sample = 0; sample < samplesPerPixel; ++sample)
+					uint32_t pixel = i + j * imageWidth;
+					PixelStats& stats = pixelStats[pixel];
+					for (uint32_t sample = 0; sample < passSampleNums[pixel]; ++sample)
 					{
-						colorAttachment[m] += RayColor(ray, maxDepth, world, lights) * pixelSamplesScale;
+						ThreadSampleStream().StartPixelSample(sampler.get(), pixel, stats.sampleNums);
+						stats.AddSample(RayColor(GetRay(i, j, stats.sampleNums), maxDepth, world, lights));
+					}
+				}
+			}
+			};
+
+		const auto startTime = std::chrono::steady_clock::now();
+		auto GetElapsedSeconds = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(); };
+		auto bOutOfTime = [&]() { return timeBudgetSeconds > 0.0 && GetElapsedSeconds() >= timeBudgetSeconds; };
+		double lastSnapshotSeconds = 0.0;
+		double lastCheckpointSeconds = 0.0;
+
+		// The scene as checkpoints know it: the caller's hash, and what the renderer sees of it.
+		const AABB bounds[2] = { world.BoundingBox(), lights.BoundingBox() };
+		const Real areas[2] = { world.GetArea(), lights.GetArea() };
+		const uint64_t renderSceneHash = HashBytes(areas, sizeof(areas), HashBytes(bounds, sizeof(bounds), sceneHash));
+		uint32_t pass = 0;
+		if (bResumeFromCheckpoint && !checkpointPath.empty() && ReadCheckpoint(renderSceneHash, pass)) {
+			LOGI("Resuming from {} after {} passes", checkpointPath, pass);
+			// A pass that was cut off is finished first, as it was planned.
+			for (size_t pixel = 0; pixel < pixelStats.size(); ++pixel) {
+				if (passTargets[pixel] > pixelStats[pixel].sampleNums) {
+					--pass;
+					break;
+				}
+			}
+		}
+
+		const uint32_t maxSamples = static_cast<uint32_t>(std::max(samplesPerPixel, 1));
+		std::vector<uint8_t> bNoisy(pixelStats.size());
+		auto bNoisyNeighbour = [&](size_t pixel) {
+			const int i = static_cast<int>(pixel % imageWidth), j = static_cast<int>(pixel / imageWidth);
+			for (int y = std::max(j - 1, 0); y <= std::min(j + 1, imageHeight - 1); ++y) {
+				for (int x = std::max(i - 1, 0); x <= std::min(i + 1, imageWidth - 1); ++x) {
+					if (bNoisy[x + y * imageWidth]) {
+						return true;
 					}
-					++m;
 				}
-				mtx.lock();
-				process--;
-				ShowProgress(process);
-				mtx.unlock();
 			}
+			return false;
 			};
-		for (int i = 0; i < threadNums; i++) {
-			threads[i] = std::thread(castRayMultiThread, i * times, (i + 1) * times);
+
+		// Passes over the image. Without adaptive sampling the first pass takes all samples; with it,
+		// passes continue on the pixels that have not converged. Progressive passes take at most
+		// progressiveSamples per pixel each. Rows are handed out to the threads as they finish,
+		// since later passes concentrate on the noisy parts of the image.
+		for (; ; ++pass) {
+			bool bResumedPass = false;
+			for (size_t pixel = 0; pixel < pixelStats.size(); ++pixel) {
+				const uint32_t sampleNums = pixelStats[pixel].sampleNums;
+				passSampleNums[pixel] = passTargets[pixel] > sampleNums ? passTargets[pixel] - sampleNums : 0;
+				bResumedPass |= passSampleNums[pixel] > 0;
+			}
+			for (size_t pixel = 0; pixel < pixelStats.size() && !bResumedPass; ++pixel) {
+				passSampleNums[pixel] = NextSampleNums(pixelStats[pixel]);
+				bNoisy[pixel] = passSampleNums[pixel] > 0;
+			}
+			// A pixel also continues while one of its neighbours does: a pixel whose samples all
+			// happened to agree so far (say, all on one side of an edge) has no variance to show.
+			if (adaptiveRelativeError > 0.0 && !bResumedPass) {
+				for (size_t pixel = 0; pixel < pixelStats.size(); ++pixel) {
+					const uint32_t sampleNums = pixelStats[pixel].sampleNums;
+					if (!bNoisy[pixel] && sampleNums < maxSamples && bNoisyNeighbour(pixel)) {
+						passSampleNums[pixel] = std::min(static_cast<uint32_t>(std::max(adaptiveStep, 1)), maxSamples - sampleNums);
+					}
+				}
+			}
+			uint32_t maxPassSamples = 0;
+			size_t passPixels = 0, passSamples = 0;
+			// The time budget only stops passes once every pixel has a sample, so that no pixel is left black.
+			bool bBudgeted = true;
+			for (size_t pixel = 0; pixel < pixelStats.size(); ++pixel) {
+				if (progressiveSamples > 0) {
+					passSampleNums[pixel] = std::min(passSampleNums[pixel], static_cast<uint32_t>(progressiveSamples));
+				}
+				maxPassSamples = std::max(maxPassSamples, passSampleNums[pixel]);
+				passPixels += passSampleNums[pixel] > 0;
+				passSamples += passSampleNums[pixel];
+				bBudgeted = bBudgeted && pixelStats[pixel].sampleNums > 0;
+			}
+			if (passSamples == 0 || (bBudgeted && bOutOfTime())) {
+				break;
+			}
+			for (size_t pixel = 0; pixel < pixelStats.size(); ++pixel) {
+				passTargets[pixel] = pixelStats[pixel].sampleNums + passSampleNums[pixel];
+			}
+			if (adaptiveRelativeError > 0.0 || progressiveSamples > 0) {
+				LOGI("Pass {}: {} pixels, {} samples, {:.1f} s", pass, passPixels, passSamples, GetElapsedSeconds());
+			}
+
+			uint32_t rowsPerTask = 1;
+			if (bWavefront) {
+				rowsPerTask = static_cast<uint32_t>(std::max<size_t>(1, wavefrontBatchPaths / (size_t(imageWidth) * maxPassSamples)));
+			}
+			else if (bPrimaryRayPackets) {
+				rowsPerTask = packetTileSize;
+			}
+			std::atomic<uint32_t> nextRow = 0;
+			int process = imageHeight;
+			auto renderRows = [&]() {
+				// Out of time, the rows not reached keep the samples of the earlier passes, of which
+				// there is at least one: a pass that gives pixels their first sample always completes.
+				for (uint32_t yMin; !(bBudgeted && bOutOfTime()) && (yMin = nextRow.fetch_add(rowsPerTask)) < static_cast<uint32_t>(imageHeight);) {
+					uint32_t yMax = std::min(yMin + rowsPerTask, static_cast<uint32_t>(imageHeight));
+					if (bWavefront) {
+						RenderWavefront(yMin, yMax, world, lights);
+					}
+					else if (bPrimaryRayPackets) {
+						castPacketsMultiThread(yMin, yMax);
+					}
+					else {
+						castRayMultiThread(yMin, yMax);
+					}
+					mtx.lock();
+					process -= yMax - yMin;
+					ShowProgress(process);
+					mtx.unlock();
+				}
+				};
+			std::vector<std::thread> threads(threadNums);
+			for (auto& th : threads) {
+				th = std::thread(renderRows);
+			}
+			for (auto& th : threads) {
+				th.join();
+			}
+
+			ResolveAttachments();
+			if (progressiveSamples > 0 && !snapshotPath.empty() && GetElapsedSeconds() - lastSnapshotSeconds >= snapshotIntervalSeconds) {
+				WriteColorAttachment(snapshotPath);
+				lastSnapshotSeconds = GetElapsedSeconds();
+			}
+			if (!checkpointPath.empty() && GetElapsedSeconds() - lastCheckpointSeconds >= checkpointIntervalSeconds) {
+				WriteCheckpoint(renderSceneHash, pass + 1);
+				lastCheckpointSeconds = GetElapsedSeconds();
+			}
+		}
+
+		ResolveAttachments();
+		if (!checkpointPath.empty()) {
+			WriteCheckpoint(renderSceneHash, pass);
+		}
+		size_t totalSamples = 0;
+		for (uint32_t sampleNums : sampleCountAttachment) {
+			totalSamples += sampleNums;
+		}
+		LOGI("Render End... {:.1f} samples per pixel on average, {:.1f} s", double(totalSamples) / pixelStats.size(), GetElapsedSeconds());
+	}
+
+	void Camera::ResolveAttachments()
+	{
+		for (size_t pixel = 0; pixel < pixelStats.size(); ++pixel) {
+			const PixelStats& stats = pixelStats[pixel];
+			colorAttachment[pixel] = stats.sampleNums > 0 ? stats.sum / Real(stats.sampleNums) : color(0.0);
+			sampleCountAttachment[pixel] = stats.sampleNums;
+			varianceAttachment[pixel] = stats.MeanVariance();
+		}
+	}
+
+	namespace {
+		struct CheckpointHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t realBytes;
+			uint64_t settingsHash;
+			uint64_t sceneHash;
+			uint32_t imageWidth;
+			uint32_t imageHeight;
+			uint32_t passNums;			// passes started
+			uint32_t reserved;
+		};
+		constexpr char checkpointMagic[8] = "PRTCKPT";
+		constexpr uint32_t checkpointVersion = 1;
+	}
+
+	uint64_t Camera::GetCheckpointHash() const
+	{
+		uint64_t hash = 0;
+		auto add = [&](const auto& value) { hash = HashBytes(&value, sizeof(value), hash); };
+		add(imageWidth); add(imageHeight); add(samplesPerPixel); add(maxDepth); add(background);
+		add(samplerType); add(seed); add(fovy); add(eye); add(lookAt); add(up);
+		add(bSampleLights); add(russianRoulette); add(bPrimaryRayPackets); add(bWavefront);
+		add(adaptiveRelativeError); add(adaptiveMinSamples); add(adaptiveStep); add(adaptiveLuminanceFloor);
+		add(progressiveSamples);
+		return hash;
+	}
+
+	bool Camera::WriteCheckpoint(uint64_t renderSceneHash, uint32_t passNums) const
+	{
+		static_assert(std::is_trivially_copyable_v<PixelStats>);
+		CheckpointHeader header{};
+		std::copy(std::begin(checkpointMagic), std::end(checkpointMagic), header.magic);
+		header.version = checkpointVersion;
+		header.realBytes = sizeof(Real);
+		header.settingsHash = GetCheckpointHash();
+		header.sceneHash = renderSceneHash;
+		header.imageWidth = imageWidth;
+		header.imageHeight = imageHeight;
+		header.passNums = passNums;
+
+		// Written beside the old one and then renamed over it, so a crash while writing leaves the
+		// previous checkpoint intact.
+		const std::string tempPath = checkpointPath + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(pixelStats.data()), pixelStats.size() * sizeof(PixelStats));
+			file.write(reinterpret_cast<const char*>(passTargets.data()), passTargets.size() * sizeof(uint32_t));
+			file.close();
+			if (!file) {
+				LOGE("Write Checkpoint Failed: {}", tempPath);
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(tempPath, checkpointPath, error);
+		if (error) {
+			LOGE("Write Checkpoint Failed: {} ({})", checkpointPath, error.message());
+			return false;
+		}
+		return true;
+	}
+
+	bool Camera::ReadCheckpoint(uint64_t renderSceneHash, uint32_t& passNums)
+	{
+		std::ifstream file(checkpointPath, std::ios::binary);
+		if (!file.is_open()) {
+			LOGW("No Checkpoint to Resume: {}", checkpointPath);
+			return false;
+		}
+		CheckpointHeader header{};
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!file || !std::equal(std::begin(checkpointMagic), std::end(checkpointMagic), header.magic) ||
+			header.version != checkpointVersion || header.realBytes != sizeof(Real)) {
+			LOGE("Read Checkpoint Failed: {} is not a checkpoint of this build", checkpointPath);
+			return false;
+		}
+		if (header.settingsHash != GetCheckpointHash() || header.sceneHash != renderSceneHash ||
+			header.imageWidth != static_cast<uint32_t>(imageWidth) || header.imageHeight != static_cast<uint32_t>(imageHeight)) {
+			LOGE("Read Checkpoint Failed: {} is of another scene or camera settings", checkpointPath);
+			return false;
+		}
+		std::vector<PixelStats> stats(pixelStats.size());
+		std::vector<uint32_t> targets(passTargets.size());
+		file.read(reinterpret_cast<char*>(stats.data()), stats.size() * sizeof(PixelStats));
+		file.read(reinterpret_cast<char*>(targets.data()), targets.size() * sizeof(uint32_t));
+		if (!file) {
+			LOGE("Read Checkpoint Failed: {} is truncated", checkpointPath);
+			return false;
+		}
+		pixelStats = std::move(stats);
+		passTargets = std::move(targets);
+		passNums = header.passNums;
+		return true;
+	}
+
+	uint32_t Camera::NextSampleNums(const PixelStats& stats) const
+	{
+		const uint32_t maxSamples = static_cast<uint32_t>(std::max(samplesPerPixel, 1));
+		if (adaptiveRelativeError <= 0.0) {
+			return maxSamples - std::min(stats.sampleNums, maxSamples);
+		}
+		const uint32_t minSamples = std::clamp(static_cast<uint32_t>(std::max(adaptiveMinSamples, 2)), 2u, maxSamples);
+		if (stats.sampleNums < minSamples) {
+			return minSamples - stats.sampleNums;
 		}
-		for (auto& th : threads) {
-			th.join();
+		if (stats.sampleNums >= maxSamples) {
+			return 0;
 		}
-		LOGI("Render End...");
+		// Standard error of the mean luminance, relative to it; dark pixels are held to the error
+		// allowed at adaptiveLuminanceFloor, so they don't soak up the budget.
+		Real error = std::sqrt(stats.MeanVariance()) / std::max(stats.mean, adaptiveLuminanceFloor);
+		if (error <= adaptiveRelativeError) {
+			return 0;
+		}
+		return std::min(static_cast<uint32_t>(std::max(adaptiveStep, 1)), maxSamples - stats.sampleNums);
+	}
+
+	void Camera::PixelStats::AddSample(const color& sample)
+	{
+		sum += sample;
+		++sampleNums;
+		Real luminance = Real(0.2126) * sample.r + Real(0.7152) * sample.g + Real(0.0722) * sample.b;
+		Real delta = luminance - mean;
+		mean += delta / sampleNums;
+		m2 += delta * (luminance - mean);
+	}
+
+	Real Camera::PixelStats::MeanVariance() const
+	{
+		return sampleNums > 1 ? m2 / (Real(sampleNums - 1) * sampleNums) : Real(0);
 	}
 
 	void Camera::Initialize()
 	{
 		imageWidth = (imageWidth < 1) ? 1 : imageWidth;
 		imageHeight = (imageHeight < 1) ? 1 : imageHeight;
-		aspectRatio = double(imageWidth) / double(imageHeight);
+		aspectRatio = Real(imageWidth) / Real(imageHeight);
 
-		colorAttachment.resize(imageWidth * imageHeight, color(0., 0., 0.));
+		colorAttachment.assign(imageWidth * imageHeight, color(0., 0., 0.));
+		sampleCountAttachment.assign(imageWidth * imageHeight, 0);
+		varianceAttachment.assign(imageWidth * imageHeight, 0.0);
+		pixelStats.assign(imageWidth * imageHeight, PixelStats{});
+		passSampleNums.assign(imageWidth * imageHeight, 0);
+		passTargets.assign(imageWidth * imageHeight, 0);
 
-		pixelSamplesScale = 1.0 / samplesPerPixel;
+		sampler = CreateSampler(samplerType, samplesPerPixel, seed);
 
 		center = eye;
 
-		double focalLength = glm::length(eye - lookAt);
-		double theta = glm::radians(fovy);
-		double h = std::tan(theta / 2.0);
+		Real focalLength = glm::length(eye - lookAt);
+		Real theta = glm::radians(fovy);
+		Real h = std::tan(theta / 2);
 
-		double viewportHeight = 2. * h * focalLength;
-		double viewportWidth = viewportHeight * aspectRatio;
+		Real viewportHeight = 2 * h * focalLength;
+		Real viewportWidth = viewportHeight * aspectRatio;
 
 		w = glm::normalize(eye - lookAt);
 		u = glm::normalize(glm::cross(up, w));
@@ -98,63 +425,74 @@ namespace Pooraytracer {
 		vec3 viewportU = viewportWidth * u;
 		vec3 viewportV = viewportHeight * -v;
 
-		pixelDeltaU = viewportU / (double)imageWidth;
-		pixelDeltaV = viewportV / (double)imageHeight;
-		vec3 viewportUpperLeft = center - (focalLength * w) - viewportU / 2. - viewportV / 2.;
-		pixel00Location = viewportUpperLeft + 0.5 * (pixelDeltaU + pixelDeltaV);
+		pixelDeltaU = viewportU / (Real)imageWidth;
+		pixelDeltaV = viewportV / (Real)imageHeight;
+		vec3 viewportUpperLeft = center - (focalLength * w) - viewportU / Real(2) - viewportV / Real(2);
+		pixel00Location = viewportUpperLeft + Real(0.5) * (pixelDeltaU + pixelDeltaV);
 
 	}
 
-	Ray Camera::GetRay(int i, int j) const
+	Ray Camera::GetRay(int i, int j, uint32_t sampleIndex) const
 	{
-		//vec2 offset = SampleSquare();
-		//vec3 pixelSample = pixel00Location + ((double)i+offset.x) * pixelDeltaU + ((double)j+offset.y) * pixelDeltaV;
-		vec3 pixelSample = pixel00Location + ((double)i) * pixelDeltaU + ((double)j) * pixelDeltaV;
+		// Box filter: a point anywhere in the pixel, from the sampler's first two dimensions.
+		vec2 offset = sampler->Get2D(i + j * imageWidth, sampleIndex, 0) - vec2(0.5);
+		vec3 pixelSample = pixel00Location + ((Real)i + offset.x) * pixelDeltaU + ((Real)j + offset.y) * pixelDeltaV;
 		vec3 origin = center;
 		vec3 direction = pixelSample - origin;
 
 		return Ray(origin, direction);
 	}
 
+	void Camera::StartBounce(int depth, uint32_t offset, uint32_t dimensionNums) const
+	{
+		ThreadSampleStream().StartDimensions(cameraDimensions + (maxDepth - depth) * bounceDimensions + offset, dimensionNums);
+	}
+
 	color Camera::RayColor(const Ray& ray, int depth, const Hittable& world, const Hittable& lights)
 	{
 		if (depth < 0.) {
 			return color(0., 0., 0.);
 		}
 		HitRecord record;
-		if (!world.Hit(ray, Interval(0.0001, std::numeric_limits<double>::infinity()), record))
+		// Secondary rays start past their surface's error bound (HitRecord::SpawnRay), so no epsilon is needed.
+		if (!world.Hit(ray, Interval(0.0, Infinity), record))
 		{
 			return background;
 		}
-		if (record.material->HasEmission())
+		record.SetShadingAttributes(ray);
+		return ShadeHit(ray, record, depth, world, lights);
+	}
+
+	template <typename M>
+	color Camera::ShadeHit(const Ray& ray, const HitRecord& record, const M& material, int depth, const Hittable& world, const Hittable& lights)
+	{
+		if (material.HasEmission())
 		{
-			return record.material->GetEmission();
+			return material.GetEmission();
 		}
 		const point3& ps = record.position; // shade point
 
 		color direct{ 0.,0.,0. }, scatter{ 0.,0.,0. };
 
-		if (bSampleLights && !record.material->SkipLightSampling())
+		if (bSampleLights && !material.SkipLightSampling())
 		{
-			double pdfLights = 0.0;
+			StartBounce(depth, lightDimension, lightDimensions);
+			Real pdfLights = 0.0;
 			HitRecord lightsSamplePointRecord;
 			lights.Sample(ps, lightsSamplePointRecord, pdfLights); // sample lights from shade point
 			const point3& pl = lightsSamplePointRecord.position; // light sample point
 			vec3 lightDirection = glm::normalize(pl - ps);		 // shade point to light sample point
 			vec3 lightNormal = lightsSamplePointRecord.normal;
-			std::shared_ptr<Material> lightMaterial = lightsSamplePointRecord.material;
+			const Material* lightMaterial = lightsSamplePointRecord.material;
 
-			HitRecord lightRayHitRecord;
-			double distance = glm::length(pl - ps);
-			Ray shadePoint2LightRay(ps, lightDirection);
-			world.Hit(shadePoint2LightRay, Interval(0.001, std::numeric_limits<double>::max()), lightRayHitRecord);
+			Real distance = glm::length(pl - ps);
+			Ray shadePoint2LightRay = record.SpawnRayTo(lightsSamplePointRecord);
 
-			const point3& pNearest = lightRayHitRecord.position;
 			if (glm::dot(record.normal, lightDirection) > 0.0 && // light direction is in the same side of eye's ray
 				lightsSamplePointRecord.bFrontFace && // light area is front to shade point
-				distance - glm::length(ps - pNearest) < 0.001) { // shade point is visible to light
+				!world.Occluded(shadePoint2LightRay, Interval(0.0, 1 - ShadowEpsilon))) { // shade point is visible to light
 
-				color emission = lightMaterial->GetEmission();
+				color emission = lightMaterial->Dispatch([](const auto& light) { return light.GetEmission(); });
 				MaterialEvalContext context;
 				context.p = record.position;
 				context.uv = record.uv;
@@ -165,9 +503,11 @@ namespace Pooraytracer {
 				// Transform all vector to shade point's local space.
 				const vec3& localWi = Material::WorldToLocal(lightDirection, record);
 				const vec3& localLightNormal = Material::WorldToLocal(lightNormal, record);
-				vec3 fr = record.material->Eval(localWi, context);
-				double cosTheta = localWi.z; // θ: the angle of light direction and face normal
-				double cosThetaBar = glm::dot(localLightNormal, -localWi);  // θ': the angle of light area normal and light direcction
+				// Only reached for visible lights, so whatever Eval draws comes from a generator.
+				StartBounce(depth, evalDimension, 0);
+				vec3 fr = material.Eval(localWi, context);
+				Real cosTheta = localWi.z; // θ: the angle of light direction and face normal
+				Real cosThetaBar = glm::dot(localLightNormal, -localWi);  // θ': the angle of light area normal and light direcction
 
 				direct = emission * fr * cosTheta * cosThetaBar / (distance * distance) / pdfLights;
 			}
@@ -177,19 +517,22 @@ namespace Pooraytracer {
 		color attenuation; // attenuation =  fr * cosθ / pdf(wi) : Indirect illumination
 		HitRecord scatteredRecord;
 		// russian roulette
+		StartBounce(depth, rouletteDimension, 1);
 		if (RandomDouble() < russianRoulette)
 		{
-			if (record.material->Scatter(ray, record, attenuation, scatteredRay))
+			StartBounce(depth, bsdfDimension, bsdfDimensions);
+			if (material.Scatter(ray, record, attenuation, scatteredRay))
 			{
 				if (bSampleLights)
 				{
 					HitRecord scatterRayHitRecord;
-					if (world.Hit(scatteredRay, Interval(0.0001, std::numeric_limits<double>::infinity()), scatterRayHitRecord)) {
-						if (!scatterRayHitRecord.material->HasEmission()) {
+					if (world.Hit(scatteredRay, Interval(0.0, Infinity), scatterRayHitRecord)) {
+						scatterRayHitRecord.SetShadingAttributes(scatteredRay);
+						if (!scatterRayHitRecord.material->Dispatch([](const auto& next) { return next.HasEmission(); })) {
 							scatter = attenuation * RayColor(scatteredRay, depth - 1, world, lights) / russianRoulette;
 						}
 						else {
-							if (record.material->SkipLightSampling()) { // Perfect Specular or Phone Reflectance Ns > 1
+							if (material.SkipLightSampling()) { // Perfect Specular or Phone Reflectance Ns > 1
 								scatter = attenuation * RayColor(scatteredRay, depth - 1, world, lights) / russianRoulette;
 							}
 						}
@@ -203,6 +546,236 @@ namespace Pooraytracer {
 		return direct + scatter;
 	}
 
+	color Camera::ShadeHit(const Ray& ray, const HitRecord& record, int depth, const Hittable& world, const Hittable& lights)
+	{
+		// One switch on the material's type; the shading above then calls the concrete class directly.
+		return record.material->Dispatch([&](const auto& material) { return ShadeHit(ray, record, material, depth, world, lights); });
+	}
+
+	// Sort key grouping rays that will traverse similar parts of the scene: direction octant first,
+	// then the Morton code of the origin quantized to 10 bits per axis within `bounds`.
+	static uint64_t RaySortKey(const Ray& ray, const AABB& bounds)
+	{
+		auto expandBits = [](uint64_t x) {
+			x = (x | (x << 16)) & 0x030000FF;
+			x = (x | (x << 8)) & 0x0300F00F;
+			x = (x | (x << 4)) & 0x030C30C3;
+			x = (x | (x << 2)) & 0x09249249;
+			return x;
+			};
+		uint64_t morton = 0;
+		for (int axis = 0; axis < 3; ++axis) {
+			const Interval& extent = bounds.GetAxisInterval(axis);
+			Real x = extent.Length() > 0.0 ? (ray.origin[axis] - extent.min) / extent.Length() : Real(0);
+			uint64_t cell = static_cast<uint64_t>(std::clamp(x, Real(0), Real(1)) * 1023);
+			morton |= expandBits(cell) << (2 - axis);
+		}
+		uint64_t octant = (ray.direction.x < 0.0 ? 4 : 0) | (ray.direction.y < 0.0 ? 2 : 0) | (ray.direction.z < 0.0 ? 1 : 0);
+		return (octant << 30) | morton;
+	}
+
+	void Camera::RenderWavefront(uint32_t yMin, uint32_t yMax, const Hittable& world, const Hittable& lights)
+	{
+		// One path per pixel sample. Misses add the background only where RayColor would: on primary
+		// rays, or everywhere without light sampling; emitters likewise unless the last bounce was
+		// sampled through next event estimation.
+		// Radiance is summed per pixel sample (`sample` indexes the batch's samples) and added to
+		// the pixels in sample order at the end of the batch, so the sums don't depend on the order
+		// the queues were processed in. The work is rows [yMin, yMax), with the pass's samples.
+		struct PathState {
+			Ray ray;
+			color throughput;
+			uint64_t sortKey;
+			uint32_t sample;
+			int depth;
+			bool bCountEmission;
+			bool bCountBackground;
+		};
+		struct ShadowRay {
+			Ray ray;
+			color contribution;
+			uint64_t sortKey;
+			uint32_t sample;
+		};
+
+		const AABB bounds = world.BoundingBox();
+
+		std::vector<PathState> paths, nextPaths;
+		std::vector<ShadowRay> shadowRays;
+		std::vector<HitRecord> records;
+		std::vector<uint32_t> shadeOrder;
+		std::vector<std::pair<uint64_t, uint32_t>> materialKeys;
+		std::vector<color> radiance;
+		std::vector<std::pair<uint32_t, uint32_t>> samples;	// pixel and sample index, per batch sample
+		std::vector<uint8_t> bResults;		// hit, or occluded, so far
+		std::vector<uint32_t> deferred;
+
+		auto finishExtend = [&](uint32_t idx) {
+			const PathState& path = paths[idx];
+			if (bResults[idx]) {
+				records[idx].SetShadingAttributes(path.ray);
+				const Material* material = records[idx].material;
+				materialKeys.push_back({ (uint64_t(material->GetType()) << 56) ^ reinterpret_cast<uintptr_t>(material), idx });
+			}
+			else if (path.bCountBackground) {
+				radiance[path.sample] += path.throughput * background;
+			}
+		};
+		auto finishShadow = [&](uint32_t idx) {
+			if (!bResults[idx]) {
+				radiance[shadowRays[idx].sample] += shadowRays[idx].contribution;
+			}
+		};
+		// Traces [0, nums) without waiting for streamed geometry: rays that skipped chunks not in
+		// memory keep their result so far and are finished after the skipped chunks were tested,
+		// chunk by chunk, so each chunk is loaded at most once per pass.
+		auto traceDeferring = [&](uint32_t nums, const auto& trace, const auto& resume, const auto& finish) {
+			bResults.assign(nums, false);
+			deferred.clear();
+			StreamedGeometry::SetDeferMisses(true);
+			for (uint32_t idx = 0; idx < nums; ++idx) {
+				bResults[idx] = trace(idx);
+				if (StreamedGeometry::TakeDeferred(idx)) {
+					deferred.push_back(idx);
+				}
+				else {
+					finish(idx);
+				}
+			}
+			StreamedGeometry::SetDeferMisses(false);
+			if (!deferred.empty()) {
+				StreamedGeometry::ResumeDeferred(resume);
+				for (uint32_t idx : deferred) {
+					finish(idx);
+				}
+			}
+		};
+		auto extend = [&](uint32_t idx) {
+			return world.Hit(paths[idx].ray, Interval(0.0, Infinity), records[idx]);
+		};
+		auto resumeExtend = [&](const Hittable& chunk, const Ray& ray, uint32_t idx) {
+			Interval domain(0.0, bResults[idx] ? records[idx].time : Infinity);
+			if (chunk.BoundingBox().Hit(ray, domain) && chunk.Hit(ray, domain, records[idx])) {
+				bResults[idx] = true;
+			}
+		};
+		auto shadow = [&](uint32_t idx) {
+			return world.Occluded(shadowRays[idx].ray, Interval(0.0, 1 - ShadowEpsilon));
+		};
+		auto resumeShadow = [&](const Hittable& chunk, const Ray& ray, uint32_t idx) {
+			Interval domain(0.0, 1 - ShadowEpsilon);
+			if (!bResults[idx] && chunk.BoundingBox().Hit(ray, domain) && chunk.Occluded(ray, domain)) {
+				bResults[idx] = true;
+			}
+		};
+
+		// Batches of at most wavefrontBatchPaths paths, in pixel and sample order, so memory doesn't
+		// grow with the sample count; a pixel's samples may span batches. Sample indices count from
+		// the pixel's samples before the pass.
+		uint32_t pixel = yMin * imageWidth;
+		const uint32_t pixelEnd = yMax * imageWidth;
+		uint32_t nextSample = 0;	// of `pixel`, in the pass
+		while (pixel < pixelEnd) {
+			paths.clear();
+			samples.clear();
+			while (pixel < pixelEnd && paths.size() < wavefrontBatchPaths) {
+				if (nextSample == passSampleNums[pixel]) {
+					++pixel;
+					nextSample = 0;
+					continue;
+				}
+				uint32_t sampleIndex = passTargets[pixel] - passSampleNums[pixel] + nextSample++;
+				paths.push_back({ GetRay(pixel % imageWidth, pixel / imageWidth, sampleIndex), color(1.0), 0, static_cast<uint32_t>(paths.size()),
+					maxDepth, true, true });
+				samples.push_back({ pixel, sampleIndex });
+			}
+			radiance.assign(paths.size(), color(0.0));
+
+			while (!paths.empty()) {
+				// Extend: trace every path's next segment, in ray order.
+				for (PathState& path : paths) {
+					path.sortKey = RaySortKey(path.ray, bounds);
+				}
+				std::sort(paths.begin(), paths.end(), [](const PathState& a, const PathState& b) { return a.sortKey < b.sortKey; });
+				records.resize(paths.size());
+				materialKeys.clear();
+				traceDeferring(static_cast<uint32_t>(paths.size()), extend, resumeExtend, finishExtend);
+
+				// Shade: hits grouped by material, so each group runs the same shading code back to back.
+				std::sort(materialKeys.begin(), materialKeys.end());
+				nextPaths.clear();
+				shadowRays.clear();
+				for (const auto& [key, idx] : materialKeys) {
+					const PathState& path = paths[idx];
+					const HitRecord& record = records[idx];
+					ThreadSampleStream().StartPixelSample(sampler.get(), samples[path.sample].first, samples[path.sample].second);
+					record.material->Dispatch([&](const auto& material) {
+						if (material.HasEmission()) {
+							if (path.bCountEmission) {
+								radiance[path.sample] += path.throughput * material.GetEmission();
+							}
+							return;
+						}
+						const point3& ps = record.position;
+
+						if (bSampleLights && !material.SkipLightSampling()) {
+							StartBounce(path.depth, lightDimension, lightDimensions);
+							Real pdfLights = 0.0;
+							HitRecord lightsSamplePointRecord;
+							lights.Sample(ps, lightsSamplePointRecord, pdfLights);
+							const point3& pl = lightsSamplePointRecord.position;
+							vec3 lightDirection = glm::normalize(pl - ps);
+							Real distance = glm::length(pl - ps);
+
+							// The shadow ray is only queued when the light could contribute at all.
+							if (glm::dot(record.normal, lightDirection) > 0.0 && lightsSamplePointRecord.bFrontFace) {
+								MaterialEvalContext context;
+								context.p = record.position;
+								context.uv = record.uv;
+								context.n = record.normal;
+								context.dpdus = record.tangent;
+								context.wo = Material::WorldToLocal(-path.ray.direction, record);
+
+								const vec3& localWi = Material::WorldToLocal(lightDirection, record);
+								const vec3& localLightNormal = Material::WorldToLocal(lightsSamplePointRecord.normal, record);
+								StartBounce(path.depth, evalDimension, 0);
+								vec3 fr = material.Eval(localWi, context);
+								Real cosTheta = localWi.z;
+								Real cosThetaBar = glm::dot(localLightNormal, -localWi);
+
+								color emission = lightsSamplePointRecord.material->Dispatch([](const auto& light) { return light.GetEmission(); });
+								color direct = emission * fr * cosTheta * cosThetaBar / (distance * distance) / pdfLights;
+								shadowRays.push_back({ record.SpawnRayTo(lightsSamplePointRecord), path.throughput * direct, 0, path.sample });
+							}
+						}
+
+						Ray scatteredRay;
+						color attenuation;
+						StartBounce(path.depth, rouletteDimension, 1);
+						bool bSurvives = path.depth > 0 && RandomDouble() < russianRoulette;
+						StartBounce(path.depth, bsdfDimension, bsdfDimensions);
+						if (bSurvives && material.Scatter(path.ray, record, attenuation, scatteredRay)) {
+							bool bSkipLightSampling = material.SkipLightSampling();
+							nextPaths.push_back({ scatteredRay, path.throughput * attenuation / russianRoulette, 0, path.sample, path.depth - 1,
+								!bSampleLights || bSkipLightSampling, !bSampleLights });
+						}
+					});
+				}
+
+				// Shadow: any-hit queries for the queued light samples.
+				for (ShadowRay& shadowRay : shadowRays) {
+					shadowRay.sortKey = RaySortKey(shadowRay.ray, bounds);
+				}
+				std::sort(shadowRays.begin(), shadowRays.end(), [](const ShadowRay& a, const ShadowRay& b) { return a.sortKey < b.sortKey; });
+				traceDeferring(static_cast<uint32_t>(shadowRays.size()), shadow, resumeShadow, finishShadow);
+				paths.swap(nextPaths);
+			}
+			for (uint32_t sample = 0; sample < radiance.size(); ++sample) {
+				pixelStats[samples[sample].first].AddSample(radiance[sample]);
+			}
+		}
+	}
+
 	color Camera::LinearToSRGB(color linearColor) const
 	{
 		color srgbColor = color(
@@ -213,7 +786,7 @@ namespace Pooraytracer {
 		return srgbColor;
 	}
 
-	double Camera::LinearToSRGB(double linearColorComponent) const
+	Real Camera::LinearToSRGB(Real linearColorComponent) const
 	{
 		if (linearColorComponent <= 0.0031308)
 			return 12.92 * linearColorComponent;
@@ -222,9 +795,9 @@ namespace Pooraytracer {
 
 	color Camera::ExponentialToneMapping(color linearColor) const
 	{
-		const double exposure = 0.5;
+		const Real exposure = 0.5;
 		color hdrColor = color(
-			1.0 - glm::exp(-exposure * linearColor)
+			Real(1) - glm::exp(-exposure * linearColor)
 		);
 		return hdrColor;
 	}
@@ -256,8 +829,8 @@ namespace Pooraytracer {
 
 		static auto RRTAndODTFit = [](vec3 v)
 			{
-				vec3 a = v * (v + 0.0245786) - 0.000090537;
-				vec3 b = v * (0.983729 * v + 0.4329510) + 0.238081;
+				vec3 a = v * (v + Real(0.0245786)) - Real(0.000090537);
+				vec3 b = v * (Real(0.983729) * v + Real(0.4329510)) + Real(0.238081);
 				return a / b;
 			};
 
@@ -270,7 +843,7 @@ namespace Pooraytracer {
 		x = x * ACESOutputMat;
 
 		// Clamp to [0, 1]
-		x = glm::clamp(x, 0., 1.);
+		x = glm::clamp(x, Real(0), Real(1));
 
 		return x;
 
@@ -329,10 +902,27 @@ namespace Pooraytracer {
 		}
 
 	}
+	void Camera::WriteAOVs(const std::string& outputPath) const
+	{
+		const std::string basePath = outputPath.substr(0, outputPath.find_last_of('.'));
+		std::vector<float> sampleCounts(imageHeight * imageWidth * 3), variances(imageHeight * imageWidth * 3);
+		for (size_t idx = 0; idx < sampleCountAttachment.size(); ++idx) {
+			for (int c = 0; c < 3; ++c) {
+				sampleCounts[idx * 3 + c] = static_cast<float>(sampleCountAttachment[idx]);
+				variances[idx * 3 + c] = static_cast<float>(varianceAttachment[idx]);
+			}
+		}
+		stbi_write_hdr((basePath + "_spp.hdr").c_str(), imageWidth, imageHeight, 3, sampleCounts.data());
+		stbi_write_hdr((basePath + "_variance.hdr").c_str(), imageWidth, imageHeight, 3, variances.data());
+	}
+
 	std::string Camera::GetParametersStr() const
 	{
 		std::stringstream ss;
-		ss << "spp" << samplesPerPixel << "-depth" << maxDepth;
+		ss << "spp" << samplesPerPixel << "-depth" << maxDepth << "-" << GetSamplerTypeName(samplerType);
+		if (adaptiveRelativeError > 0.0) {
+			ss << "-adaptive" << adaptiveRelativeError;
+		}
 		return ss.str();
 	}
 
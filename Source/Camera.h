@@ -1,12 +1,11 @@
 #pragma once
 
-#include <glm/vec3.hpp>
 #include "HittableList.h"
+#include "Real.h"
+#include "Sampler.h"
 #include <string>
 
 namespace Pooraytracer {
-	using vec3 = glm::dvec3;
-	using color = glm::dvec3;
 	class Ray;
 	class Camera {
 
@@ -17,36 +16,130 @@ namespace Pooraytracer {
 		int threadNums = 16;
 		int maxDepth = 10;
 		color background = color(0.,0.,0.);
+		// Where the sample values of the pixel offsets, light samples and BSDF samples come from.
+		SamplerType samplerType = SamplerType::Sobol;
+		// Randomizes the sampler: the same seed renders the same image, whatever the thread count
+		// or scheduling.
+		uint64_t seed = 0;
 
-		double fovy = 90.;
+		Real fovy = 90.;
 		vec3 eye = vec3(0., 0., 0.);
 		vec3 lookAt = vec3(0., 0., -1.);
 		vec3 up = vec3(0., 1., 0.);
 
 		std::vector <color> colorAttachment;
+		// Per pixel, filled by Render: the samples taken, and the variance of the pixel's mean
+		// luminance (its squared standard error).
+		std::vector<uint32_t> sampleCountAttachment;
+		std::vector<Real> varianceAttachment;
 		void Render(Hittable& world, Hittable& lights);
 		void WriteColorAttachment(const std::string& outputPath, bool bWriteHDR=true) const;
+		// Writes the sample count and variance images next to `outputPath`, as _spp.hdr and _variance.hdr.
+		void WriteAOVs(const std::string& outputPath) const;
 		std::string GetParametersStr() const;
 		void SetViewParametersByXmlFile(const std::string& xmlFilePath);
 
 		bool bSampleLights = true;
-		double russianRoulette = 0.8;
+		Real russianRoulette = 0.8;
+		// Trace primary rays in packets of packetTileSize x packetTileSize pixels.
+		bool bPrimaryRayPackets = true;
+		static constexpr int packetTileSize = 8;
+		// Breadth-first (wavefront) integrator: all paths of a batch advance one bounce per pass,
+		// through sorted extension, shading and shadow queues. Same estimator as RayColor.
+		// Rays reaching StreamedGeometry chunks that are not in memory are finished after the pass
+		// has gone through those chunks one at a time, instead of each waiting for the disk.
+		bool bWavefront = false;
+		// Paths in flight per thread, whatever the sample count.
+		static constexpr size_t wavefrontBatchPaths = 1 << 16;
+		// Adaptive sampling: after adaptiveMinSamples, pixels get adaptiveStep samples per pass
+		// until the standard error of their mean luminance is within adaptiveRelativeError of it,
+		// or they have samplesPerPixel. 0 takes samplesPerPixel everywhere.
+		Real adaptiveRelativeError = 0.0;
+		int adaptiveMinSamples = 64;
+		int adaptiveStep = 64;
+		// Luminance below which the allowed error stays that of this luminance.
+		Real adaptiveLuminanceFloor = 0.01;
+		// Progressive rendering: passes of at most progressiveSamples per pixel over the whole image,
+		// the image resolved after each, until samplesPerPixel or timeBudgetSeconds (0: none) is
+		// reached, whichever comes first; the first pass always completes, so every pixel has a
+		// sample. Every snapshotIntervalSeconds the image so far is written to snapshotPath, if set.
+		// 0 takes all samples in one pass.
+		int progressiveSamples = 0;
+		double timeBudgetSeconds = 0.0;
+		std::string snapshotPath;
+		double snapshotIntervalSeconds = 60.0;
+		// Checkpoints: if checkpointPath is set, the per-pixel sample sums and statistics are written
+		// to it every checkpointIntervalSeconds between passes, and when the render stops. With
+		// bResumeFromCheckpoint, Render continues from a checkpoint of the same camera settings and
+		// scene and ends with the same image as an uninterrupted run. A render of one pass is only
+		// checkpointed at its end, so long renders want progressiveSamples.
+		std::string checkpointPath;
+		double checkpointIntervalSeconds = 600.0;
+		bool bResumeFromCheckpoint = false;
+		// Identifies the scene in checkpoints, e.g. a hash of its files. Render adds the bounds and
+		// area of the world and the lights.
+		uint64_t sceneHash = 0;
 
 	private:
-		double aspectRatio;			// Ratio of image width over height
-		double pixelSamplesScale;	// 1.0/samplesPerPixel
+		Real aspectRatio;			// Ratio of image width over height
 		vec3 center;
 		vec3 pixel00Location;		// Location of pixel 0, 0 (Upper right)
 		vec3 pixelDeltaU;			// Offset to pixel to the right
 		vec3 pixelDeltaV;			// Offset to pixel below
 		vec3 u, v, w;				// Camera frame basis vectors
+		std::shared_ptr<Sampler> sampler;
+		// Running sums of a pixel's samples; mean and m2 of their luminance by Welford's algorithm.
+		struct PixelStats {
+			color sum = color(0.0);
+			uint32_t sampleNums = 0;
+			Real mean = 0.0;
+			Real m2 = 0.0;
+
+			void AddSample(const color& sample);
+			Real MeanVariance() const;
+		};
+		std::vector<PixelStats> pixelStats;
+		std::vector<uint32_t> passSampleNums;	// per pixel, in the current pass
+		std::vector<uint32_t> passTargets;		// per pixel, its sample count once the current pass is done
+		// Sampler dimensions: the pixel offset, then a block per bounce in which every use starts at
+		// its own offset, whatever the uses before it drew: light choice and position, russian
+		// roulette, BSDF lobe and direction. Draws past a use's dimensions, and draws whose number
+		// varies from sample to sample (rejection loops, a stochastic Eval), come from a generator
+		// seeded by the use, so they never shift the dimensions another use reads.
+		static constexpr uint32_t cameraDimensions = 2;
+		// Light choice and position: the lights list holds one BVH, which draws the area offset of
+		// its triangle, and the triangle draws its two barycentrics (checked in Triangle::Sample).
+		static constexpr uint32_t lightDimension = 0;
+		static constexpr uint32_t lightDimensions = 3;
+		static constexpr uint32_t rouletteDimension = 3;
+		static constexpr uint32_t bsdfDimension = 4;		// lobe, then direction
+		static constexpr uint32_t bsdfDimensions = 3;
+		static constexpr uint32_t evalDimension = 7;		// the generator of Eval at the light sample only
+		static constexpr uint32_t bounceDimensions = 8;
 
 		void Initialize();
-		Ray GetRay(int i, int j) const;
+		Ray GetRay(int i, int j, uint32_t sampleIndex) const;
+		// colorAttachment, sampleCountAttachment and varianceAttachment from pixelStats.
+		void ResolveAttachments();
+		// Hash of the settings that decide the samples and how they are taken; not the thread count.
+		uint64_t GetCheckpointHash() const;
+		// The pixel statistics, the targets of the pass in progress and the passes done. A checkpoint
+		// that cannot be read or is of another render is reported and left alone.
+		bool WriteCheckpoint(uint64_t renderSceneHash, uint32_t passNums) const;
+		bool ReadCheckpoint(uint64_t renderSceneHash, uint32_t& passNums);
+		// Samples the pixel takes in the next pass.
+		uint32_t NextSampleNums(const PixelStats& stats) const;
+		// Points this thread's RandomDouble() at dimensionNums dimensions from `offset` in the block
+		// of the bounce at `depth`, then at the generator of that offset.
+		void StartBounce(int depth, uint32_t offset, uint32_t dimensionNums) const;
 		color RayColor(const Ray& ray, int depth, const Hittable& world, const Hittable& lights);
+		color ShadeHit(const Ray& ray, const HitRecord& record, int depth, const Hittable& world, const Hittable& lights);
+		template <typename M>
+		color ShadeHit(const Ray& ray, const HitRecord& record, const M& material, int depth, const Hittable& world, const Hittable& lights);
+		void RenderWavefront(uint32_t yMin, uint32_t yMax, const Hittable& world, const Hittable& lights);
 
 		color LinearToSRGB(color linearColor) const;
-		double LinearToSRGB(double linearColorComponent) const;
+		Real LinearToSRGB(Real linearColorComponent) const;
 		color ExponentialToneMapping(color linearColor) const;
 		color ACESFilmToneMapping(color linearColor) const;
 	};
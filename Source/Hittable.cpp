@@ -1,14 +1,47 @@
 #include "Hittable.h"
+#include "Instance.h"
 #include "Ray.h"
 
 #include <glm/geometric.hpp>
 
 namespace Pooraytracer {
 
+	void HitRecord::SetShadingAttributes(const Ray& ray)
+	{
+		if (instance == nullptr) {
+			primitive->SetHitRecord(ray, *this);
+			return;
+		}
+		primitive->SetHitRecord(instance->WorldToObject(ray), *this);
+		instance->ObjectToWorld(*this);
+	}
+
 	void HitRecord::SetFaceNormal(const Ray& ray, const vec3& outwordNormal)
 	{
 		// NOTE: the parameter `outwordNormal` is assumed to have unit length.
 		bFrontFace = glm::dot(ray.direction, outwordNormal) < 0.;
 		normal = bFrontFace ? outwordNormal : -outwordNormal;
 	}
+
+	Ray HitRecord::SpawnRay(const vec3& direction) const
+	{
+		return Ray(OffsetRayOrigin(position, positionError, normal, direction), direction);
+	}
+
+	Ray HitRecord::SpawnRayTo(const HitRecord& target) const
+	{
+		vec3 origin = OffsetRayOrigin(position, positionError, normal, target.position - position);
+		vec3 end = OffsetRayOrigin(target.position, target.positionError, target.normal, origin - target.position);
+		return Ray(origin, end - origin);
+	}
+
+	void Hittable::HitPacket(const RayPacket& packet, Interval domain, RayPacketHits& hits) const
+	{
+		for (int r = 0; r < packet.rayNums; ++r) {
+			if (Hit(packet.rays[r], Interval(domain.min, hits.closest[r]), hits.records[r])) {
+				hits.closest[r] = hits.records[r].time;
+				hits.bUpdated[r] = true;
+			}
+		}
+	}
 }
@@ -1,39 +1,93 @@
 #pragma once
 
-#include <glm/vec2.hpp>
-#include <glm/vec3.hpp>
+#include <cstdint>
 #include <memory>
 #include "AABB.h"
+#include "RayPacket.h"
+#include "Real.h"
 
 namespace Pooraytracer {
 
-	using vec3 = glm::dvec3;
-	using vec2 = glm::dvec2;
-	using point3 = glm::dvec3;
-
 	class Ray;
 	class Material;
+	class Hittable;
+	class Instance;
+
+	// Fraction of a shadow ray's length kept clear in front of the light sample, whose own
+	// error bound is already accounted for by SpawnRayTo.
+	constexpr Real ShadowEpsilon = 0.0001;
 
+	// Traversal only records where the closest hit so far is: its time, the primitive and the
+	// barycentrics on it. The shading attributes below are filled once the closest hit is known,
+	// by SetShadingAttributes(); light samples fill them directly.
 	class HitRecord {
 	public:
+		Real time;
+		Real alpha, beta;
+		const Hittable* primitive = nullptr;
+		uint32_t primitiveIndex = 0;		// which part of `primitive` was hit, for primitives made of several
+		const Instance* instance = nullptr;	// placing `primitive` in the world, if transformed
+
 		vec3 position;
-		double time;
+		vec3 positionError;	// absolute bound on the rounding error of `position`, per axis
 		vec3 normal; // in the same side with the ray
 		vec3 tangent;
 		vec2 uv;
-		std::shared_ptr<Material> material; // [TODO]
+		const Material* material = nullptr;	// owned by the mesh
 		bool bFrontFace;
 
+		// `ray` is the one the hit was found with.
+		void SetShadingAttributes(const Ray& ray);
 		void SetFaceNormal(const Ray& ray, const vec3& outwordNormal);
+		// Ray leaving the surface, started past the error bound so it cannot hit the surface again; trace it from t = 0.
+		Ray SpawnRay(const vec3& direction) const;
+		// Ray towards another surface point (a light sample); both ends are offset, so the target
+		// is reached at t = 1 and the ray should be traced over [0, 1 - ShadowEpsilon].
+		Ray SpawnRayTo(const HitRecord& target) const;
+	};
+
+	// Per-ray results of a packet query. `closest` starts at the far end of the query interval;
+	// whatever finds a closer hit for a ray updates its time and record and sets `bUpdated`.
+	// As with Hit(), the records only hold the hits, not their shading attributes.
+	class RayPacketHits {
+	public:
+		void Reset(int rayNums, Real tMax) {
+			std::fill(closest, closest + rayNums, tMax);
+			std::fill(bUpdated, bUpdated + rayNums, false);
+		}
+	public:
+		Real closest[RayPacket::maxRays];
+		bool bUpdated[RayPacket::maxRays];
+		HitRecord records[RayPacket::maxRays];
 	};
 
 
 	class Hittable {
 	public:
 		virtual ~Hittable() = default;
+		// Closest hit in `domain`. Only the hit itself is recorded (see HitRecord), and the record
+		// is left untouched on a miss.
 		virtual bool Hit(const Ray& ray, Interval domain, HitRecord& record) const = 0;
+		// Any-hit query for shadow rays: true as soon as something is hit in `domain`, no record is filled.
+		virtual bool Occluded(const Ray& ray, Interval domain) const {
+			HitRecord record;
+			return Hit(ray, domain, record);
+		}
+		// Closest hits of a whole packet; the default traces its rays one by one.
+		virtual void HitPacket(const RayPacket& packet, Interval domain, RayPacketHits& hits) const;
 		virtual AABB BoundingBox() const = 0;
-		virtual void Sample(const point3& origin, HitRecord& samplePointRecord, double& pdf) const {}
-		virtual double GetArea() const { return 0.0; }
+		virtual void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const {}
+		// Sample the primitive found at area offset `p` in [0, GetArea()); acceleration structures
+		// descend with the same `p`, primitives sample themselves and return `pdf` scaled by their area.
+		virtual void SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const {
+			Sample(origin, samplePointRecord, pdf);
+			pdf *= GetArea();
+		}
+		virtual Real GetArea() const { return 0.0; }
+		// Shading attributes of a hit on this primitive, in the space of `ray`.
+		virtual void SetHitRecord(const Ray& ray, HitRecord& record) const {}
+		// Recompute cached bounds and areas after the children moved. Only this level is refit,
+		// so nested structures are refit bottom-up by the caller (each shared one once).
+		virtual void Refit() {}
 	};
 }
\ No newline at end of file
@@ -24,29 +24,48 @@ namespace Pooraytracer {
 		}
 
 		bool Hit(const Ray& ray, Interval domain, HitRecord& record) const override {
-			HitRecord tempRecord;
 			bool bHitAnything = false;
 
-			double rightBound = domain.max;
+			Real rightBound = domain.max;
 			for (const auto& object : objects) {
-				if (object->Hit(ray, Interval(domain.min, rightBound), tempRecord)) {
+				if (object->Hit(ray, Interval(domain.min, rightBound), record)) {
 					bHitAnything = true;
-					rightBound = tempRecord.time;
-					record = tempRecord;
+					rightBound = record.time;
 				}
 			}
 			return bHitAnything;
 		}
+		bool Occluded(const Ray& ray, Interval domain) const override {
+			for (const auto& object : objects) {
+				if (object->Occluded(ray, domain)) {
+					return true;
+				}
+			}
+			return false;
+		}
 		AABB BoundingBox() const override { return bbox; }
-		double GetArea() const override {
+		void Refit() override {
+			bbox = AABB::empty;
+			area = 0.0;
+			for (const auto& object : objects) {
+				area += object->GetArea();
+				bbox = AABB(bbox, object->BoundingBox());
+			}
+		}
+		Real GetArea() const override {
 			return area;
 		}
-		void Sample(const point3& origin, HitRecord& samplePointRecord, double& pdf) const override{
-			double areaSum = 0.0;
+		void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const override{
+			// Nothing to choose: the object gets all the dimensions (Camera::lightDimensions).
+			if (objects.size() == 1) {
+				objects[0]->Sample(origin, samplePointRecord, pdf);
+				return;
+			}
+			Real areaSum = 0.0;
 			for (const auto& object : objects) {
 				areaSum += object->GetArea();
 			}
-			double p = RandomDouble() * areaSum;
+			Real p = RandomDouble() * areaSum;
 
 			areaSum = 0.0;
 			for (const auto& object : objects) {
@@ -59,6 +78,6 @@ namespace Pooraytracer {
 		}
 	public:
 		AABB bbox;
-		double area = 0.0;
+		Real area = 0.0;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "Instance.h"
+#include "Ray.h"
+#include "RandomNumberGenerator.h"
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace Pooraytracer {
+
+	Instance::Instance(shared_ptr<Hittable> object) :Instance(object, mat4(1.0))
+	{
+	}
+
+	Instance::Instance(shared_ptr<Hittable> object, const mat4& objectToWorld) :object(object)
+	{
+		SetTransform(objectToWorld);
+	}
+
+	void Instance::SetTransform(const mat4& objectToWorld)
+	{
+		linear = mat3(objectToWorld);
+		translation = vec3(objectToWorld[3]);
+		absLinear = mat3(glm::abs(linear[0]), glm::abs(linear[1]), glm::abs(linear[2]));
+		invLinear = glm::inverse(linear);
+		normalMatrix = glm::transpose(invLinear);
+		bIdentity = linear == mat3(1.0) && translation == vec3(0.0);
+		areaScale = std::pow(std::fabs(glm::determinant(linear)), 2.0 / 3.0);
+		Refit();
+	}
+
+	void Instance::Refit()
+	{
+		area = object->GetArea() * areaScale;
+
+		if (bIdentity) {
+			bbox = object->BoundingBox();
+			return;
+		}
+		// Bound the eight transformed corners of the object-space box.
+		const AABB objectBox = object->BoundingBox();
+		vec3 minCorner(std::numeric_limits<Real>::infinity());
+		vec3 maxCorner(-std::numeric_limits<Real>::infinity());
+		for (int corner = 0; corner < 8; ++corner) {
+			vec3 p(
+				(corner & 1) ? objectBox.x.max : objectBox.x.min,
+				(corner & 2) ? objectBox.y.max : objectBox.y.min,
+				(corner & 4) ? objectBox.z.max : objectBox.z.min);
+			p = linear * p + translation;
+			minCorner = glm::min(minCorner, p);
+			maxCorner = glm::max(maxCorner, p);
+		}
+		bbox = AABB(minCorner, maxCorner);
+	}
+
+	Ray Instance::WorldToObject(const Ray& ray) const
+	{
+		// The direction is not renormalized, so hit times are the same in both spaces.
+		return Ray(invLinear * (ray.origin - translation), invLinear * ray.direction);
+	}
+
+	void Instance::ObjectToWorld(HitRecord& record) const
+	{
+		// The normal keeps its side relative to the ray: dot(M d, M^-T n) == dot(d, n).
+		// Error of the transformed point: the transform's own rounding plus the carried error, as in pbrt.
+		record.positionError = (Gamma(3) + 1) * (absLinear * record.positionError) +
+			Gamma(3) * (absLinear * glm::abs(record.position) + glm::abs(translation));
+		record.position = linear * record.position + translation;
+		record.normal = glm::normalize(normalMatrix * record.normal);
+		record.tangent = glm::normalize(linear * record.tangent);
+	}
+
+	bool Instance::Hit(const Ray& ray, Interval domain, HitRecord& record) const
+	{
+		if (bIdentity) {
+			return object->Hit(ray, domain, record);
+		}
+		if (!object->Hit(WorldToObject(ray), domain, record)) {
+			return false;
+		}
+		record.instance = this;
+		return true;
+	}
+
+	bool Instance::Occluded(const Ray& ray, Interval domain) const
+	{
+		return object->Occluded(bIdentity ? ray : WorldToObject(ray), domain);
+	}
+
+	void Instance::HitPacket(const RayPacket& packet, Interval domain, RayPacketHits& hits) const
+	{
+		if (bIdentity) {
+			object->HitPacket(packet, domain, hits);
+			return;
+		}
+		// A linear map keeps a packet coherent unless it flips a direction sign, which Setup checks.
+		RayPacket objectPacket;
+		objectPacket.rayNums = packet.rayNums;
+		for (int r = 0; r < packet.rayNums; ++r) {
+			objectPacket.rays[r] = WorldToObject(packet.rays[r]);
+		}
+		objectPacket.Setup();
+
+		// Only the records written by the object are hits on this instance.
+		bool bUpdated[RayPacket::maxRays];
+		std::copy(hits.bUpdated, hits.bUpdated + packet.rayNums, bUpdated);
+		std::fill(hits.bUpdated, hits.bUpdated + packet.rayNums, false);
+		object->HitPacket(objectPacket, domain, hits);
+		for (int r = 0; r < packet.rayNums; ++r) {
+			if (hits.bUpdated[r]) {
+				hits.records[r].instance = this;
+			}
+			hits.bUpdated[r] = hits.bUpdated[r] || bUpdated[r];
+		}
+	}
+
+	void Instance::Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		Real p = std::sqrt(RandomDouble()) * GetArea();
+		SampleByArea(origin, p, samplePointRecord, pdf);
+		pdf /= GetArea();
+	}
+
+	void Instance::SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		if (bIdentity) {
+			object->SampleByArea(origin, p, samplePointRecord, pdf);
+			return;
+		}
+		// pdf comes back multiplied by the sampled primitive's area, so the area scale cancels out.
+		object->SampleByArea(invLinear * (origin - translation), p / areaScale, samplePointRecord, pdf);
+		ObjectToWorld(samplePointRecord);
+	}
+}
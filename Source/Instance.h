@@ -0,0 +1,51 @@
+#pragma once
+#include "Hittable.h"
+#include "HittableList.h"
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+
+namespace Pooraytracer {
+
+	// Top-level entry of a two-level acceleration structure: a shared bottom-level structure
+	// (usually a per-mesh BVH) placed in the world by an affine object-to-world transform.
+	// Rays are moved into object space instead of the geometry being copied, so any number of
+	// instances, and the lights list, can reference the same BVH. A hit only records the instance;
+	// HitRecord::SetShadingAttributes moves its attributes to world space, so instances don't nest.
+	class Instance :public Hittable {
+
+	public:
+		Instance(shared_ptr<Hittable> object);
+		Instance(shared_ptr<Hittable> object, const mat4& objectToWorld);
+
+		bool Hit(const Ray& ray, Interval domain, HitRecord& record) const override;
+		bool Occluded(const Ray& ray, Interval domain) const override;
+		void HitPacket(const RayPacket& packet, Interval domain, RayPacketHits& hits) const override;
+		AABB BoundingBox() const override { return bbox; }
+		// Light sampling scales the object's area by |det|^(2/3), which is exact for rotations,
+		// translations and uniform scales; sheared or non-uniformly scaled lights are approximated.
+		Real GetArea() const override { return area; }
+		void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const override;
+		void SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const override;
+		// Picks up a moved or refit object; the structures containing the instance then need a Refit().
+		void Refit() override;
+		// Move the instance, e.g. once per frame of an animation, without touching the shared object.
+		void SetTransform(const mat4& objectToWorld);
+
+		const shared_ptr<Hittable>& GetObject() const { return object; }
+
+		Ray WorldToObject(const Ray& ray) const;
+		void ObjectToWorld(HitRecord& record) const;
+
+	private:
+		shared_ptr<Hittable> object;
+		mat3 linear;				// object to world, without the translation
+		mat3 absLinear;				// |linear| per element, for error bounds
+		mat3 invLinear;				// world to object
+		mat3 normalMatrix;			// transpose(invLinear): object-space normals to world
+		vec3 translation;
+		bool bIdentity;				// skip all transforms for the common untransformed case
+		Real areaScale;
+		AABB bbox;
+		Real area;
+	};
+}
@@ -4,19 +4,19 @@
 namespace Pooraytracer {
 
 	const Interval Interval::empty = Interval(
-		+std::numeric_limits<double>::infinity(),
-		-std::numeric_limits<double>::infinity()
+		+std::numeric_limits<Real>::infinity(),
+		-std::numeric_limits<Real>::infinity()
 	);
 	const Interval Interval::universe = Interval(
-		-std::numeric_limits<double>::infinity(),
-		+std::numeric_limits<double>::infinity()
+		-std::numeric_limits<Real>::infinity(),
+		+std::numeric_limits<Real>::infinity()
 	);
 
-	Interval operator+(const Interval& ival, double displacement)
+	Interval operator+(const Interval& ival, Real displacement)
 	{
 		return Interval(ival.min + displacement, ival.max + displacement);
 	}
-	Interval operator+(double displacement, const Interval& ival)
+	Interval operator+(Real displacement, const Interval& ival)
 	{
 		return ival + displacement;
 	}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Real.h"
 #include <limits>
 
 namespace Pooraytracer {
@@ -7,37 +8,39 @@ namespace Pooraytracer {
 
 	class Interval {
 	public:
-		double min, max;
-		Interval() :min(+std::numeric_limits<double>::infinity()), max(-std::numeric_limits<double>::infinity()) {}
-		Interval(double min, double max) : min(min), max(max) {}
-		Interval(const Interval& a, const Interval& b) {
+		Real min, max;
+		// constexpr so that `empty` and `universe` are constant-initialized, before any other
+		// translation unit's statics (AABB::empty) are built from them.
+		constexpr Interval() :min(+std::numeric_limits<Real>::infinity()), max(-std::numeric_limits<Real>::infinity()) {}
+		constexpr Interval(Real min, Real max) : min(min), max(max) {}
+		constexpr Interval(const Interval& a, const Interval& b) {
 			min = a.min <= b.min ? a.min : b.min;
 			max = a.max >= b.max ? a.max : b.max;
 		}
 
-		double Length() const {
+		Real Length() const {
 			return max - min;
 		}
-		bool Contains(double x) const {
+		bool Contains(Real x) const {
 			return min <= x && x <= max;
 		}
-		bool Surrounds(double x) const {
+		bool Surrounds(Real x) const {
 			return min < x && x < max;
 		}
-		double Clamp(double x) const {
+		Real Clamp(Real x) const {
 			if (x < min) return min;
 			if (x > max) return max;
 			return x;
 		}
 
-		Interval Expand(double delta) const {
-			double padding = delta / 2.;
+		Interval Expand(Real delta) const {
+			Real padding = delta / 2.;
 			return Interval(min - padding, max + padding);
 		}
 
 		static const Interval empty, universe;
 	};
 
-	Interval operator+(const Interval& ival, double displacement);
-	Interval operator+(double displacement, const Interval& ival);
+	Interval operator+(const Interval& ival, Real displacement);
+	Interval operator+(Real displacement, const Interval& ival);
 }
\ No newline at end of file
@@ -0,0 +1,710 @@
+#include "LinearBVH.h"
+#include "Logger.h"
+#include "Ray.h"
+#include "SAH.h"
+#include "RandomNumberGenerator.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+namespace Pooraytracer {
+
+	LinearBVH::LinearBVH(HittableList list, BVHSplitMethod splitMethod, int threadNums)
+	{
+		Build(list.objects, splitMethod, threadNums);
+		LOGI("LinearBVH over {} objects: {} nodes ({} KB), SAH cost: {:.3f}, built in {:.1f} ms ({:.2f} M objects/s)",
+			primitives.size(), nodes.size(), nodes.size() * sizeof(LinearBVHNode) / 1024, SAHCost(),
+			buildSeconds * 1000.0, BuildThroughput() / 1e6);
+	}
+	LinearBVH::LinearBVH(shared_ptr<Mesh> mesh, BVHSplitMethod splitMethod, int threadNums)
+	{
+		Build(mesh->objects, splitMethod, threadNums);
+		LOGD("Mesh {} LinearBVH over {} triangles: {} nodes ({} KB), SAH cost: {:.3f}, built in {:.1f} ms ({:.2f} M triangles/s)",
+			mesh->name, primitives.size(), nodes.size(), nodes.size() * sizeof(LinearBVHNode) / 1024, SAHCost(),
+			buildSeconds * 1000.0, BuildThroughput() / 1e6);
+	}
+	LinearBVH::LinearBVH(const std::vector<shared_ptr<Hittable>>& objects, BVHSplitMethod splitMethod, int threadNums)
+	{
+		Build(objects, splitMethod, threadNums);
+	}
+	LinearBVH::LinearBVH(shared_ptr<BVHNode> root)
+	{
+		Flatten(root);
+		SetupPrimitives();
+		buildCosts = SubtreeCosts(nodes);
+	}
+
+	void LinearBVH::Build(const std::vector<shared_ptr<Hittable>>& objects, BVHSplitMethod splitMethod, int threadNums)
+	{
+		if (objects.empty()) {
+			return;
+		}
+		auto startTime = std::chrono::steady_clock::now();
+		this->splitMethod = splitMethod;
+		std::vector<BVHPrimitiveInfo> primitiveInfo(objects.size());
+		for (size_t i = 0; i < objects.size(); ++i) {
+			AABB bbox = objects[i]->BoundingBox();
+			primitiveInfo[i] = { i, bbox, bbox.Centroid() };
+		}
+		// A binary tree has at most 2n - 1 nodes.
+		nodes.reserve(2 * objects.size() - 1);
+		if (splitMethod == BVHSplitMethod::SpatialSAH) {
+			SpatialBuildContext context{ objects, std::vector<const Triangle*>(objects.size()), 0.0 };
+			AABB bbox = AABB::empty;
+			for (size_t i = 0; i < objects.size(); ++i) {
+				context.triangles[i] = dynamic_cast<const Triangle*>(objects[i].get());
+				bbox = AABB(bbox, primitiveInfo[i].bbox);
+			}
+			context.rootArea = bbox.SurfaceArea();
+			size_t budget = static_cast<size_t>(spatialSplitBudget * objects.size());
+
+			std::vector<size_t> leafObjects;
+			leafObjects.reserve(objects.size() + budget);
+			BuildSpatialRecursive(context, primitiveInfo, 0, budget, std::max(threadNums, 1), nodes, leafObjects);
+			primitives.reserve(leafObjects.size());
+			for (size_t objectIdx : leafObjects) {
+				primitives.push_back(objects[objectIdx]);
+			}
+			bSpatialSplits = primitives.size() > objects.size();
+			LOGD("Spatial splits: {} references for {} primitives", primitives.size(), objects.size());
+		}
+		else {
+			BuildRecursive(objects, primitiveInfo, 0, objects.size(), 0, splitMethod, std::max(threadNums, 1), nodes);
+			// primitiveInfo has been partitioned in place, so it already lists the primitives in leaf order.
+			primitives.reserve(objects.size());
+			for (const BVHPrimitiveInfo& info : primitiveInfo) {
+				primitives.push_back(objects[info.primitiveIndex]);
+			}
+		}
+		nodes.shrink_to_fit();
+		SetupPrimitives();
+		if (bSpatialSplits) {
+			RefitNodes(false);
+		}
+		buildCosts = SubtreeCosts(nodes);
+		buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	}
+
+	uint32_t LinearBVH::BuildRecursive(const std::vector<shared_ptr<Hittable>>& objects, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+		size_t start, size_t end, int depth, BVHSplitMethod splitMethod, int threadNums, std::vector<LinearBVHNode>& subtreeNodes)
+	{
+		auto first = std::begin(primitiveInfo) + start;
+		auto last = std::begin(primitiveInfo) + end;
+		size_t objectSpan = end - start;
+
+		AABB bbox = AABB::empty;
+		AABB centroidBounds = AABB::empty;
+		for (auto it = first; it != last; ++it) {
+			bbox = AABB(bbox, it->bbox);
+			centroidBounds = AABB(centroidBounds, AABB(it->centroid, it->centroid));
+		}
+
+		auto emitLeaf = [&]() {
+			uint32_t nodeIdx = static_cast<uint32_t>(subtreeNodes.size());
+			LinearBVHNode& node = subtreeNodes.emplace_back();
+			node.bbox = bbox;
+			node.area = 0.0;
+			for (auto it = first; it != last; ++it) {
+				node.area += objects[it->primitiveIndex]->GetArea();
+			}
+			node.primitivesOffset = static_cast<uint32_t>(start);
+			node.primitiveNums = static_cast<uint16_t>(objectSpan);
+			node.axis = 0;
+			return nodeIdx;
+			};
+
+		// The traversal stack holds at most one entry per level.
+		if (objectSpan == 1 || depth >= maxDepth - 1) {
+			return emitLeaf();
+		}
+
+		size_t mid = start + objectSpan / 2;
+		int axis = bbox.LongestAxis();
+		if (splitMethod == BVHSplitMethod::SAH) {
+			SAHSplit split = FindSAHSplit(first, last, bbox, centroidBounds,
+				[](const BVHPrimitiveInfo& info) -> const AABB& { return info.bbox; });
+			if (objectSpan <= maxLeafPrimitives && SAHLeafCost(objectSpan) <= split.cost) {
+				return emitLeaf();
+			}
+			if (split.axis >= 0) {
+				axis = split.axis;
+				auto midIt = std::partition(first, last, [&](const BVHPrimitiveInfo& info) {
+					return SAHBinIndex(centroidBounds, split.axis, info.centroid) <= split.bin;
+					});
+				mid = start + std::distance(first, midIt);
+			}
+		}
+		else {
+			if (objectSpan <= 2) {
+				return emitLeaf();
+			}
+			std::sort(first, last, [axis](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+				return a.bbox.GetAxisInterval(axis).min < b.bbox.GetAxisInterval(axis).min;
+				});
+		}
+
+		uint32_t nodeIdx = static_cast<uint32_t>(subtreeNodes.size());
+		subtreeNodes.emplace_back();
+		uint32_t secondChildIdx;
+		if (threadNums > 1 && objectSpan >= parallelBuildMinPrimitives) {
+			// The two halves of primitiveInfo are disjoint: build the second child on its own thread
+			// into a separate array and append it, which yields the same node order as the serial build.
+			std::vector<LinearBVHNode> secondChildNodes;
+			secondChildNodes.reserve(2 * (end - mid) - 1);
+			int secondChildThreadNums = threadNums / 2;
+			std::thread secondChildThread([&]() {
+				BuildRecursive(objects, primitiveInfo, mid, end, depth + 1, splitMethod, secondChildThreadNums, secondChildNodes);
+				});
+			BuildRecursive(objects, primitiveInfo, start, mid, depth + 1, splitMethod, threadNums - secondChildThreadNums, subtreeNodes);
+			secondChildThread.join();
+
+			secondChildIdx = static_cast<uint32_t>(subtreeNodes.size());
+			for (LinearBVHNode node : secondChildNodes) {
+				if (node.primitiveNums == 0) {
+					node.secondChildOffset += secondChildIdx;
+				}
+				subtreeNodes.push_back(node);
+			}
+		}
+		else {
+			BuildRecursive(objects, primitiveInfo, start, mid, depth + 1, splitMethod, 1, subtreeNodes);
+			secondChildIdx = BuildRecursive(objects, primitiveInfo, mid, end, depth + 1, splitMethod, 1, subtreeNodes);
+		}
+
+		LinearBVHNode& node = subtreeNodes[nodeIdx];
+		node.bbox = bbox;
+		node.area = subtreeNodes[nodeIdx + 1].area + subtreeNodes[secondChildIdx].area;
+		node.secondChildOffset = secondChildIdx;
+		node.primitiveNums = 0;
+		node.axis = static_cast<uint8_t>(axis);
+		return nodeIdx;
+	}
+
+	uint32_t LinearBVH::BuildSpatialRecursive(const SpatialBuildContext& context, std::vector<BVHPrimitiveInfo>& references,
+		int depth, size_t budget, int threadNums, std::vector<LinearBVHNode>& subtreeNodes, std::vector<size_t>& leafObjects)
+	{
+		size_t referenceSpan = references.size();
+
+		AABB bbox = AABB::empty;
+		AABB centroidBounds = AABB::empty;
+		for (const BVHPrimitiveInfo& reference : references) {
+			bbox = AABB(bbox, reference.bbox);
+			centroidBounds = AABB(centroidBounds, AABB(reference.centroid, reference.centroid));
+		}
+
+		// Leaf areas are provisional here; SetupPrimitives shares them out once every duplicate is known.
+		auto emitLeaf = [&]() {
+			uint32_t nodeIdx = static_cast<uint32_t>(subtreeNodes.size());
+			LinearBVHNode& node = subtreeNodes.emplace_back();
+			node.bbox = bbox;
+			node.area = 0.0;
+			node.primitivesOffset = static_cast<uint32_t>(leafObjects.size());
+			for (const BVHPrimitiveInfo& reference : references) {
+				node.area += context.objects[reference.primitiveIndex]->GetArea();
+				leafObjects.push_back(reference.primitiveIndex);
+			}
+			node.primitiveNums = static_cast<uint16_t>(referenceSpan);
+			node.axis = 0;
+			return nodeIdx;
+			};
+
+		if (referenceSpan == 1 || depth >= maxDepth - 1) {
+			return emitLeaf();
+		}
+
+		auto boxOf = [](const BVHPrimitiveInfo& info) -> const AABB& { return info.bbox; };
+		auto clipOf = [&](const BVHPrimitiveInfo& info, int axis, Real lo, Real hi) {
+			if (const Triangle* triangle = context.triangles[info.primitiveIndex]) {
+				return ClipTriangleToSlab(triangle->Vertices(), info.bbox, axis, lo, hi);
+			}
+			// Anything else can only be cut at its box.
+			Interval slab[3] = { Interval::universe, Interval::universe, Interval::universe };
+			slab[axis] = Interval(lo, hi);
+			return IntersectBounds(info.bbox, AABB(slab[0], slab[1], slab[2]));
+			};
+
+		SAHSplit objectSplit = FindSAHSplit(references.begin(), references.end(), bbox, centroidBounds, boxOf);
+		auto isObjectSplitLeft = [&](const BVHPrimitiveInfo& info) {
+			return SAHBinIndex(centroidBounds, objectSplit.axis, info.centroid) <= objectSplit.bin;
+			};
+
+		// Spatial splits only pay off where the object split leaves the children overlapping.
+		SpatialSplit spatialSplit;
+		if (budget > 0 && objectSplit.axis >= 0) {
+			AABB leftBox = AABB::empty, rightBox = AABB::empty;
+			for (const BVHPrimitiveInfo& reference : references) {
+				AABB& childBox = isObjectSplitLeft(reference) ? leftBox : rightBox;
+				childBox = AABB(childBox, reference.bbox);
+			}
+			AABB overlap = IntersectBounds(leftBox, rightBox);
+			if (!IsEmpty(overlap) && overlap.SurfaceArea() > SpatialSplitAlpha * context.rootArea) {
+				spatialSplit = FindSpatialSplit(references.begin(), references.end(), bbox, boxOf, clipOf);
+				if (spatialSplit.leftCount + spatialSplit.rightCount - referenceSpan > budget) {
+					spatialSplit = SpatialSplit();
+				}
+			}
+		}
+
+		if (referenceSpan <= maxLeafPrimitives && SAHLeafCost(referenceSpan) <= std::min(objectSplit.cost, spatialSplit.cost)) {
+			return emitLeaf();
+		}
+
+		std::vector<BVHPrimitiveInfo> leftReferences, rightReferences;
+		int axis = bbox.LongestAxis();
+		if (spatialSplit.cost < objectSplit.cost) {
+			axis = spatialSplit.axis;
+			const Interval& extent = bbox.GetAxisInterval(axis);
+			for (const BVHPrimitiveInfo& reference : references) {
+				int firstBin = SpatialBinIndex(bbox, axis, reference.bbox.GetAxisInterval(axis).min);
+				int lastBin = SpatialBinIndex(bbox, axis, reference.bbox.GetAxisInterval(axis).max);
+				if (lastBin <= spatialSplit.bin) {
+					leftReferences.push_back(reference);
+				}
+				else if (firstBin > spatialSplit.bin) {
+					rightReferences.push_back(reference);
+				}
+				else {
+					// Straddles the plane: each side keeps the clipped part.
+					AABB leftPart = clipOf(reference, axis, extent.min, spatialSplit.position);
+					AABB rightPart = clipOf(reference, axis, spatialSplit.position, extent.max);
+					if (!IsEmpty(leftPart)) {
+						leftReferences.push_back({ reference.primitiveIndex, leftPart, leftPart.Centroid() });
+					}
+					if (!IsEmpty(rightPart)) {
+						rightReferences.push_back({ reference.primitiveIndex, rightPart, rightPart.Centroid() });
+					}
+				}
+			}
+		}
+		if (leftReferences.empty() || rightReferences.empty()) {
+			leftReferences.clear();
+			rightReferences.clear();
+			if (objectSplit.axis >= 0) {
+				axis = objectSplit.axis;
+				for (const BVHPrimitiveInfo& reference : references) {
+					(isObjectSplitLeft(reference) ? leftReferences : rightReferences).push_back(reference);
+				}
+			}
+			else {
+				// All centroids coincide: split by count.
+				leftReferences.assign(references.begin(), references.begin() + referenceSpan / 2);
+				rightReferences.assign(references.begin() + referenceSpan / 2, references.end());
+			}
+		}
+		// The children now own copies; release this level before descending.
+		std::vector<BVHPrimitiveInfo>().swap(references);
+
+		size_t duplicates = leftReferences.size() + rightReferences.size() - referenceSpan;
+		size_t remainingBudget = budget - std::min(budget, duplicates);
+		size_t leftBudget = remainingBudget * leftReferences.size() / (leftReferences.size() + rightReferences.size());
+		size_t rightBudget = remainingBudget - leftBudget;
+
+		uint32_t nodeIdx = static_cast<uint32_t>(subtreeNodes.size());
+		subtreeNodes.emplace_back();
+		uint32_t secondChildIdx;
+		if (threadNums > 1 && referenceSpan >= parallelBuildMinPrimitives) {
+			// As in BuildRecursive; leaves of the second child also index its own leafObjects until appended.
+			std::vector<LinearBVHNode> secondChildNodes;
+			std::vector<size_t> secondChildObjects;
+			int secondChildThreadNums = threadNums / 2;
+			std::thread secondChildThread([&]() {
+				BuildSpatialRecursive(context, rightReferences, depth + 1, rightBudget, secondChildThreadNums, secondChildNodes, secondChildObjects);
+				});
+			BuildSpatialRecursive(context, leftReferences, depth + 1, leftBudget, threadNums - secondChildThreadNums, subtreeNodes, leafObjects);
+			secondChildThread.join();
+
+			secondChildIdx = static_cast<uint32_t>(subtreeNodes.size());
+			uint32_t objectsOffset = static_cast<uint32_t>(leafObjects.size());
+			for (LinearBVHNode node : secondChildNodes) {
+				if (node.primitiveNums == 0) {
+					node.secondChildOffset += secondChildIdx;
+				}
+				else {
+					node.primitivesOffset += objectsOffset;
+				}
+				subtreeNodes.push_back(node);
+			}
+			leafObjects.insert(leafObjects.end(), secondChildObjects.begin(), secondChildObjects.end());
+		}
+		else {
+			BuildSpatialRecursive(context, leftReferences, depth + 1, leftBudget, 1, subtreeNodes, leafObjects);
+			secondChildIdx = BuildSpatialRecursive(context, rightReferences, depth + 1, rightBudget, 1, subtreeNodes, leafObjects);
+		}
+
+		LinearBVHNode& node = subtreeNodes[nodeIdx];
+		node.bbox = bbox;
+		node.area = subtreeNodes[nodeIdx + 1].area + subtreeNodes[secondChildIdx].area;
+		node.secondChildOffset = secondChildIdx;
+		node.primitiveNums = 0;
+		node.axis = static_cast<uint8_t>(axis);
+		return nodeIdx;
+	}
+
+	void LinearBVH::SetupPrimitives()
+	{
+		primitivePtrs.clear();
+		primitiveTriangles.clear();
+		primitiveAreas.clear();
+		primitivePtrs.reserve(primitives.size());
+		primitiveTriangles.reserve(primitives.size());
+		primitiveAreas.reserve(primitives.size());
+		for (const auto& primitive : primitives) {
+			primitivePtrs.push_back(primitive.get());
+			primitiveTriangles.push_back(dynamic_cast<const Triangle*>(primitive.get()));
+			primitiveAreas.push_back(primitive->GetArea());
+		}
+		if (!bSpatialSplits) {
+			return;
+		}
+
+		// Share each duplicated primitive's area between its references.
+		std::unordered_map<const Hittable*, uint32_t> referenceNums;
+		for (const Hittable* primitive : primitivePtrs) {
+			++referenceNums[primitive];
+		}
+		for (size_t i = 0; i < primitivePtrs.size(); ++i) {
+			primitiveAreas[i] /= referenceNums[primitivePtrs[i]];
+		}
+	}
+
+	void LinearBVH::RefitNodes(bool bBounds)
+	{
+		// Children always follow their parent in the array, so one backward pass is bottom-up.
+		for (size_t nodeIdx = nodes.size(); nodeIdx-- > 0;) {
+			LinearBVHNode& node = nodes[nodeIdx];
+			if (node.primitiveNums > 0) {
+				if (bBounds) {
+					node.bbox = AABB::empty;
+				}
+				node.area = 0.0;
+				for (uint32_t i = node.primitivesOffset; i < node.primitivesOffset + node.primitiveNums; ++i) {
+					if (bBounds) {
+						node.bbox = AABB(node.bbox, primitivePtrs[i]->BoundingBox());
+					}
+					node.area += primitiveAreas[i];
+				}
+			}
+			else {
+				const LinearBVHNode& firstChild = nodes[nodeIdx + 1];
+				const LinearBVHNode& secondChild = nodes[node.secondChildOffset];
+				if (bBounds) {
+					node.bbox = AABB(firstChild.bbox, secondChild.bbox);
+				}
+				node.area = firstChild.area + secondChild.area;
+			}
+		}
+	}
+
+	void LinearBVH::Refit()
+	{
+		// Primitive areas change with the primitives.
+		SetupPrimitives();
+		RefitNodes(true);
+	}
+
+	size_t LinearBVH::Update(double rebuildThreshold)
+	{
+		Refit();
+		if (nodes.empty() || bSpatialSplits) {
+			return 0;
+		}
+		std::vector<double> costs = SubtreeCosts(nodes);
+		bool bDegraded = false;
+		for (size_t nodeIdx = 0; nodeIdx < nodes.size() && !bDegraded; ++nodeIdx) {
+			bDegraded = nodes[nodeIdx].primitiveNums == 0 && costs[nodeIdx] > rebuildThreshold * buildCosts[nodeIdx];
+		}
+		if (!bDegraded) {
+			return 0;
+		}
+
+		auto startTime = std::chrono::steady_clock::now();
+		std::vector<LinearBVHNode> newNodes;
+		std::vector<double> newBuildCosts;
+		newNodes.reserve(nodes.size());
+		newBuildCosts.reserve(nodes.size());
+		size_t rebuiltNums = 0;
+		UpdateRecursive(0, 0, costs, rebuildThreshold, newNodes, newBuildCosts, rebuiltNums);
+		nodes.swap(newNodes);
+		buildCosts.swap(newBuildCosts);
+		SetupPrimitives();
+		LOGI("LinearBVH update: rebuilt {} subtrees, SAH cost: {:.3f}, in {:.1f} ms", rebuiltNums, SAHCost(),
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+		return rebuiltNums;
+	}
+
+	uint32_t LinearBVH::UpdateRecursive(uint32_t nodeIdx, int depth, const std::vector<double>& costs, double rebuildThreshold,
+		std::vector<LinearBVHNode>& newNodes, std::vector<double>& newBuildCosts, size_t& rebuiltNums)
+	{
+		const LinearBVHNode& node = nodes[nodeIdx];
+		if (node.primitiveNums == 0 && costs[nodeIdx] > rebuildThreshold * buildCosts[nodeIdx]) {
+			++rebuiltNums;
+			return RebuildSubtree(nodeIdx, depth, newNodes, newBuildCosts);
+		}
+
+		uint32_t newNodeIdx = static_cast<uint32_t>(newNodes.size());
+		newNodes.push_back(node);
+		newBuildCosts.push_back(buildCosts[nodeIdx]);
+		if (node.primitiveNums == 0) {
+			UpdateRecursive(nodeIdx + 1, depth + 1, costs, rebuildThreshold, newNodes, newBuildCosts, rebuiltNums);
+			uint32_t secondChildIdx = UpdateRecursive(node.secondChildOffset, depth + 1, costs, rebuildThreshold, newNodes, newBuildCosts, rebuiltNums);
+			newNodes[newNodeIdx].secondChildOffset = secondChildIdx;
+		}
+		return newNodeIdx;
+	}
+
+	uint32_t LinearBVH::RebuildSubtree(uint32_t nodeIdx, int depth, std::vector<LinearBVHNode>& newNodes, std::vector<double>& newBuildCosts)
+	{
+		// Without duplicated references a subtree's leaves cover one contiguous span of primitives,
+		// from its leftmost to its rightmost leaf.
+		uint32_t firstLeafIdx = nodeIdx;
+		while (nodes[firstLeafIdx].primitiveNums == 0) {
+			firstLeafIdx = firstLeafIdx + 1;
+		}
+		uint32_t lastLeafIdx = nodeIdx;
+		while (nodes[lastLeafIdx].primitiveNums == 0) {
+			lastLeafIdx = nodes[lastLeafIdx].secondChildOffset;
+		}
+		size_t start = nodes[firstLeafIdx].primitivesOffset;
+		size_t end = nodes[lastLeafIdx].primitivesOffset + nodes[lastLeafIdx].primitiveNums;
+
+		std::vector<shared_ptr<Hittable>> objects(primitives.begin() + start, primitives.begin() + end);
+		std::vector<BVHPrimitiveInfo> primitiveInfo(objects.size());
+		for (size_t i = 0; i < objects.size(); ++i) {
+			AABB bbox = objects[i]->BoundingBox();
+			primitiveInfo[i] = { i, bbox, bbox.Centroid() };
+		}
+		std::vector<LinearBVHNode> subtreeNodes;
+		subtreeNodes.reserve(2 * objects.size() - 1);
+		BuildRecursive(objects, primitiveInfo, 0, objects.size(), depth, splitMethod, 1, subtreeNodes);
+		for (size_t i = 0; i < objects.size(); ++i) {
+			primitives[start + i] = objects[primitiveInfo[i].primitiveIndex];
+		}
+
+		std::vector<double> subtreeCosts = SubtreeCosts(subtreeNodes);
+		newBuildCosts.insert(newBuildCosts.end(), subtreeCosts.begin(), subtreeCosts.end());
+		uint32_t subtreeIdx = static_cast<uint32_t>(newNodes.size());
+		for (LinearBVHNode node : subtreeNodes) {
+			if (node.primitiveNums == 0) {
+				node.secondChildOffset += subtreeIdx;
+			}
+			else {
+				node.primitivesOffset += static_cast<uint32_t>(start);
+			}
+			newNodes.push_back(node);
+		}
+		return subtreeIdx;
+	}
+
+	std::vector<double> LinearBVH::SubtreeCosts(const std::vector<LinearBVHNode>& nodes)
+	{
+		// Unnormalized SAH cost of each subtree: a subtree whose boxes were stretched by the refit
+		// costs more than it did when built, whatever happened to the rest of the tree.
+		std::vector<double> costs(nodes.size());
+		for (size_t nodeIdx = nodes.size(); nodeIdx-- > 0;) {
+			const LinearBVHNode& node = nodes[nodeIdx];
+			if (node.primitiveNums > 0) {
+				costs[nodeIdx] = node.bbox.SurfaceArea() * SAHLeafCost(node.primitiveNums);
+			}
+			else {
+				costs[nodeIdx] = node.bbox.SurfaceArea() * SAHTraversalCost + costs[nodeIdx + 1] + costs[node.secondChildOffset];
+			}
+		}
+		return costs;
+	}
+
+	uint32_t LinearBVH::EmitLeaf(const AABB& bbox, size_t primitivesOffset)
+	{
+		uint32_t nodeIdx = static_cast<uint32_t>(nodes.size());
+		LinearBVHNode& node = nodes.emplace_back();
+		node.bbox = bbox;
+		node.area = 0.0;
+		for (size_t i = primitivesOffset; i < primitives.size(); ++i) {
+			node.area += primitives[i]->GetArea();
+		}
+		node.primitivesOffset = static_cast<uint32_t>(primitivesOffset);
+		node.primitiveNums = static_cast<uint16_t>(primitives.size() - primitivesOffset);
+		node.axis = 0;
+		return nodeIdx;
+	}
+
+	uint32_t LinearBVH::Flatten(const shared_ptr<Hittable>& hittable)
+	{
+		shared_ptr<BVHNode> bvhNode = std::dynamic_pointer_cast<BVHNode>(hittable);
+		if (!bvhNode) {
+			// A bare primitive referenced directly by a median-split node.
+			size_t primitivesOffset = primitives.size();
+			primitives.push_back(hittable);
+			return EmitLeaf(hittable->BoundingBox(), primitivesOffset);
+		}
+		if (!bvhNode->primitives.empty() || bvhNode->left == bvhNode->right) {
+			size_t primitivesOffset = primitives.size();
+			if (bvhNode->primitives.empty()) {
+				primitives.push_back(bvhNode->left);
+			}
+			else {
+				primitives.insert(primitives.end(), bvhNode->primitives.begin(), bvhNode->primitives.end());
+			}
+			return EmitLeaf(bvhNode->bbox, primitivesOffset);
+		}
+
+		uint32_t nodeIdx = static_cast<uint32_t>(nodes.size());
+		nodes.emplace_back();
+		Flatten(bvhNode->left);
+		uint32_t secondChildIdx = Flatten(bvhNode->right);
+
+		// BVHNode does not keep its split axis; the axis separating the child centroids most is equivalent.
+		vec3 delta = glm::abs(bvhNode->left->BoundingBox().Centroid() - bvhNode->right->BoundingBox().Centroid());
+		int axis = (delta.x > delta.y) ? (delta.x > delta.z ? 0 : 2) : (delta.y > delta.z ? 1 : 2);
+
+		LinearBVHNode& node = nodes[nodeIdx];
+		node.bbox = bvhNode->bbox;
+		node.area = nodes[nodeIdx + 1].area + nodes[secondChildIdx].area;
+		node.secondChildOffset = secondChildIdx;
+		node.primitiveNums = 0;
+		node.axis = static_cast<uint8_t>(axis);
+		return nodeIdx;
+	}
+
+	bool LinearBVH::Hit(const Ray& ray, Interval domain, HitRecord& record) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		bool bHitAnything = false;
+		Real closest = domain.max;
+		const RayQuery query(ray);
+		Mailbox mailbox;
+
+		uint32_t toVisit[maxDepth];
+		int toVisitOffset = 0;
+		uint32_t currentNodeIdx = 0;
+		while (true) {
+			const LinearBVHNode& node = nodes[currentNodeIdx];
+			// Testing against [min, closest] also culls a deferred far child whose entry is past the closest hit.
+			if (node.bbox.Hit(query, Interval(domain.min, closest))) {
+				if (node.primitiveNums > 0) {
+					for (uint32_t i = 0; i < node.primitiveNums; ++i) {
+						const Hittable* primitive = primitivePtrs[node.primitivesOffset + i];
+						if (bSpatialSplits && !mailbox.Visit(primitive)) {
+							continue;
+						}
+						const Triangle* triangle = primitiveTriangles[node.primitivesOffset + i];
+						if (triangle ? triangle->Hit(ray, Interval(domain.min, closest), record) : primitive->Hit(ray, Interval(domain.min, closest), record)) {
+							bHitAnything = true;
+							closest = record.time;
+						}
+					}
+					if (toVisitOffset == 0) break;
+					currentNodeIdx = toVisit[--toVisitOffset];
+				}
+				else if (query.dirIsNeg[node.axis]) {
+					// The second child lies on the far side of the split plane: visit it first.
+					toVisit[toVisitOffset++] = currentNodeIdx + 1;
+					currentNodeIdx = node.secondChildOffset;
+				}
+				else {
+					toVisit[toVisitOffset++] = node.secondChildOffset;
+					currentNodeIdx = currentNodeIdx + 1;
+				}
+			}
+			else {
+				if (toVisitOffset == 0) break;
+				currentNodeIdx = toVisit[--toVisitOffset];
+			}
+		}
+		return bHitAnything;
+	}
+
+	bool LinearBVH::Occluded(const Ray& ray, Interval domain) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		const RayQuery query(ray);
+		Mailbox mailbox;
+		uint32_t toVisit[maxDepth];
+		int toVisitOffset = 0;
+		uint32_t currentNodeIdx = 0;
+		while (true) {
+			const LinearBVHNode& node = nodes[currentNodeIdx];
+			if (node.bbox.Hit(query, domain)) {
+				if (node.primitiveNums > 0) {
+					for (uint32_t i = 0; i < node.primitiveNums; ++i) {
+						const Hittable* primitive = primitivePtrs[node.primitivesOffset + i];
+						if (bSpatialSplits && !mailbox.Visit(primitive)) {
+							continue;
+						}
+						const Triangle* triangle = primitiveTriangles[node.primitivesOffset + i];
+						if (triangle ? triangle->Occluded(ray, domain) : primitive->Occluded(ray, domain)) {
+							return true;
+						}
+					}
+					if (toVisitOffset == 0) break;
+					currentNodeIdx = toVisit[--toVisitOffset];
+				}
+				else {
+					toVisit[toVisitOffset++] = node.secondChildOffset;
+					currentNodeIdx = currentNodeIdx + 1;
+				}
+			}
+			else {
+				if (toVisitOffset == 0) break;
+				currentNodeIdx = toVisit[--toVisitOffset];
+			}
+		}
+		return false;
+	}
+
+	void LinearBVH::Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		Real p = std::sqrt(RandomDouble()) * GetArea();
+		SampleByArea(origin, p, samplePointRecord, pdf);
+		pdf /= GetArea();
+	}
+
+	void LinearBVH::SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		// Walk down by area, exactly like BVHNode::TraverseSample.
+		uint32_t currentNodeIdx = 0;
+		while (nodes[currentNodeIdx].primitiveNums == 0) {
+			const LinearBVHNode& node = nodes[currentNodeIdx];
+			Real leftArea = nodes[currentNodeIdx + 1].area;
+			if (p < leftArea) {
+				currentNodeIdx = currentNodeIdx + 1;
+			}
+			else {
+				p -= leftArea;
+				currentNodeIdx = node.secondChildOffset;
+			}
+		}
+
+		const LinearBVHNode& leaf = nodes[currentNodeIdx];
+		for (uint32_t i = 0; i < leaf.primitiveNums; ++i) {
+			const Hittable* primitive = primitivePtrs[leaf.primitivesOffset + i];
+			Real area = primitiveAreas[leaf.primitivesOffset + i];
+			if (p < area || i + 1 == leaf.primitiveNums) {
+				primitive->SampleByArea(origin, ScaleToPrimitiveArea(p, area, primitive), samplePointRecord, pdf);
+				return;
+			}
+			p -= area;
+		}
+	}
+
+	double LinearBVH::BuildThroughput() const
+	{
+		return buildSeconds > 0.0 ? primitives.size() / buildSeconds : 0.0;
+	}
+
+	double LinearBVH::SAHCost() const
+	{
+		if (nodes.empty()) {
+			return 0.0;
+		}
+		double cost = 0.0;
+		for (const LinearBVHNode& node : nodes) {
+			cost += node.bbox.SurfaceArea() * (node.primitiveNums > 0 ? SAHLeafCost(node.primitiveNums) : SAHTraversalCost);
+		}
+		return cost / nodes[0].bbox.SurfaceArea();
+	}
+}
\ No newline at end of file
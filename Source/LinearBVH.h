@@ -0,0 +1,113 @@
+#pragma once
+#include "AABB.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "BVH.h"
+#include "SpatialSplit.h"
+#include <cstdint>
+#include <vector>
+
+namespace Pooraytracer {
+
+	// One node of the flattened tree, 64 bytes so that a node never straddles a cache line.
+	// Nodes are stored in depth-first order: the first child of an interior node directly
+	// follows its parent, the second child is found through `secondChildOffset`.
+	struct alignas(64) LinearBVHNode {
+		AABB bbox;
+		Real area;
+		union {
+			uint32_t primitivesOffset;	// leaf
+			uint32_t secondChildOffset;	// interior
+		};
+		uint16_t primitiveNums;			// 0 -> interior node
+		uint8_t axis;					// split axis of an interior node
+	};
+	static_assert(sizeof(LinearBVHNode) == 64, "LinearBVHNode should fill exactly one cache line");
+
+	// Pointer-free BVH: a contiguous node array plus a primitive array in leaf order,
+	// traversed iteratively with a fixed-size stack.
+	class LinearBVH :public Hittable {
+
+	public:
+		// `threadNums` > 1 builds large subtrees in parallel; the resulting tree is identical to the serial one.
+		// BVHSplitMethod::SpatialSAH may reference a primitive from several leaves, up to `spatialSplitBudget`.
+		LinearBVH(HittableList list, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, int threadNums = 1);
+		LinearBVH(shared_ptr<Mesh> mesh, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, int threadNums = 1);
+		LinearBVH(const std::vector<shared_ptr<Hittable>>& objects, BVHSplitMethod splitMethod = BVHSplitMethod::SAH, int threadNums = 1);
+		// Flatten an already built pointer tree.
+		LinearBVH(shared_ptr<BVHNode> root);
+
+		bool Hit(const Ray& ray, Interval domain, HitRecord& record) const override;
+		bool Occluded(const Ray& ray, Interval domain) const override;
+		AABB BoundingBox() const override { return nodes.empty() ? AABB::empty : nodes[0].bbox; }
+		Real GetArea() const override { return nodes.empty() ? 0.0 : nodes[0].area; }
+		void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const override;
+		void SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const override;
+		double SAHCost() const;
+		// Recompute every node's bounds and area bottom-up in O(n) after primitives moved; the
+		// topology is kept. Leaves of a spatial-split tree are refit to whole primitives.
+		void Refit() override;
+		// Refit, then rebuild each topmost subtree whose SAH cost has grown past `rebuildThreshold`
+		// times its cost when it was built, e.g. 1.5 for +50%.
+		// Spatial-split trees are only refit. Returns the number of subtrees rebuilt.
+		size_t Update(double rebuildThreshold = defaultRebuildThreshold);
+
+		size_t GetNodeNums() const { return nodes.size(); }
+		size_t GetPrimitiveNums() const { return primitives.size(); }	// references, duplicates included
+		double GetBuildSeconds() const { return buildSeconds; }
+		// Primitives per second of the last build.
+		double BuildThroughput() const;
+
+	public:
+		static constexpr int maxDepth = 64;
+		static constexpr size_t maxLeafPrimitives = BVHNode::maxLeafPrimitives;
+		// Spans smaller than this are not worth a thread of their own.
+		static constexpr size_t parallelBuildMinPrimitives = 4096;
+		// Spatial splits may add at most this many duplicated references per primitive.
+		static constexpr double spatialSplitBudget = 0.5;
+		static constexpr double defaultRebuildThreshold = 1.5;
+
+	private:
+		template <int N> friend class WideBVH;
+		struct BVHPrimitiveInfo {
+			size_t primitiveIndex;
+			AABB bbox;
+			vec3 centroid;
+		};
+
+		std::vector<LinearBVHNode> nodes;
+		std::vector<shared_ptr<Hittable>> primitives;	// owns the primitives, in leaf order
+		std::vector<const Hittable*> primitivePtrs;		// what traversal touches: no refcounting
+		// Per reference, the primitive as a Triangle or nullptr. Triangle is final, so leaves call
+		// it directly and only other primitives go through the vtable.
+		std::vector<const Triangle*> primitiveTriangles;
+		// Area each reference stands for when sampling; a primitive referenced from k leaves
+		// (spatial splits) contributes 1/k of its area through each of them.
+		std::vector<Real> primitiveAreas;
+		bool bSpatialSplits = false;	// duplicated references: traversal uses a mailbox
+		BVHSplitMethod splitMethod = BVHSplitMethod::SAH;	// used again by partial rebuilds
+		// Per node, SubtreeCosts() when the node was built: the reference Update() measures refits against.
+		std::vector<double> buildCosts;
+		double buildSeconds = 0.0;
+
+		struct SpatialBuildContext {
+			const std::vector<shared_ptr<Hittable>>& objects;
+			std::vector<const Triangle*> triangles;	// per object, nullptr for anything else
+			Real rootArea;
+		};
+
+		void Build(const std::vector<shared_ptr<Hittable>>& objects, BVHSplitMethod splitMethod, int threadNums);
+		static uint32_t BuildRecursive(const std::vector<shared_ptr<Hittable>>& objects, std::vector<BVHPrimitiveInfo>& primitiveInfo,
+			size_t start, size_t end, int depth, BVHSplitMethod splitMethod, int threadNums, std::vector<LinearBVHNode>& subtreeNodes);
+		static uint32_t BuildSpatialRecursive(const SpatialBuildContext& context, std::vector<BVHPrimitiveInfo>& references,
+			int depth, size_t budget, int threadNums, std::vector<LinearBVHNode>& subtreeNodes, std::vector<size_t>& leafObjects);
+		void SetupPrimitives();
+		void RefitNodes(bool bBounds);
+		static std::vector<double> SubtreeCosts(const std::vector<LinearBVHNode>& nodes);
+		uint32_t UpdateRecursive(uint32_t nodeIdx, int depth, const std::vector<double>& costs, double rebuildThreshold,
+			std::vector<LinearBVHNode>& newNodes, std::vector<double>& newBuildCosts, size_t& rebuiltNums);
+		uint32_t RebuildSubtree(uint32_t nodeIdx, int depth, std::vector<LinearBVHNode>& newNodes, std::vector<double>& newBuildCosts);
+		uint32_t EmitLeaf(const AABB& bbox, size_t primitivesOffset);
+		uint32_t Flatten(const shared_ptr<Hittable>& hittable);
+	};
+}
\ No newline at end of file
@@ -8,14 +8,10 @@
 #include "MaterialUtils.h"
 #include "Logger.h"
 
-#include <glm/vec3.hpp>
 #include <glm/mat3x3.hpp>
 #include <glm/geometric.hpp>
 
 namespace Pooraytracer {
-	using vec3 = glm::dvec3;
-	using color = glm::dvec3;
-	using point3 = glm::dvec3;
 	using glm::normalize, glm::cross, glm::length, glm::dot;
 
 	struct MaterialEvalContext {
@@ -41,7 +37,7 @@ namespace Pooraytracer {
 		vec3 wi;		// local space wi
 		vec3 wm;		// microfacet normal
 		vec3 f;			// brdf
-		double pdf;
+		Real pdf;
 		SampleFlags flags;
 	};
 
@@ -52,8 +48,9 @@ namespace Pooraytracer {
 
 	class Material {
 	public:
+		Material() = default;
 		virtual ~Material() = default;
-		virtual color Emmited(double u, double v, const point3& p) const {
+		virtual color Emmited(Real u, Real v, const point3& p) const {
 			return color(0., 0., 0.);
 		}
 		virtual bool Scatter(const Ray& rayIn, const HitRecord& record, color& attenuation, Ray& scatteredRay) const {
@@ -65,12 +62,22 @@ namespace Pooraytracer {
 		virtual vec3 Eval(const vec3& wi, const MaterialEvalContext& context) const {
 			return vec3(0., 0., 0.);
 		};
-		virtual double PDF(const vec3& wi, const MaterialEvalContext& context) const {
+		virtual Real PDF(const vec3& wi, const MaterialEvalContext& context) const {
 			return 1.0;
 		}
 		virtual bool HasEmission() const { return false; }
 		virtual color GetEmission() const { return color(0., 0., 0.); }
 		virtual bool SkipLightSampling() const { return false; }
+		// Lets batched integrators group hits that run the same shading code.
+		MaterialType GetType() const { return type; }
+		// Calls f with this material as its concrete (final) class, chosen by a switch on the type
+		// tag, so the calls f makes are direct and can be inlined. Other materials are passed as
+		// Material and dispatched virtually. Defining POORAYTRACER_VIRTUAL_DISPATCH always does so.
+		template <typename F>
+		decltype(auto) Dispatch(F&& f) const;
+
+	protected:
+		explicit Material(MaterialType type) :type(type) {}
 
 	public:
 		static vec3 LocalToWorld(const vec3& local, const MaterialEvalContext& context)
@@ -87,21 +94,24 @@ namespace Pooraytracer {
 			const vec3& tangent = record.tangent;
 			vec3 bitangent = glm::cross(tangent, normal);
 
-			double x = glm::dot(world, tangent);
-			double y = glm::dot(world, bitangent);
-			double z = glm::dot(world, normal);
+			Real x = glm::dot(world, tangent);
+			Real y = glm::dot(world, bitangent);
+			Real z = glm::dot(world, normal);
 
 			return vec3(x, y, z);
 		}
 		static vec3 Reflect(const vec3& wo, const vec3& n) {
-			return -wo + 2. * dot(wo, n) * n;
+			return -wo + Real(2) * dot(wo, n) * n;
 		}
+
+	private:
+		MaterialType type = MaterialType::Empty;
 	};
 
-	class Lambertian : public Material {
+	class Lambertian final : public Material {
 	public:
-		Lambertian(const color& albedo) :texture(make_shared<SolidColor>(albedo)) {}
-		Lambertian(shared_ptr<Texture> texture) :texture(texture) {}
+		Lambertian(const color& albedo) :Material(MaterialType::Lambertian), texture(albedo) {}
+		Lambertian(shared_ptr<Texture> texture) :Material(MaterialType::Lambertian), texture(texture) {}
 
 		MaterialSampleContext Sample(const MaterialEvalContext& context) const override
 		{
@@ -111,7 +121,8 @@ namespace Pooraytracer {
 			while (wi.z <= 0.) {
 				// wi.z == 0.0 -> pdf = 0.
 				// which will cause cosθ / pdf == NAN
-				// so we simply resample a wi
+				// so we simply resample a wi, from the generator: the retries vary per sample
+				ThreadSampleStream().EndDimensions();
 				wi = SampleCosineHemisphere();
 			}
 			sampleContext.wi = wi;
@@ -120,13 +131,13 @@ namespace Pooraytracer {
 			sampleContext.flags = SampleFlags::Diffuse;
 			return sampleContext;
 		}
-		double PDF(const vec3& wi, const MaterialEvalContext& context) const override
+		Real PDF(const vec3& wi, const MaterialEvalContext& context) const override
 		{
-			double cosTheta = wi.z;
+			Real cosTheta = wi.z;
 			return cosTheta * InvPi;
 		}
 		vec3 Eval(const vec3& wi, const MaterialEvalContext& context) const override {
-			return texture->Value(context.uv[0], context.uv[1], context.p) * InvPi; // albedo / pi
+			return texture.Value(context.uv[0], context.uv[1], context.p) * InvPi; // albedo / pi
 		}
 		bool Scatter(const Ray& rayIn, const HitRecord& record, color& attenuation, Ray& scatteredRay)
 			const override {
@@ -140,71 +151,73 @@ namespace Pooraytracer {
 
 			MaterialSampleContext sampleContext = Sample(context);
 			const vec3& wi = sampleContext.wi;
-			const double cosTheta = sampleContext.wi.z;
+			const Real cosTheta = sampleContext.wi.z;
 			const vec3& fr = sampleContext.f;
-			const double& pdf = sampleContext.pdf;
+			const Real& pdf = sampleContext.pdf;
 
-			scatteredRay = Ray(record.position, LocalToWorld(wi, context));
+			scatteredRay = record.SpawnRay(LocalToWorld(wi, context));
 			attenuation = fr * cosTheta / pdf; // attenuation = f_r * cos{θ_i} / pdf
 
 			return true;
 		}
 
 	private:
-		shared_ptr<Texture> texture;
+		TextureSlot texture;
 	};
 
-	class DiffuseLight : public Material {
+	class DiffuseLight final : public Material {
 	public:
 
-		DiffuseLight(shared_ptr<Texture> texture) :texture(texture) {}
-		DiffuseLight(const color& emit) :texture(make_shared<SolidColor>(emit)) {}
+		DiffuseLight(shared_ptr<Texture> texture) :Material(MaterialType::DiffuseLight), texture(texture) {}
+		DiffuseLight(const color& emit) :Material(MaterialType::DiffuseLight), texture(emit) {}
 
-		color Emmited(double u, double v, const point3& p) const override {
-			return texture->Value(u, v, p);
+		color Emmited(Real u, Real v, const point3& p) const override {
+			return texture.Value(u, v, p);
 		}
 		bool HasEmission() const override { return true; }
 		color GetEmission() const override { return Emmited(0., 0., point3(0.)); }
 	private:
-		shared_ptr<Texture> texture;
+		TextureSlot texture;
 	};
 
-	class PhoneReflectance : public Material {
+	class PhoneReflectance final : public Material {
 	public:
-		PhoneReflectance(const color& Kd, const color& Ks, double Ns) :
-			Kd(make_shared<SolidColor>(Kd)), Ks(make_shared<SolidColor>(Ks)), Ns(Ns) {
+		PhoneReflectance(const color& Kd, const color& Ks, Real Ns) :
+			Material(MaterialType::PhoneReflectance), Kd(Kd), Ks(Ks), Ns(Ns) {
 			SetProbabilitiesByNs();
 		}
-		PhoneReflectance(shared_ptr<Texture> mapKd, const color& Ks, double Ns) :
-			Kd(mapKd), Ks(mapKd), Ns(Ns) {
+		PhoneReflectance(shared_ptr<Texture> mapKd, const color& Ks, Real Ns) :
+			Material(MaterialType::PhoneReflectance), Kd(mapKd), Ks(mapKd), Ns(Ns) {
 			SetProbabilitiesByNs();
 		}
 
 		MaterialSampleContext Sample(const MaterialEvalContext& context) const override {
 			MaterialSampleContext sampleContext{};
 
-			double u = RandomDouble();
+			Real u = RandomDouble();
 			if (u < pkd)
 			{
 				// Sample Diffuse
 				vec3 wi = SampleCosineHemisphere();
 				while (wi.z <= 0.) {
+					ThreadSampleStream().EndDimensions();
 					wi = SampleCosineHemisphere();
 				}
 				sampleContext.wi = wi;
 				sampleContext.pdf = DiffusePDF(wi, context);
 				// f_r_diffuse = kd / pi
-				sampleContext.f = Kd->Value(context.uv[0], context.uv[1], context.p) * InvPi;
+				sampleContext.f = Kd.Value(context.uv[0], context.uv[1], context.p) * InvPi;
 				sampleContext.flags = SampleFlags::Diffuse;
 			}
 			else if (pkd <= u && u < pkd + pks)
 			{
 				// Sample Specular
 				vec3 wi;
-				double u1 = RandomDouble(), u2 = RandomDouble();
-				double alpha = glm::acos(glm::pow(u1, 1.0 / (Ns + 1.0)));
-				double phi = 2.0 * Pi * u2;
-				double sinAlpha = glm::sin(alpha), cosAlpha = glm::cos(alpha),
+				vec2 u12 = Random2D();
+				Real u1 = u12.x, u2 = u12.y;
+				Real alpha = glm::acos(glm::pow(u1, 1.0 / (Ns + 1.0)));
+				Real phi = 2.0 * Pi * u2;
+				Real sinAlpha = glm::sin(alpha), cosAlpha = glm::cos(alpha),
 					sinPhi = glm::sin(phi), cosPhi = glm::cos(phi);
 				vec3 reflectWi = vec3(sinAlpha * cosPhi, sinAlpha * sinPhi, cosAlpha);
 				wi = ReflectiveSpaceToLocal(reflectWi, context);
@@ -212,11 +225,11 @@ namespace Pooraytracer {
 				sampleContext.wi = wi;
 				sampleContext.pdf = SpecularPDF(sampleContext.wi, context);
 				vec3 localReflect = glm::normalize(Reflect(context.wo, vec3(0., 0., 1.)));
-				double localCosAlpha = std::max(0.0, glm::dot(sampleContext.wi, localReflect));
+				Real localCosAlpha = std::max(Real(0), glm::dot(sampleContext.wi, localReflect));
 
 				// f_r_specular = ks*(Ns+2)/(2*Pi)*(cosα)^n
 				if (wi.z > 0. && localCosAlpha > 0.) {
-					sampleContext.f = Ks->Value(context.uv[0], context.uv[1], context.p) * (Ns + 2.) * Inv2Pi * glm::pow(localCosAlpha, Ns);
+					sampleContext.f = Ks.Value(context.uv[0], context.uv[1], context.p) * ((Ns + 2) * Inv2Pi * glm::pow(localCosAlpha, Ns));
 				}
 
 				sampleContext.flags = SampleFlags::Specular;
@@ -225,38 +238,38 @@ namespace Pooraytracer {
 			return sampleContext;
 		}
 		vec3 Eval(const vec3& wi, const MaterialEvalContext& context) const override {
-			double u = RandomDouble();
+			Real u = RandomDouble();
 			if (u < pkd) {
 				if (wi.z <= 0) {
 					return vec3(0.0, 0.0, 0.0);
 				}
-				return Kd->Value(context.uv[0], context.uv[1], context.p) * InvPi;
+				return Kd.Value(context.uv[0], context.uv[1], context.p) * InvPi;
 			}
 			else if (pkd <= u && u < pkd + pks) {
 				if (wi.z <= 0) {
 					return vec3(0.0, 0.0, 0.0);
 				}
 				vec3 localReflect = glm::normalize(Reflect(context.wo, vec3(0., 0., 1.)));
-				double localCosAlpha = std::max(0., glm::dot(wi, localReflect));
+				Real localCosAlpha = std::max(Real(0), glm::dot(wi, localReflect));
 				if (localCosAlpha <= 0.) {
 					return vec3(0.0, 0.0, 0.0);
 				}
 
-				return Ks->Value(context.uv[0], context.uv[1], context.p) * (Ns + 2.) * Inv2Pi * glm::pow(localCosAlpha, Ns);
+				return Ks.Value(context.uv[0], context.uv[1], context.p) * ((Ns + 2) * Inv2Pi * glm::pow(localCosAlpha, Ns));
 			}
 			return vec3(0.);
 		}
-		double DiffusePDF(const vec3& wi, const MaterialEvalContext& context) const
+		Real DiffusePDF(const vec3& wi, const MaterialEvalContext& context) const
 		{
 			// wi : local space.
-			double cosTheta = wi.z;
+			Real cosTheta = wi.z;
 			return cosTheta * InvPi;
 		}
-		double SpecularPDF(const vec3& wi, const MaterialEvalContext& context) const
+		Real SpecularPDF(const vec3& wi, const MaterialEvalContext& context) const
 		{
 			if (wi.z <= 0.) return 0.0;
 			vec3 localReflect = glm::normalize(Reflect(context.wo, vec3(0., 0., 1.)));
-			double cosAlpha = glm::dot(wi, localReflect);
+			Real cosAlpha = glm::dot(wi, localReflect);
 			return (Ns + 1.0) * Inv2Pi * glm::pow(cosAlpha, Ns);
 		}
 		bool Scatter(const Ray& rayIn, const HitRecord& record, color& attenuation, Ray& scatteredRay)
@@ -271,11 +284,11 @@ namespace Pooraytracer {
 
 			MaterialSampleContext sampleContext = Sample(context);
 			const vec3& wi = sampleContext.wi;
-			double cosTheta = wi.z;
+			Real cosTheta = wi.z;
 			const vec3& fr = sampleContext.f;
-			const double& pdf = sampleContext.pdf;
+			const Real& pdf = sampleContext.pdf;
 
-			scatteredRay = Ray(record.position, LocalToWorld(wi, context));
+			scatteredRay = record.SpawnRay(LocalToWorld(wi, context));
 
 			if (pdf > 0. && wi.z > 0) {
 				attenuation = fr * cosTheta / pdf;
@@ -293,9 +306,9 @@ namespace Pooraytracer {
 			vec3 T = glm::normalize(glm::cross(V, localR));
 			vec3 B = glm::cross(localR, T);
 
-			double x = glm::dot(local, T);
-			double y = glm::dot(local, B);
-			double z = glm::dot(local, localR);
+			Real x = glm::dot(local, T);
+			Real y = glm::dot(local, B);
+			Real z = glm::dot(local, localR);
 
 			return vec3(x, y, z);
 		}
@@ -310,11 +323,12 @@ namespace Pooraytracer {
 
 			return reflect.x * T + reflect.y * B + reflect.z * localR;
 		}
+		bool SkipLightSampling() const override { return Ns > 1.; }
 	private:
-		shared_ptr<Texture> Kd;
-		shared_ptr<Texture> Ks;
-		double Ns;
-		double pkd, pks;
+		TextureSlot Kd;
+		TextureSlot Ks;
+		Real Ns;
+		Real pkd, pks;
 		void SetProbabilitiesByNs() {
 			if (Ns <= 9.) {
 				pkd = 1.0;
@@ -325,18 +339,17 @@ namespace Pooraytracer {
 				pks = 0.4;
 			}
 		}
-		bool SkipLightSampling() const override { return Ns > 1.; }
-
 	};
 
-	class PerfectMirror :public Material {
+	class PerfectMirror final :public Material {
 	public:
+		PerfectMirror() :Material(MaterialType::PerfectMirror) {}
 		MaterialSampleContext Sample(const MaterialEvalContext& context) const override
 		{
 			const vec3& wo = context.wo;
 			MaterialSampleContext sampleContext;
 			sampleContext.wi = Reflect(wo, vec3(0., 0., 1.));
-			double cosTheta = sampleContext.wi.z;
+			Real cosTheta = sampleContext.wi.z;
 			sampleContext.f = color(1.0, 1.0, 1.0) / cosTheta;
 			sampleContext.pdf = 1;
 			return sampleContext;
@@ -352,11 +365,11 @@ namespace Pooraytracer {
 
 			MaterialSampleContext sampleContext = Sample(context);
 			const vec3& wi = sampleContext.wi;
-			double cosTheta = wi.z;
+			Real cosTheta = wi.z;
 			const vec3& fr = sampleContext.f;// fr = vec3(1., 1., 1.)
-			const double& pdf = sampleContext.pdf; // pdf ~ δ function
+			const Real& pdf = sampleContext.pdf; // pdf ~ δ function
 
-			scatteredRay = Ray(record.position, LocalToWorld(wi, context));
+			scatteredRay = record.SpawnRay(LocalToWorld(wi, context));
 			attenuation = fr * cosTheta / pdf;
 
 			return true;
@@ -365,38 +378,38 @@ namespace Pooraytracer {
 		bool SkipLightSampling() const override { return true; }
 	};
 
-	class CookTorrance : public Material {
+	class CookTorrance final : public Material {
 	public:
-		CookTorrance(const color& Kd, double alphaX=0.3, double alphaY=0.3, vec3 eta=vec3(1.0), vec3 k=vec3(0.0)) :texture(make_shared<SolidColor>(Kd)), alphaX(alphaX), alphaY(alphaY),
+		CookTorrance(const color& Kd, Real alphaX=0.3, Real alphaY=0.3, vec3 eta=vec3(1.0), vec3 k=vec3(0.0)) :Material(MaterialType::CookTorrance), texture(Kd), alphaX(alphaX), alphaY(alphaY),
 			eta(eta), k(k) {
 		}
-		double D(const vec3& wm) const {
-			double tan2Theta = Tan2Theta(wm);
+		Real D(const vec3& wm) const {
+			Real tan2Theta = Tan2Theta(wm);
 			if (IsInf(tan2Theta)) return 0;
-			double cos4Theta = Sqr(Cos2Theta(wm));
-			double e = tan2Theta * (Sqr(CosPhi(wm) / alphaX) +
+			Real cos4Theta = Sqr(Cos2Theta(wm));
+			Real e = tan2Theta * (Sqr(CosPhi(wm) / alphaX) +
 				Sqr(SinPhi(wm) / alphaY));
 			return 1 / (Pi * alphaX * alphaY * cos4Theta * Sqr(1 + e));
 		}
-		double Lambda(const vec3& w) const {
-			double tan2Theta = Tan2Theta(w);
+		Real Lambda(const vec3& w) const {
+			Real tan2Theta = Tan2Theta(w);
 			if (IsInf(tan2Theta)) return 0;
-			double alpha2 = Sqr(CosPhi(w) * alphaX) + Sqr(SinPhi(w) * alphaY);
+			Real alpha2 = Sqr(CosPhi(w) * alphaX) + Sqr(SinPhi(w) * alphaY);
 			return (std::sqrt(1 + alpha2 * tan2Theta) - 1) / 2;
 		}
-		double G1(const vec3& w) const { return 1 / (1 + Lambda(w)); }
-		double G(const vec3& wo, const vec3& wi) const {
+		Real G1(const vec3& w) const { return 1 / (1 + Lambda(w)); }
+		Real G(const vec3& wo, const vec3& wi) const {
 			return 1 / (1 + Lambda(wo) + Lambda(wi));
 		}
-		double D(const vec3& w, const vec3& wm) const {
+		Real D(const vec3& w, const vec3& wm) const {
 			return G1(w) / AbsCosTheta(w) * D(wm) * AbsDot(w, wm);
 		}
 
-		double PDF(const vec3& w, const vec3& wm) const {
+		Real PDF(const vec3& w, const vec3& wm) const {
 			return D(w, wm);
 		}
 
-		double PDF(const vec3& wi, const MaterialEvalContext& context) const override{
+		Real PDF(const vec3& wi, const MaterialEvalContext& context) const override{
 			const vec3& wo = context.wo;
 			if (!SameHemisphere(wo, wi))
 				return 0;
@@ -419,14 +432,14 @@ namespace Pooraytracer {
 			//  Generate uniformly distributed points on the unit disk
 			vec2 p = SampleUniformDiskPolar(u);
 			// Warp hemispherical projection for visible normal sampling
-			double h = std::sqrt(1 - Sqr(p.x));
+			Real h = std::sqrt(1 - Sqr(p.x));
 			p.y = Lerp((1 + wh.z) / 2, h, p.y);
 
 			// Reproject to hemisphere and transform normal to ellipsoid configuration
-			double pz = std::sqrt(std::max<double>(0., 1. - LengthSquared(vec2(p))));
+			Real pz = std::sqrt(std::max<Real>(0., 1. - LengthSquared(vec2(p))));
 			vec3 nh = p.x * T1 + p.y * T2 + pz * wh;
 			return normalize(vec3(alphaX * nh.x, alphaY * nh.y,
-				std::max < double > (1e-6, nh.z)));
+				std::max < Real > (1e-6, nh.z)));
 		}
 
 		MaterialSampleContext Sample(const MaterialEvalContext& context) const override
@@ -440,24 +453,24 @@ namespace Pooraytracer {
 			if (wo.z == 0) {
 				return {};
 			}
-			vec2 u = vec2(RandomDouble(), RandomDouble());
+			vec2 u = Random2D();
 			vec3 wm = SampleWm(wo, u);
 			vec3 wi = Reflect(wo, wm);
 			if (!SameHemisphere(wo, wi)) {
 				return {};
 			}
 			// Compute PDF of _wi_ for microfacet reflection
-			double pdf = PDF(wo, wm) / (4. * AbsDot(wo, wm));
-			double cosTheta_o = AbsCosTheta(wo), cosTheta_i = AbsCosTheta(wi);
+			Real pdf = PDF(wo, wm) / (4. * AbsDot(wo, wm));
+			Real cosTheta_o = AbsCosTheta(wo), cosTheta_i = AbsCosTheta(wi);
 			if (cosTheta_i == 0 || cosTheta_o == 0)
 				return {};
 
 			// Evaluate Fresnel factor _F_ for conductor BRDF
-			vec3 F = vec3(FrComplex(AbsDot(wo, wm), Complex<double>(eta.x, k.x)), FrComplex(AbsDot(wo, wm), Complex<double>(eta.y, k.y)), FrComplex(AbsDot(wo, wm), Complex<double>(eta.z, k.z)));
+			vec3 F = vec3(FrComplex(AbsDot(wo, wm), Complex<Real>(eta.x, k.x)), FrComplex(AbsDot(wo, wm), Complex<Real>(eta.y, k.y)), FrComplex(AbsDot(wo, wm), Complex<Real>(eta.z, k.z)));
 
-			//double F = FrComplex(AbsDot(wo, wm), Complex<double>(eta, k));
+			//Real F = FrComplex(AbsDot(wo, wm), Complex<Real>(eta, k));
 			//color diffuse = (vec3(1.0f) - F) * texture->Value(context.uv[0], context.uv[1], point3(0)) / Pi;
-			vec3 f = vec3(D(wm) * F * G(wo, wi) / (4. * cosTheta_i * cosTheta_o));
+			vec3 f = vec3(D(wm) * F * G(wo, wi) / (4 * cosTheta_i * cosTheta_o));
 
 			sampleContext.f = f;
 			sampleContext.pdf = pdf;
@@ -473,7 +486,7 @@ namespace Pooraytracer {
 			const vec3& wo = context.wo;
 			if (!SameHemisphere(wo, wi))
 				return  { 0., 0., 0. };
-			double cosTheta_o = AbsCosTheta(wo), cosTheta_i = AbsCosTheta(wi);
+			Real cosTheta_o = AbsCosTheta(wo), cosTheta_i = AbsCosTheta(wi);
 			if (cosTheta_i == 0 || cosTheta_o == 0)
 				return { 0., 0., 0. };
 
@@ -484,9 +497,9 @@ namespace Pooraytracer {
 
 			wm = normalize(wm);
 
-			vec3 F = vec3(FrComplex(AbsDot(wo, wm), Complex<double>(eta.x, k.x)), FrComplex(AbsDot(wo, wm), Complex<double>(eta.y, k.y)), FrComplex(AbsDot(wo, wm), Complex<double>(eta.z, k.z)));
+			vec3 F = vec3(FrComplex(AbsDot(wo, wm), Complex<Real>(eta.x, k.x)), FrComplex(AbsDot(wo, wm), Complex<Real>(eta.y, k.y)), FrComplex(AbsDot(wo, wm), Complex<Real>(eta.z, k.z)));
 
-			//double F = FrComplex(AbsDot(wo, wm), Complex<double>(eta, k));
+			//Real F = FrComplex(AbsDot(wo, wm), Complex<Real>(eta, k));
 
 			//color diffuse = (vec3(1.0f) - F) * texture->Value(context.uv[0], context.uv[1], point3(0)) / Pi;
 			return vec3(D(wm)*F*G(wo, wi)/ (4 * cosTheta_i * cosTheta_o));
@@ -506,32 +519,32 @@ namespace Pooraytracer {
 				return false;
 			}
 			const vec3& wi = sampleContext.wi;
-			const double& cosTheta = wi.z;
+			const Real& cosTheta = wi.z;
 			const vec3& fr = sampleContext.f;
-			const double& pdf = sampleContext.pdf;
+			const Real& pdf = sampleContext.pdf;
 
 			attenuation = fr * cosTheta / pdf;
-			scatteredRay = Ray(record.position, LocalToWorld(wi, context));
+			scatteredRay = record.SpawnRay(LocalToWorld(wi, context));
 			return true;
 		}
 	private:
 		vec3 eta, k;
-		double alphaX = 0.2, alphaY = 0.2;
-		shared_ptr<Texture> texture;
+		Real alphaX = 0.2, alphaY = 0.2;
+		TextureSlot texture;
 	};
 
-	class DebugMaterial : public Material {
+	class DebugMaterial final : public Material {
 	public:
 
-		DebugMaterial(shared_ptr<Texture> texture) :texture(texture) {}
-		DebugMaterial(const color& albedo) :texture(make_shared<SolidColor>(albedo)) {}
+		DebugMaterial(shared_ptr<Texture> texture) :Material(MaterialType::DebugMaterial), texture(texture) {}
+		DebugMaterial(const color& albedo) :Material(MaterialType::DebugMaterial), texture(albedo) {}
 		bool HasEmission() const override { return true; }
 		color GetEmission() const override { return Emmited(0., 0., point3(0.)); }
-		color Emmited(double u, double v, const point3& p) const override {
-			return texture->Value(u, v, p);
+		color Emmited(Real u, Real v, const point3& p) const override {
+			return texture.Value(u, v, p);
 		}
 	private:
-		shared_ptr<Texture> texture;
+		TextureSlot texture;
 	};
 
 	class EmptyMaterial : public Material {
@@ -539,4 +552,21 @@ namespace Pooraytracer {
 		virtual bool SkipLightSampling() const { return true; }
 	};
 
+
+	template <typename F>
+	decltype(auto) Material::Dispatch(F&& f) const
+	{
+#ifndef POORAYTRACER_VIRTUAL_DISPATCH
+		switch (type) {
+		case MaterialType::Lambertian: return f(static_cast<const Lambertian&>(*this));
+		case MaterialType::PhoneReflectance: return f(static_cast<const PhoneReflectance&>(*this));
+		case MaterialType::PerfectMirror: return f(static_cast<const PerfectMirror&>(*this));
+		case MaterialType::CookTorrance: return f(static_cast<const CookTorrance&>(*this));
+		case MaterialType::DiffuseLight: return f(static_cast<const DiffuseLight&>(*this));
+		case MaterialType::DebugMaterial: return f(static_cast<const DebugMaterial&>(*this));
+		default: break;
+		}
+#endif
+		return f(*this);
+	}
 }
\ No newline at end of file
@@ -64,7 +64,7 @@ namespace Pooraytracer {
 			return { std::fabs(t2), std::copysign(t1, z.im) };
 	}
 
-	inline constexpr double Clamp(double val, double low, double high) {
+	inline constexpr Real Clamp(Real val, Real low, Real high) {
 		if (val < low)       return low;
 		else if (val > high) return high;
 		else                 return val;
@@ -72,36 +72,36 @@ namespace Pooraytracer {
 	template <typename T>
 	constexpr T Sqr(T v) { return v * v; }
 
-	inline double CosTheta(const vec3& w) { return w.z; }
-	inline double Cos2Theta(const vec3& w) { return Sqr(w.z); }
-	inline double Sin2Theta(const vec3& w) { return std::max<double>(0., 1 - Cos2Theta(w)); }
-	inline double Tan2Theta(const vec3& w) {
+	inline Real CosTheta(const vec3& w) { return w.z; }
+	inline Real Cos2Theta(const vec3& w) { return Sqr(w.z); }
+	inline Real Sin2Theta(const vec3& w) { return std::max<Real>(0., 1 - Cos2Theta(w)); }
+	inline Real Tan2Theta(const vec3& w) {
 		return Sin2Theta(w) / Cos2Theta(w);
 	}
-	inline double SinTheta(const vec3& w) { return std::sqrt(Sin2Theta(w)); }
-	inline double AbsCosTheta(const vec3& w) { return std::abs(w.z); }
-	inline bool IsInf(double v) { return std::isinf(v); }
-	inline double CosPhi(const vec3& w) {
-		double sinTheta = SinTheta(w);
+	inline Real SinTheta(const vec3& w) { return std::sqrt(Sin2Theta(w)); }
+	inline Real AbsCosTheta(const vec3& w) { return std::abs(w.z); }
+	inline bool IsInf(Real v) { return std::isinf(v); }
+	inline Real CosPhi(const vec3& w) {
+		Real sinTheta = SinTheta(w);
 		return (sinTheta == 0) ? 1 : Clamp(w.x / sinTheta, -1, 1);
 	}
-	inline double SinPhi(const vec3& w) {
-		double sinTheta = SinTheta(w);
+	inline Real SinPhi(const vec3& w) {
+		Real sinTheta = SinTheta(w);
 		return (sinTheta == 0) ? 0 : Clamp(w.y / sinTheta, -1, 1);
 	}
-	inline double AbsDot(const vec3& v1, const vec3& v2) { return std::fabs(glm::dot(v1, v2)); }
-	inline double Lerp(double x, double a, double b) {
+	inline Real AbsDot(const vec3& v1, const vec3& v2) { return std::fabs(glm::dot(v1, v2)); }
+	inline Real Lerp(Real x, Real a, Real b) {
 		return (1 - x) * a + x * b;
 	}
-	inline double LengthSquared(const vec2& v) { return Sqr(v.x) + Sqr(v.y); }
-	inline double LengthSquared(const vec3& v) { return Sqr(v.x) + Sqr(v.y) + Sqr(v.z); }
+	inline Real LengthSquared(const vec2& v) { return Sqr(v.x) + Sqr(v.y); }
+	inline Real LengthSquared(const vec3& v) { return Sqr(v.x) + Sqr(v.y) + Sqr(v.z); }
 
 
-	inline double FrComplex(double cosTheta_i, Complex<double> eta) {
-		using Complex = Complex<double>;
+	inline Real FrComplex(Real cosTheta_i, Complex<Real> eta) {
+		using Complex = Complex<Real>;
 		cosTheta_i = Clamp(cosTheta_i, 0, 1);
 		// Compute complex $\cos\,\theta_\roman{t}$ for Fresnel equations using Snell's law
-		double sin2Theta_i = 1 - Sqr(cosTheta_i);
+		Real sin2Theta_i = 1 - Sqr(cosTheta_i);
 		Complex sin2Theta_t = sin2Theta_i / Sqr(eta);
 		Complex cosTheta_t = Sqrt(1 - sin2Theta_t);
 
@@ -5,8 +5,10 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 #include <tinyxml2.h>
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <string>
 #include <vector>
 #include <unordered_set>
@@ -50,8 +52,9 @@ namespace Pooraytracer {
 		{"Ceramic", MaterialType::Lambertian }		   
 	};
 
-	Model::Model(const std::string& modelDirectory, const std::string& modelName) :modelDirectory(modelDirectory), modelName(modelName)
+	Model::Model(const std::string& modelDirectory, const std::string& modelName, Arena* arena) :modelDirectory(modelDirectory), modelName(modelName), arena(arena)
 	{
+		auto loadStartTime = std::chrono::steady_clock::now();
 
 		const std::string& modelPath = modelDirectory + "/" + modelName + ".obj";
 
@@ -76,38 +79,7 @@ namespace Pooraytracer {
 		auto& shapes = reader.GetShapes();
 		auto& materials = reader.GetMaterials();
 
-		// Loading Textures...
-		for (const auto& material : materials) {
-			std::string mtlName = material.name;
-			if (!material.diffuse_texname.empty()) {
-				std::string texName = material.diffuse_texname;
-				std::shared_ptr<Texture> imageTexture = std::make_shared<ImageTexture>(modelDirectory + "/" + texName);
-				if (imageTextureInstances.find(texName) == imageTextureInstances.end()) {
-					imageTextureInstances.insert({ texName, imageTexture });
-				}
-			}
-			if (!material.specular_texname.empty()) {
-				std::string texName = material.diffuse_texname;
-				std::shared_ptr<Texture> imageTexture = std::make_shared<ImageTexture>(modelDirectory + "/" + texName);
-				if (imageTextureInstances.find(texName) == imageTextureInstances.end()) {
-					imageTextureInstances.insert({ texName, imageTexture });
-				}
-			}
-		}
-
-		// Creating Material Instances...
-		for (const auto& material : materials) {
-			std::string mtlName = material.name;
-			if (materialInstances.find(mtlName) == materialInstances.end()) {
-				
-				std::shared_ptr<Material> materialInstance = CreateMaterial(material);
-				materialInstances.insert({ mtlName, materialInstance });
-			}
-			else
-			{
-				LOGW("Some Materials Have the Same Name:{} ! ", mtlName);
-			}
-		}
+		CreateMaterialInstances(materials);
 
 		// Loop over shapes
 		LOGI("Shapes/Meshes Nums: {}", shapes.size());
@@ -127,14 +99,20 @@ namespace Pooraytracer {
 			std::shared_ptr<Material> material = materialInstances.at(material_name);
 
 			// Loop over faces(polygon)
+			// Corners sharing the same position/normal/texcoord indices share one vertex of the mesh.
 			size_t index_offset = 0;
-			std::vector<std::shared_ptr<Hittable>> meshTriangles;
+			std::vector<vec3> positions;
+			std::vector<vec3> normals;
+			std::vector<vec2> texCoords;
+			std::vector<uint32_t> indices;
+			auto hashCorner = [](const std::array<int, 3>& corner) {
+				return std::hash<int>()(corner[0]) ^ (std::hash<int>()(corner[1]) * 0x9e3779b9u) ^ (std::hash<int>()(corner[2]) * 0x85ebca6bu);
+				};
+			std::unordered_map<std::array<int, 3>, uint32_t, decltype(hashCorner)> vertexIndices(0, hashCorner);
+			indices.reserve(3 * shapes[s].mesh.num_face_vertices.size());
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
 			{
 				size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
-				std::array<vec3, 3> vertices;
-				std::array<vec3, 3> normals;
-				std::array<vec2, 3> texCoords;
 				if (fv != 3) {
 					LOGE("Only Support Triangle Mesh!");
 					break;
@@ -144,20 +122,26 @@ namespace Pooraytracer {
 				for (size_t v = 0; v < fv; v++) {
 					// Access to vertex
 					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+					std::array<int, 3> corner = { idx.vertex_index, idx.normal_index, idx.texcoord_index };
+					auto [it, bInserted] = vertexIndices.try_emplace(corner, static_cast<uint32_t>(positions.size()));
+					indices.push_back(it->second);
+					if (!bInserted) {
+						continue;
+					}
+
 					tinyobj::real_t vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
 					tinyobj::real_t vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
 					tinyobj::real_t vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
-					vertices[v] = { vx, vy, vz };
-					//tinyobj::real_t nx, ny, nz;
-					//// Check if `normal_index` is zero or positive. negative = no normal data
-					
+					positions.push_back({ vx, vy, vz });
+
 					tinyobj::real_t nx{}, ny{}, nz{};
+					// Check if `normal_index` is zero or positive. negative = no normal data
 					if (idx.normal_index >= 0) {
 						nx = attrib.normals[3 * size_t(idx.normal_index) + 0];
 						ny = attrib.normals[3 * size_t(idx.normal_index) + 1];
 						nz = attrib.normals[3 * size_t(idx.normal_index) + 2];
 					}
-					normals[v] = { nx, ny, nz };
+					normals.push_back({ nx, ny, nz });
 
 					tinyobj::real_t tx{}, ty{};
 					// Check if `texcoord_index` is zero or positive. negative = no texcoord data
@@ -165,13 +149,7 @@ namespace Pooraytracer {
 						tx = attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
 						ty = attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
 					}
-					texCoords[v] = { tx, ty };
-				}
-				if (texCoords[0] == texCoords[1] || texCoords[1] == texCoords[2] || texCoords[0] == texCoords[2])
-				{
-					//LOGW("The texture coordinates of the triangle's vertices are the same");
-					//LOGW("So we set them to a fixed value to ensure the correct calculation of the tangent.")
-					texCoords[0] = { 0, 0 }; texCoords[1] = { 1, 0 }; texCoords[2] = { 1, 1 };
+					texCoords.push_back({ tx, ty });
 				}
 				index_offset += fv;
 
@@ -183,13 +161,83 @@ namespace Pooraytracer {
 				////LOGI("Material Name: {}", material_name);
 				//std::shared_ptr<Material> material = make_shared<Lambertian>(albedo);// [TODO]: Implentment Material Initialize
 
-				std::shared_ptr<Triangle> triangle = make_shared<Triangle>(vertices, normals, texCoords, material);
-				meshTriangles.push_back(triangle);
-
 			}// End of a face
-			meshes.push_back(make_shared<Mesh>(shapes[s].name, meshTriangles, material));
+			meshes.push_back(MakeShared<Mesh>(arena, shapes[s].name, std::move(positions), std::move(normals), std::move(texCoords), std::move(indices), material));
 		}// End of a Shape/Mesh
 
+		size_t triangleNums = 0, vertexNums = 0, meshBytes = 0;
+		for (const auto& mesh : meshes) {
+			triangleNums += mesh->GetFaceNums();
+			vertexNums += mesh->positions.size();
+			meshBytes += mesh->GetMemoryBytes();
+		}
+		double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStartTime).count();
+		LOGI("Model loaded in {:.1f} ms: {} triangles, {} vertices, meshes {:.2f} MB ({} B per triangle)",
+			loadSeconds * 1000.0, triangleNums, vertexNums, meshBytes / 1048576.0, triangleNums > 0 ? meshBytes / triangleNums : 0);
+
+	}
+
+	void Model::CreateMaterialInstances(const std::vector<tinyobj::material_t>& materials)
+	{
+		// Loading Textures...
+		for (const auto& material : materials) {
+			std::string mtlName = material.name;
+			if (!material.diffuse_texname.empty()) {
+				std::string texName = material.diffuse_texname;
+				std::shared_ptr<Texture> imageTexture = MakeShared<ImageTexture>(arena, modelDirectory + "/" + texName);
+				if (imageTextureInstances.find(texName) == imageTextureInstances.end()) {
+					imageTextureInstances.insert({ texName, imageTexture });
+				}
+			}
+			if (!material.specular_texname.empty()) {
+				std::string texName = material.diffuse_texname;
+				std::shared_ptr<Texture> imageTexture = MakeShared<ImageTexture>(arena, modelDirectory + "/" + texName);
+				if (imageTextureInstances.find(texName) == imageTextureInstances.end()) {
+					imageTextureInstances.insert({ texName, imageTexture });
+				}
+			}
+		}
+
+		// Creating Material Instances...
+		for (const auto& material : materials) {
+			std::string mtlName = material.name;
+			if (materialInstances.find(mtlName) == materialInstances.end()) {
+				
+				std::shared_ptr<Material> materialInstance = CreateMaterial(material);
+				materialInstances.insert({ mtlName, materialInstance });
+			}
+			else
+			{
+				LOGW("Some Materials Have the Same Name:{} ! ", mtlName);
+			}
+		}
+	}
+
+	std::unordered_map<std::string, std::shared_ptr<Material>> Model::LoadMaterials(const std::string& modelDirectory,
+		const std::string& modelName, const std::vector<std::string>& materialLibraries, Arena* arena)
+	{
+		Model model;
+		model.modelDirectory = modelDirectory;
+		model.modelName = modelName;
+		model.arena = arena;
+		model.InitializeLightsRadiance();
+
+		std::map<std::string, int> materialMap;
+		std::vector<tinyobj::material_t> materials;
+		for (const std::string& library : materialLibraries) {
+			std::ifstream file(modelDirectory + "/" + library);
+			if (!file.is_open()) {
+				LOGE("Open Material Library Failed: {}", library);
+				continue;
+			}
+			std::string warning, error;
+			tinyobj::LoadMtl(&materialMap, &materials, &file, &warning, &error);
+			if (!error.empty()) {
+				LOGE("TinyObjReader: {}", error);
+			}
+		}
+		model.CreateMaterialInstances(materials);
+		return std::move(model.materialInstances);
 	}
 
 	bool Model::ProcessObjFile(const std::string& modelPath)
@@ -215,6 +263,14 @@ namespace Pooraytracer {
 		for (size_t i = 0; i < lines.size(); i++) {
 			std::string& currentLine = lines[i];
 
+			if (currentLine.substr(0, 7) == "mtllib ") {
+				std::stringstream ss(currentLine.substr(7));
+				std::string library;
+				while (ss >> library) {
+					materialLibraries.push_back(library);
+				}
+			}
+
 			// If a line defines a group
 			if (currentLine.substr(0, 2) == "g " || currentLine == "g") {
 
@@ -292,7 +348,7 @@ namespace Pooraytracer {
 		}
 		case MaterialType::DiffuseLight: {
 			color radiance = lightRadianceMap.at(mtlname);
-			return make_shared<DiffuseLight>(radiance);
+			return MakeShared<DiffuseLight>(arena, radiance);
 			break;
 		}
 		case MaterialType::Lambertian: {
@@ -300,27 +356,27 @@ namespace Pooraytracer {
 			break;
 		}
 		case MaterialType::PerfectMirror: {
-			return make_shared<PerfectMirror>();
+			return MakeShared<PerfectMirror>(arena);
 			break;
 		}
 		case MaterialType::CookTorrance: {
 			color Kd = vec3(materialRaw.diffuse[0], materialRaw.diffuse[1], materialRaw.diffuse[2]);
-			double alphaX = 0.3, alphaY = 0.3;
+			Real alphaX = 0.3, alphaY = 0.3;
 			vec3 eta = vec3(0.1, 0.5, 1.5) , k = vec3(4.0, 0.02, 0.3);	// Au
 			//vec3 eta = vec3(0.02, 0.04, 0.14), k = vec3(3.9, 2.4, 3.0);	// Ag
 			//vec3 eta = vec3(0.3, 0.7, 1.1), k = vec3(4.4, 3.1, 2.5);      // Cu
 			//vec3 eta = vec3(1.75, 1.76, 1.78), k = vec3(0, 0, 0);			// Al₂O₃
 			//vec3 eta = vec3(0.13, 1.8, 3.2), k = vec3(0.0, 0.0, 0.0);     // veach-mis
-			return make_shared<CookTorrance>(Kd, alphaX, alphaY, eta, k);
+			return MakeShared<CookTorrance>(arena, Kd, alphaX, alphaY, eta, k);
 			break;
 		}
 		case MaterialType::DebugMaterial: {
 			color albedo = vec3(materialRaw.diffuse[0], materialRaw.diffuse[1], materialRaw.diffuse[2]);
-			return make_shared<DebugMaterial>(albedo);
+			return MakeShared<DebugMaterial>(arena, albedo);
 			break;
 		}
 		case MaterialType::Empty: {
-			return make_shared<EmptyMaterial>();
+			return MakeShared<EmptyMaterial>(arena);
 			break;
 		}
 		default:
@@ -367,14 +423,14 @@ namespace Pooraytracer {
 			LOGI("Texture name: {}", materialRaw.diffuse_texname);
 			std::shared_ptr<Texture> imageTextureInstance = imageTextureInstances.at(texName);
 			color Ks = vec3(materialRaw.specular[0], materialRaw.specular[1], materialRaw.specular[2]);
-			double Ns = materialRaw.shininess;
-			return make_shared<PhoneReflectance>(imageTextureInstance, Ks, Ns);
+			Real Ns = materialRaw.shininess;
+			return MakeShared<PhoneReflectance>(arena, imageTextureInstance, Ks, Ns);
 		}
 		else {
 			color Kd = vec3(materialRaw.diffuse[0], materialRaw.diffuse[1], materialRaw.diffuse[2]);
 			color Ks = vec3(materialRaw.specular[0], materialRaw.specular[1], materialRaw.specular[2]);
-			double Ns = materialRaw.shininess;
-			return make_shared<PhoneReflectance>(Kd, Ks, Ns);
+			Real Ns = materialRaw.shininess;
+			return MakeShared<PhoneReflectance>(arena, Kd, Ks, Ns);
 		}
 	}
 
@@ -385,11 +441,11 @@ namespace Pooraytracer {
 			const std::string& texName = materialRaw.diffuse_texname;
 			LOGI("Texture name: {}", materialRaw.diffuse_texname);
 			std::shared_ptr<Texture> imageTextureInstance = imageTextureInstances.at(texName);
-			return make_shared<Lambertian>(imageTextureInstance);
+			return MakeShared<Lambertian>(arena, imageTextureInstance);
 		}
 		else {
 			vec3 albedo = vec3(materialRaw.diffuse[0], materialRaw.diffuse[1], materialRaw.diffuse[2]);
-			return make_shared<Lambertian>(albedo);
+			return MakeShared<Lambertian>(arena, albedo);
 		}
 	}
 }
\ No newline at end of file
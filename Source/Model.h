@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Arena.h"
 #include "Triangle.h"
 #include "Material.h"
 #include <unordered_map>
@@ -13,13 +14,26 @@ namespace Pooraytracer {
 	class Model {
 	public:
 		Model() = default;
-		Model(const std::string& modelDirectory, const std::string& modelName);
+		// The Mesh, Material and Texture objects are allocated from `arena` when given, which then has
+		// to outlive everything referencing them; their vertex and pixel arrays stay on the heap.
+		Model(const std::string& modelDirectory, const std::string& modelName, Arena* arena = nullptr);
 
 		std::vector< std::shared_ptr<Mesh>> meshes;
+		const std::unordered_map<std::string, std::shared_ptr<Material>>& GetMaterials() const { return materialInstances; }
+		// The .mtl files named by the .obj, relative to the model directory.
+		const std::vector<std::string>& GetMaterialLibraries() const { return materialLibraries; }
+
+		// Only the materials, by name, from the given .mtl files and the lights of the model's .xml;
+		// the .obj is not read.
+		static std::unordered_map<std::string, std::shared_ptr<Material>> LoadMaterials(const std::string& modelDirectory,
+			const std::string& modelName, const std::vector<std::string>& materialLibraries, Arena* arena = nullptr);
 	private:
 		std::string modelDirectory;
 		std::string modelName;
+		Arena* arena = nullptr;
+		std::vector<std::string> materialLibraries;
 		bool ProcessObjFile(const std::string& modelPath);
+		void CreateMaterialInstances(const std::vector<tinyobj::material_t>& materials);
 		std::shared_ptr<Material> CreateMaterial(const tinyobj::material_t& materialRaw) const;
 		std::unordered_map<std::string, color> lightRadianceMap;
 		void InitializeLightsRadiance();
@@ -1,21 +1,109 @@
 #pragma once
 
-#include <cstdlib>
-#include <glm/vec2.hpp>
-#include <glm/vec3.hpp>
+#include "Real.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <glm/geometric.hpp>
 
 namespace Pooraytracer {
 
-	const double Pi = 3.14159265358979323846;
-	const double InvPi = 0.31830988618379067154;
-	const double Inv2Pi = 0.15915494309189533577;
-	const double PiOver2 = 1.57079632679489661923;
-	const double PiOver4 = 0.78539816339744830961;
+	const Real Pi = Real(3.14159265358979323846);
+	const Real InvPi = Real(0.31830988618379067154);
+	const Real Inv2Pi = Real(0.15915494309189533577);
+	const Real PiOver2 = Real(1.57079632679489661923);
+	const Real PiOver4 = Real(0.78539816339744830961);
+
+	// Finalizer of SplitMix64: spreads every input bit over the whole output.
+	inline uint64_t MixBits(uint64_t v)
+	{
+		v ^= v >> 31;
+		v *= 0x7fb5d329728ea185ull;
+		v ^= v >> 27;
+		v *= 0x81dadef4bc2dd44dull;
+		v ^= v >> 33;
+		return v;
+	}
+
+	// Hash of `bytes` bytes at `data`, 8 at a time; `hash` chains it onto an earlier one.
+	inline uint64_t HashBytes(const void* data, size_t bytes, uint64_t hash = 0)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < bytes; i += 8) {
+			uint64_t word = 0;
+			std::memcpy(&word, p + i, std::min<size_t>(8, bytes - i));
+			hash = MixBits(hash + word + 0x9e3779b97f4a7c15ull);
+		}
+		return MixBits(hash ^ bytes);
+	}
+
+	// PCG32 (O'Neill, pcg-random.org): a 64-bit LCG whose state is permuted into 32-bit outputs.
+	// 16 bytes, so a path can carry its own; `stream` selects one of 2^63 independent sequences.
+	class PCG32 {
+	public:
+		PCG32() = default;
+		PCG32(uint64_t seed, uint64_t stream = 0) { Seed(seed, stream); }
+
+		void Seed(uint64_t seed, uint64_t stream = 0)
+		{
+			state = 0u;
+			inc = (stream << 1u) | 1u;
+			NextUInt();
+			state += seed;
+			NextUInt();
+		}
+		uint32_t NextUInt()
+		{
+			uint64_t oldState = state;
+			state = oldState * 0x5851f42d4c957f2dull + inc;
+			uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u);
+			uint32_t rot = static_cast<uint32_t>(oldState >> 59u);
+			return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+		}
+		// In [0, 1).
+		double NextDouble() { return NextUInt() * 0x1p-32; }
+
+	private:
+		uint64_t state = 0x853c49e6748fea9bull;
+		uint64_t inc = 0xda3e39cb94b95bdbull;
+	};
+
+	class Sampler;
+
+	// What RandomDouble() and Random2D() draw from on the calling thread: dimensions
+	// [dimension, dimensionEnd) of a pixel sample of `sampler`, and past those a generator seeded
+	// by where they started. Renderers start it per pixel sample and per use of the samples within
+	// a bounce, so every use reads the same dimensions, whatever the thread, scheduling or draws
+	// of other uses. Draws whose number varies go to the generator with EndDimensions().
+	struct SampleStream {
+		const Sampler* sampler = nullptr;
+		uint32_t pixel = 0;
+		uint32_t sampleIndex = 0;
+		uint32_t dimension = 0;
+		uint32_t dimensionEnd = 0;
+		PCG32 rng;
+
+		void StartPixelSample(const Sampler* sampler, uint32_t pixel, uint32_t sampleIndex);
+		void StartDimensions(uint32_t dimension, uint32_t dimensionNums);
+		void EndDimensions() { dimensionEnd = dimension; }
+		// Whether the next dimensionNums draws still come from the sampler; always true without one.
+		bool HasDimensions(uint32_t dimensionNums) const { return !sampler || dimension + dimensionNums <= dimensionEnd; }
+		double Next1D();
+		vec2 Next2D();
+	};
+	inline SampleStream& ThreadSampleStream()
+	{
+		thread_local SampleStream stream;
+		return stream;
+	}
 
 	inline double RandomDouble() {
 		// Returns a random real in [0, 1).
-		return std::rand() / (RAND_MAX + 1.0);
+		return ThreadSampleStream().Next1D();
+	}
+	// Two dimensions as one 2D point, for samplers that stratify pairs.
+	inline vec2 Random2D() {
+		return ThreadSampleStream().Next2D();
 	}
 	inline double RandomDouble(double min, double max) {
 		// Returns a random real in [min,max).
@@ -25,25 +113,25 @@ namespace Pooraytracer {
 		// Returns a random integer in [min,max].
 		return int(RandomDouble(min, max + 1));
 	}
-	inline glm::dvec3 RandomUnitVector3()
+	inline vec3 RandomUnitVector3()
 	{
 		while (true)
 		{
-			glm::dvec3 p = glm::dvec3(RandomDouble(-1.0, 1.0), RandomDouble(-1.0, 1.0), RandomDouble(-1.0, 1.0));
-			double lensq = glm::dot(p, p);
+			vec3 p = vec3(RandomDouble(-1.0, 1.0), RandomDouble(-1.0, 1.0), RandomDouble(-1.0, 1.0));
+			Real lensq = glm::dot(p, p);
 			if (1e-160 < lensq && lensq <= 1.) {
 				return glm::normalize(p);
 			}
 		}
 	}
-	inline glm::dvec2 SampleUniformDiskConcentric(glm::dvec2 u)
+	inline vec2 SampleUniformDiskConcentric(vec2 u)
 	{
-		glm::dvec2 uOffset = 2. * u - glm::dvec2(1., 1.);
+		vec2 uOffset = Real(2) * u - vec2(1, 1);
 		if (uOffset.x == 0. && uOffset.y == 0.)
 		{
 			return { 0., 0. };
 		}
-		double theta, r;
+		Real theta, r;
 		if (std::fabs(uOffset.x) > std::fabs(uOffset.y)) {
 			r = uOffset.x;
 			theta = PiOver4 * (uOffset.y / uOffset.x);
@@ -52,23 +140,23 @@ namespace Pooraytracer {
 			r = uOffset.y;
 			theta = PiOver2 - PiOver4 * (uOffset.x / uOffset.y);
 		}
-		return r * glm::dvec2(std::cos(theta), std::sin(theta));
+		return r * vec2(std::cos(theta), std::sin(theta));
 	}
-	inline glm::dvec3 SampleCosineHemisphere()
+	inline vec3 SampleCosineHemisphere()
 	{
-		glm::dvec2 u = glm::dvec2(RandomDouble(), RandomDouble());
-		glm::dvec2 d = SampleUniformDiskConcentric(u);
-		double z = std::sqrt(std::max(0.0, 1. - d.x * d.x - d.y * d.y));
+		vec2 u = Random2D();
+		vec2 d = SampleUniformDiskConcentric(u);
+		Real z = std::sqrt(std::max(Real(0), 1 - d.x * d.x - d.y * d.y));
 
-		return glm::dvec3(d.x, d.y, z);
+		return vec3(d.x, d.y, z);
 	}
-	inline glm::dvec2 SampleSquare() {
+	inline vec2 SampleSquare() {
 		// Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-		return glm::dvec2(RandomDouble() - 0.5, RandomDouble() - 0.5);
+		return Random2D() - vec2(0.5);
 	}
-	inline glm::dvec2 SampleUniformDiskPolar(glm::dvec2 u) {// [0, 1)
-		double r = std::sqrt(u[0]);
-		double theta = 2 * Pi * u[1];
+	inline vec2 SampleUniformDiskPolar(vec2 u) {// [0, 1)
+		Real r = std::sqrt(u[0]);
+		Real theta = 2 * Pi * u[1];
 		return { r * std::cos(theta), r * std::sin(theta) };
 	}
 }
\ No newline at end of file
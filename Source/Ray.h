@@ -1,18 +1,85 @@
 #pragma once
 
-#include <glm/vec3.hpp>
+#include "Real.h"
+#include <cmath>
+#include <utility>
 
 namespace Pooraytracer {
-	using vec3 = glm::dvec3;
 	class Ray {
 	public:
 		Ray() = default;
 		Ray(const vec3& origin, const vec3& direction) :
 			origin(origin), direction(direction) {
 		}
-		vec3 operator()(double t) const { return origin + direction * t; }
+		vec3 operator()(Real t) const { return origin + direction * t; }
 	public:
 		vec3 origin;
 		vec3 direction;
 	};
+
+	// Origin for a ray leaving a surface point `p` known to within `pError` per axis: `p` is pushed
+	// along the normal `n` until the whole error box lies behind it, on the side `w` leaves from,
+	// then rounded one more ulp away so that the rounding of the offset itself cannot undo it.
+	// The ray can then start at t = 0 without finding the surface it leaves.
+	inline vec3 OffsetRayOrigin(const vec3& p, const vec3& pError, const vec3& n, const vec3& w)
+	{
+		Real d = std::fabs(n.x) * pError.x + std::fabs(n.y) * pError.y + std::fabs(n.z) * pError.z;
+		vec3 offset = d * n;
+		if (w.x * n.x + w.y * n.y + w.z * n.z < 0.0) {
+			offset = -offset;
+		}
+		vec3 po = p + offset;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (offset[axis] > 0.0) {
+				po[axis] = NextRealUp(po[axis]);
+			}
+			else if (offset[axis] < 0.0) {
+				po[axis] = NextRealDown(po[axis]);
+			}
+		}
+		return po;
+	}
+
+	// Per-ray data shared by every box test of one traversal: the inverse direction
+	// and its signs are computed once instead of at every node.
+	class RayQuery {
+	public:
+		RayQuery() = default;
+		RayQuery(const Ray& ray) :
+			origin(ray.origin), invDirection(1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z),
+			dirIsNeg{ invDirection.x < 0.0, invDirection.y < 0.0, invDirection.z < 0.0 } {
+		}
+	public:
+		vec3 origin;
+		vec3 invDirection;
+		bool dirIsNeg[3];
+	};
+
+	// Per-ray setup of the watertight triangle test (Woop et al. 2013): the axes are permuted so
+	// that z is the dominant direction and the ray is sheared onto +z, after which the edge tests
+	// reduce to 2D. Two triangles sharing an edge evaluate it from the same sheared vertices, so
+	// their edge functions are exact negatives and a ray through the edge cannot slip between
+	// them; it may hit both. An edge function that rounds to zero counts as on the edge; float
+	// builds recompute it in double first (IntersectWatertight), double builds have no wider type.
+	class ShearedRay {
+	public:
+		ShearedRay() = default;
+		ShearedRay(const Ray& ray) :origin(ray.origin) {
+			vec3 absDirection(std::fabs(ray.direction.x), std::fabs(ray.direction.y), std::fabs(ray.direction.z));
+			kz = (absDirection.x > absDirection.y) ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+			kx = (kz + 1) % 3;
+			ky = (kx + 1) % 3;
+			// Keep the winding when the dominant direction is negative.
+			if (ray.direction[kz] < 0.0) {
+				std::swap(kx, ky);
+			}
+			shearZ = 1.0 / ray.direction[kz];
+			shearX = ray.direction[kx] * shearZ;
+			shearY = ray.direction[ky] * shearZ;
+		}
+	public:
+		vec3 origin;
+		int kx, ky, kz;
+		Real shearX, shearY, shearZ;
+	};
 }
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+#include "AABB.h"
+#include "Ray.h"
+#include <glm/common.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace Pooraytracer {
+
+	// Up to 64 rays traced together, typically the primary rays of an 8x8 pixel tile. A coherent
+	// packet also carries interval bounds on its origins and inverse directions, so that one
+	// interval-arithmetic slab test decides for all of its rays that a box can be skipped.
+	class RayPacket {
+	public:
+		static constexpr int maxRays = 64;
+
+		// Recompute the packet bounds after the rays were written.
+		void Setup() {
+			bCoherent = rayNums > 0;
+			for (int r = 0; r < rayNums; ++r) {
+				// Same expression as RayQuery, so the bounds enclose every ray's own slab distances.
+				vec3 invDirection(1.0 / rays[r].direction.x, 1.0 / rays[r].direction.y, 1.0 / rays[r].direction.z);
+				originMin = r == 0 ? rays[r].origin : glm::min(originMin, rays[r].origin);
+				originMax = r == 0 ? rays[r].origin : glm::max(originMax, rays[r].origin);
+				invDirectionMin = r == 0 ? invDirection : glm::min(invDirectionMin, invDirection);
+				invDirectionMax = r == 0 ? invDirection : glm::max(invDirectionMax, invDirection);
+			}
+			for (int axis = 0; axis < 3 && bCoherent; ++axis) {
+				bCoherent = std::isfinite(invDirectionMin[axis]) && std::isfinite(invDirectionMax[axis]) &&
+					(invDirectionMin[axis] > 0.0 || invDirectionMax[axis] < 0.0);
+			}
+		}
+
+		// False only if no ray of a coherent packet can overlap `box` within [tMin, tMax];
+		// `tEnter` receives a lower bound of the rays' entry distances.
+		bool MayHit(const AABB& box, Real tMin, Real tMax, Real& tEnter) const {
+			for (int axis = 0; axis < 3; ++axis) {
+				const Interval& slab = box.GetAxisInterval(axis);
+				// Rounding is monotonic, so the corner products bound every ray's (plane - o) * invD.
+				auto planeDistances = [&](Real plane, Real& lo, Real& hi) {
+					Real d0 = (plane - originMax[axis]) * invDirectionMin[axis];
+					Real d1 = (plane - originMax[axis]) * invDirectionMax[axis];
+					Real d2 = (plane - originMin[axis]) * invDirectionMin[axis];
+					Real d3 = (plane - originMin[axis]) * invDirectionMax[axis];
+					lo = std::min({ d0, d1, d2, d3 });
+					hi = std::max({ d0, d1, d2, d3 });
+					};
+				Real nearLo, nearHi, farLo, farHi;
+				bool bNegative = invDirectionMax[axis] < 0.0;
+				planeDistances(bNegative ? slab.max : slab.min, nearLo, nearHi);
+				planeDistances(bNegative ? slab.min : slab.max, farLo, farHi);
+				tMin = std::max(tMin, nearLo);
+				tMax = std::min(tMax, farHi);
+				if (tMax < tMin) {
+					return false;
+				}
+			}
+			tEnter = tMin;
+			return true;
+		}
+
+	public:
+		int rayNums = 0;
+		Ray rays[maxRays];
+		// Every direction component keeps one nonzero sign across the packet, so the bounds are
+		// finite and meaningful. Incoherent packets are traced ray by ray.
+		bool bCoherent = false;
+		vec3 originMin, originMax;
+		vec3 invDirectionMin, invDirectionMax;
+	};
+}
\ No newline at end of file
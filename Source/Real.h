@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+#include <cmath>
+#include <limits>
+
+namespace Pooraytracer {
+
+	// Scalar type of geometry and shading, chosen at compile time. Define
+	// POORAYTRACER_FLOAT_PRECISION (CMake option of the same name) for a single-precision
+	// renderer: half the memory for triangles, BVH nodes and hit records. Build-time
+	// quantities (SAH costs, timings) stay double either way.
+#ifdef POORAYTRACER_FLOAT_PRECISION
+	using Real = float;
+#else
+	using Real = double;
+#endif
+
+	using vec2 = glm::vec<2, Real>;
+	using vec3 = glm::vec<3, Real>;
+	using point3 = vec3;
+	using color = vec3;
+	using mat3 = glm::mat<3, 3, Real>;
+	using mat4 = glm::mat<4, 4, Real>;
+
+	constexpr Real Infinity = std::numeric_limits<Real>::infinity();
+
+	// Bound on the relative error of n floating-point operations (pbrt's gamma(n)).
+	constexpr Real MachineEpsilon = std::numeric_limits<Real>::epsilon() * Real(0.5);
+	constexpr Real Gamma(int n)
+	{
+		return (n * MachineEpsilon) / (1 - n * MachineEpsilon);
+	}
+
+	inline Real NextRealUp(Real v)
+	{
+		return std::nextafter(v, Infinity);
+	}
+	inline Real NextRealDown(Real v)
+	{
+		return std::nextafter(v, -Infinity);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "AABB.h"
+#include <algorithm>
+#include <array>
+#include <limits>
+
+namespace Pooraytracer {
+
+	// Binned Surface Area Heuristic, shared by the BVH builders.
+	// Costs are expressed relative to a single primitive intersection test.
+	constexpr int SAHBinCount = 12;
+	constexpr double SAHTraversalCost = 1.0;
+	constexpr double SAHIntersectionCost = 1.0;
+
+	struct SAHSplit {
+		int axis = -1;	// -1: no valid split was found
+		int bin = 0;	// primitives in bins [0, bin] go to the left child
+		double cost = std::numeric_limits<double>::infinity();
+	};
+
+	// Only defined on axes where the centroids have extent, which FindSAHSplit ensures for its splits.
+	inline int SAHBinIndex(const AABB& centroidBounds, int axis, const vec3& centroid)
+	{
+		const Interval& extent = centroidBounds.GetAxisInterval(axis);
+		int bin = static_cast<int>(SAHBinCount * (centroid[axis] - extent.min) / extent.Length());
+		return std::clamp(bin, 0, SAHBinCount - 1);
+	}
+
+	inline double SAHLeafCost(size_t primitiveNums)
+	{
+		return SAHIntersectionCost * static_cast<double>(primitiveNums);
+	}
+
+	// Evaluates the SAH for every bin boundary on all three axes and returns the cheapest split.
+	// Axes on which the centroids have no extent cannot be binned and are skipped, as in
+	// FindSpatialSplit; with none left the split stays invalid and the caller splits by count or
+	// makes a leaf.
+	// `BoxOf` maps an element of [begin, end) to its bounding box.
+	template <typename Iterator, typename BoxOf>
+	SAHSplit FindSAHSplit(Iterator begin, Iterator end, const AABB& bounds, const AABB& centroidBounds, BoxOf boxOf)
+	{
+		struct Bin {
+			AABB bbox = AABB::empty;
+			size_t count = 0;
+		};
+
+		SAHSplit best;
+		double invArea = 1.0 / bounds.SurfaceArea();
+
+		for (int axis = 0; axis < 3; ++axis) {
+			if (centroidBounds.GetAxisInterval(axis).Length() <= 0.0) {
+				continue;
+			}
+			std::array<Bin, SAHBinCount> bins;
+			for (Iterator it = begin; it != end; ++it) {
+				const AABB& box = boxOf(*it);
+				Bin& bin = bins[SAHBinIndex(centroidBounds, axis, box.Centroid())];
+				bin.bbox = AABB(bin.bbox, box);
+				++bin.count;
+			}
+
+			// Sweep from the right to get the area and count of every right-hand side.
+			std::array<double, SAHBinCount - 1> rightArea;
+			std::array<size_t, SAHBinCount - 1> rightCount;
+			AABB rightBox = AABB::empty;
+			size_t count = 0;
+			for (int i = SAHBinCount - 1; i > 0; --i) {
+				rightBox = AABB(rightBox, bins[i].bbox);
+				count += bins[i].count;
+				rightArea[i - 1] = rightBox.SurfaceArea();
+				rightCount[i - 1] = count;
+			}
+
+			AABB leftBox = AABB::empty;
+			size_t leftCount = 0;
+			for (int i = 0; i < SAHBinCount - 1; ++i) {
+				leftBox = AABB(leftBox, bins[i].bbox);
+				leftCount += bins[i].count;
+				if (leftCount == 0 || rightCount[i] == 0) {
+					continue;
+				}
+				double cost = SAHTraversalCost + SAHIntersectionCost *
+					(leftCount * leftBox.SurfaceArea() + rightCount[i] * rightArea[i]) * invArea;
+				if (cost < best.cost) {
+					best.axis = axis;
+					best.bin = i;
+					best.cost = cost;
+				}
+			}
+		}
+		return best;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "SIMD.h"
+
+#if defined(POORAYTRACER_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Pooraytracer {
+
+	static SIMDLevel DetectSIMDLevel()
+	{
+#if defined(POORAYTRACER_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		bool bSSE2 = (info[3] & (1 << 26)) != 0;
+		bool bOSXSAVE = (info[2] & (1 << 27)) != 0;
+		bool bAVX = (info[2] & (1 << 28)) != 0;
+		bool bAVX2 = false;
+		if (maxLeaf >= 7 && bOSXSAVE && bAVX) {
+			// The OS must save the YMM registers on context switches.
+			bool bYMMEnabled = (_xgetbv(0) & 0x6) == 0x6;
+			__cpuidex(info, 7, 0);
+			bAVX2 = bYMMEnabled && (info[1] & (1 << 5)) != 0;
+		}
+		if (bAVX2) return SIMDLevel::AVX2;
+		if (bSSE2) return SIMDLevel::SSE2;
+		return SIMDLevel::Scalar;
+#elif defined(POORAYTRACER_X86) && (defined(__GNUC__) || defined(__clang__))
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return SIMDLevel::AVX2;
+		if (__builtin_cpu_supports("sse2")) return SIMDLevel::SSE2;
+		return SIMDLevel::Scalar;
+#else
+		return SIMDLevel::Scalar;
+#endif
+	}
+
+	SIMDLevel GetSIMDLevel()
+	{
+		static const SIMDLevel level = DetectSIMDLevel();
+		return level;
+	}
+
+	const char* GetSIMDLevelName(SIMDLevel level)
+	{
+		switch (level)
+		{
+		case SIMDLevel::AVX2: return "AVX2";
+		case SIMDLevel::SSE2: return "SSE2";
+		default: return "Scalar";
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define POORAYTRACER_X86 1
+#include <immintrin.h>
+#endif
+
+// Functions using wider instruction sets than the build baseline are compiled per function
+// and only called after the runtime check below. MSVC accepts the intrinsics without flags.
+#if defined(POORAYTRACER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define POORAYTRACER_TARGET_SSE2 __attribute__((target("sse2")))
+#define POORAYTRACER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define POORAYTRACER_TARGET_SSE2
+#define POORAYTRACER_TARGET_AVX2
+#endif
+
+namespace Pooraytracer {
+
+	enum class SIMDLevel
+	{
+		Scalar, SSE2, AVX2
+	};
+
+	// Highest instruction set supported by both the CPU and the OS, detected once.
+	SIMDLevel GetSIMDLevel();
+	const char* GetSIMDLevelName(SIMDLevel level);
+}
\ No newline at end of file
@@ -0,0 +1,242 @@
+#include "Sampler.h"
+#include <algorithm>
+#include <array>
+
+namespace Pooraytracer {
+
+	namespace {
+		Real ToUnit(uint64_t bits)
+		{
+			return std::min(static_cast<Real>((bits >> 11) * 0x1p-53), OneMinusEpsilon);
+		}
+		Real ToUnit(uint32_t bits)
+		{
+			return std::min(static_cast<Real>(bits * 0x1p-32), OneMinusEpsilon);
+		}
+
+		// Element i of a random permutation of [0, l) chosen by p, without storing it (Kensler 2013).
+		uint32_t PermutationElement(uint32_t i, uint32_t l, uint32_t p)
+		{
+			uint32_t w = l - 1;
+			w |= w >> 1;
+			w |= w >> 2;
+			w |= w >> 4;
+			w |= w >> 8;
+			w |= w >> 16;
+			do {
+				i ^= p;
+				i *= 0xe170893d;
+				i ^= p >> 16;
+				i ^= (i & w) >> 4;
+				i ^= p >> 8;
+				i *= 0x0929eb3f;
+				i ^= p >> 23;
+				i ^= (i & w) >> 1;
+				i *= 1 | p >> 27;
+				i *= 0x6935fa69;
+				i ^= (i & w) >> 11;
+				i *= 0x74dcb303;
+				i ^= (i & w) >> 2;
+				i *= 0x9e501cc3;
+				i ^= (i & w) >> 2;
+				i *= 0xc860a3df;
+				i &= w;
+				i ^= i >> 5;
+			} while (i >= l);
+			return (i + p) % l;
+		}
+
+		uint32_t ReverseBits32(uint32_t v)
+		{
+			v = (v << 16) | (v >> 16);
+			v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+			v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+			v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+			v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+			return v;
+		}
+
+		// Owen scrambling of the bits of x, most significant first, by hashing (Burley 2020).
+		uint32_t NestedUniformScramble(uint32_t x, uint32_t seed)
+		{
+			x = ReverseBits32(x);
+			x += seed;
+			x ^= x * 0x6c50b47cu;
+			x ^= x * 0xb82f1e52u;
+			x ^= x * 0xc7afe638u;
+			x ^= x * 0x8d22f6e6u;
+			return ReverseBits32(x);
+		}
+
+		// The first two dimensions of the Sobol' sequence: van der Corput, and its companion.
+		uint32_t Sobol(uint32_t index, int dimension)
+		{
+			if (dimension == 0) {
+				return ReverseBits32(index);
+			}
+			uint32_t x = 0;
+			for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+				if (index & 1) {
+					x ^= v;
+				}
+			}
+			return x;
+		}
+
+		const std::array<uint32_t, HaltonSampler::maxDimensions>& Primes()
+		{
+			static const std::array<uint32_t, HaltonSampler::maxDimensions> primes = [] {
+				std::array<uint32_t, HaltonSampler::maxDimensions> table{};
+				size_t count = 0;
+				for (uint32_t n = 2; count < table.size(); ++n) {
+					bool bPrime = true;
+					for (size_t i = 0; i < count && table[i] * table[i] <= n; ++i) {
+						if (n % table[i] == 0) {
+							bPrime = false;
+							break;
+						}
+					}
+					if (bPrime) {
+						table[count++] = n;
+					}
+				}
+				return table;
+				}();
+			return primes;
+		}
+
+		// Radical inverse of a in `base`, with every digit permuted depending on the digits below
+		// it, i.e. Owen scrambling. Digits are taken down to 2^-32, the precision of the samples.
+		Real OwenScrambledRadicalInverse(uint32_t base, uint64_t a, uint32_t hash)
+		{
+			const double invBase = 1.0 / base;
+			double invBaseM = 1.0;
+			uint64_t reversedDigits = 0;
+			while (invBaseM > 0x1p-32) {
+				uint64_t next = a / base;
+				uint32_t digit = static_cast<uint32_t>(a - next * base);
+				digit = PermutationElement(digit, base, static_cast<uint32_t>(MixBits(hash ^ reversedDigits)));
+				reversedDigits = reversedDigits * base + digit;
+				invBaseM *= invBase;
+				a = next;
+			}
+			return std::min(static_cast<Real>(reversedDigits * invBaseM), OneMinusEpsilon);
+		}
+	}
+
+	void SampleStream::StartPixelSample(const Sampler* sampler, uint32_t pixel, uint32_t sampleIndex)
+	{
+		this->sampler = sampler;
+		this->pixel = pixel;
+		this->sampleIndex = sampleIndex;
+		StartDimensions(0, 0);
+	}
+
+	void SampleStream::StartDimensions(uint32_t dimension, uint32_t dimensionNums)
+	{
+		this->dimension = dimension;
+		dimensionEnd = sampler ? dimension + dimensionNums : dimension;
+		const uint64_t seed = sampler ? sampler->GetSeed() : 0;
+		rng.Seed(MixBits(seed ^ MixBits((uint64_t(pixel) << 32) | sampleIndex)), dimension);
+	}
+
+	double SampleStream::Next1D()
+	{
+		if (dimension < dimensionEnd) {
+			return sampler->Get1D(pixel, sampleIndex, dimension++);
+		}
+		return std::min<double>(rng.NextDouble(), OneMinusEpsilon);
+	}
+
+	vec2 SampleStream::Next2D()
+	{
+		if (dimension + 1 < dimensionEnd) {
+			vec2 u = sampler->Get2D(pixel, sampleIndex, dimension);
+			dimension += 2;
+			return u;
+		}
+		Real x = static_cast<Real>(Next1D());
+		Real y = static_cast<Real>(Next1D());
+		return vec2(x, y);
+	}
+
+	Real IndependentSampler::Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const
+	{
+		return ToUnit(MixBits(Hash(pixel, dimension) ^ MixBits(sampleIndex)));
+	}
+
+	StratifiedSampler::StratifiedSampler(int samplesPerPixel, uint64_t seed) :Sampler(std::max(samplesPerPixel, 1), seed)
+	{
+		// The most square grid of exactly samplesPerPixel strata.
+		xStrata = static_cast<int>(std::sqrt(double(this->samplesPerPixel)));
+		while (this->samplesPerPixel % xStrata != 0) {
+			--xStrata;
+		}
+		yStrata = this->samplesPerPixel / xStrata;
+	}
+
+	Real StratifiedSampler::Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const
+	{
+		const uint64_t hash = Hash(pixel, dimension);
+		const uint32_t strata = static_cast<uint32_t>(samplesPerPixel);
+		uint32_t stratum = PermutationElement(sampleIndex % strata, strata, static_cast<uint32_t>(hash));
+		Real jitter = ToUnit(MixBits(hash ^ MixBits(sampleIndex)));
+		return std::min((stratum + jitter) / strata, OneMinusEpsilon);
+	}
+
+	vec2 StratifiedSampler::Get2D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const
+	{
+		const uint64_t hash = Hash(pixel, dimension);
+		const uint32_t strata = static_cast<uint32_t>(samplesPerPixel);
+		uint32_t stratum = PermutationElement(sampleIndex % strata, strata, static_cast<uint32_t>(hash));
+		const uint64_t jitterHash = MixBits(hash ^ MixBits(sampleIndex));
+		Real jitterX = ToUnit(static_cast<uint32_t>(jitterHash)), jitterY = ToUnit(static_cast<uint32_t>(jitterHash >> 32));
+		return vec2(std::min((stratum % xStrata + jitterX) / xStrata, OneMinusEpsilon),
+			std::min((stratum / xStrata + jitterY) / yStrata, OneMinusEpsilon));
+	}
+
+	Real HaltonSampler::Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const
+	{
+		const uint64_t hash = Hash(pixel, dimension);
+		if (dimension >= maxDimensions) {
+			return ToUnit(MixBits(hash ^ MixBits(sampleIndex)));
+		}
+		return OwenScrambledRadicalInverse(Primes()[dimension], sampleIndex, static_cast<uint32_t>(hash));
+	}
+
+	Real SobolSampler::Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const
+	{
+		const uint64_t hash = Hash(pixel, dimension);
+		uint32_t index = NestedUniformScramble(sampleIndex, static_cast<uint32_t>(hash));
+		return ToUnit(NestedUniformScramble(Sobol(index, 0), static_cast<uint32_t>(hash >> 32)));
+	}
+
+	vec2 SobolSampler::Get2D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const
+	{
+		const uint64_t hash = Hash(pixel, dimension);
+		uint32_t index = NestedUniformScramble(sampleIndex, static_cast<uint32_t>(hash));
+		const uint64_t scrambles = MixBits(hash);
+		return vec2(ToUnit(NestedUniformScramble(Sobol(index, 0), static_cast<uint32_t>(scrambles))),
+			ToUnit(NestedUniformScramble(Sobol(index, 1), static_cast<uint32_t>(scrambles >> 32))));
+	}
+
+	std::shared_ptr<Sampler> CreateSampler(SamplerType type, int samplesPerPixel, uint64_t seed)
+	{
+		switch (type) {
+		case SamplerType::Stratified: return std::make_shared<StratifiedSampler>(samplesPerPixel, seed);
+		case SamplerType::Halton: return std::make_shared<HaltonSampler>(samplesPerPixel, seed);
+		case SamplerType::Sobol: return std::make_shared<SobolSampler>(samplesPerPixel, seed);
+		default: return std::make_shared<IndependentSampler>(samplesPerPixel, seed);
+		}
+	}
+
+	const char* GetSamplerTypeName(SamplerType type)
+	{
+		switch (type) {
+		case SamplerType::Stratified: return "Stratified";
+		case SamplerType::Halton: return "Halton";
+		case SamplerType::Sobol: return "Sobol";
+		default: return "Independent";
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "RandomNumberGenerator.h"
+#include <cstdint>
+#include <memory>
+
+namespace Pooraytracer {
+
+	// Largest Real below 1: sample values are clamped to it, so [0, 1) survives rounding to float.
+	constexpr Real OneMinusEpsilon = Real(1) - MachineEpsilon;
+
+	enum class SamplerType {
+		Independent,	// uniform random values
+		Stratified,		// one jittered stratum per sample, per dimension and per pair of them
+		Halton,			// Owen-scrambled Halton points, one prime base per dimension
+		Sobol			// Owen-scrambled 2D Sobol' points, per pair of dimensions
+	};
+
+	// Values of the dimensions of a pixel's samples, in [0, 1). A sampler is stateless: any
+	// dimension of any sample can be asked for at any time, so one sampler serves all threads
+	// and a path can be resumed at any bounce. Every pixel gets its own randomization.
+	// The stratified and Sobol samplers pad: each dimension (pair) is a low-dimensional point
+	// set of its own, decorrelated from the others by shuffling which sample gets which point.
+	class Sampler {
+	public:
+		Sampler(int samplesPerPixel, uint64_t seed) :samplesPerPixel(samplesPerPixel), seed(seed) {}
+		virtual ~Sampler() = default;
+
+		virtual Real Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const = 0;
+		// Dimensions `dimension` and `dimension + 1`, as one 2D point.
+		virtual vec2 Get2D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const
+		{
+			return vec2(Get1D(pixel, sampleIndex, dimension), Get1D(pixel, sampleIndex, dimension + 1));
+		}
+
+		int GetSamplesPerPixel() const { return samplesPerPixel; }
+		uint64_t GetSeed() const { return seed; }
+
+	protected:
+		uint64_t Hash(uint32_t pixel, uint32_t dimension) const
+		{
+			return MixBits(seed ^ MixBits((uint64_t(pixel) << 32) | dimension));
+		}
+
+		int samplesPerPixel;
+		uint64_t seed;
+	};
+
+	class IndependentSampler final :public Sampler {
+	public:
+		using Sampler::Sampler;
+		Real Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+	};
+
+	// Stratified in 1D (samplesPerPixel strata) and in 2D (a grid of them, as square as the
+	// count allows); which sample gets which stratum is permuted per pixel and dimension.
+	class StratifiedSampler final :public Sampler {
+	public:
+		StratifiedSampler(int samplesPerPixel, uint64_t seed);
+		Real Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+		vec2 Get2D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+
+	private:
+		int xStrata, yStrata;
+	};
+
+	// Dimensions past the prime table are independent.
+	class HaltonSampler final :public Sampler {
+	public:
+		using Sampler::Sampler;
+		Real Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+
+	public:
+		static constexpr uint32_t maxDimensions = 256;
+	};
+
+	// Burley's shuffled, scrambled Sobol' (2020): every prefix of 2^k samples of a pixel is
+	// stratified, so it suits any sample count, best powers of two.
+	class SobolSampler final :public Sampler {
+	public:
+		using Sampler::Sampler;
+		Real Get1D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+		vec2 Get2D(uint32_t pixel, uint32_t sampleIndex, uint32_t dimension) const override;
+	};
+
+	std::shared_ptr<Sampler> CreateSampler(SamplerType type, int samplesPerPixel, uint64_t seed);
+	const char* GetSamplerTypeName(SamplerType type);
+}
\ No newline at end of file
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "AABB.h"
+#include "SAH.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace Pooraytracer {
+
+	class Hittable;
+
+	// Spatial splits (SBVH, Stich et al. 2009), shared by the BVH builders. A primitive reference
+	// straddling the split plane is clipped and kept on both sides, which removes the overlap
+	// object splits suffer from on long, thin triangles.
+	constexpr int SpatialBinCount = 16;
+	// Spatial splits are only tried where the object split's children overlap by more than
+	// this fraction of the root surface area.
+	constexpr double SpatialSplitAlpha = 1e-5;
+
+	struct SpatialSplit {
+		int axis = -1;	// -1: no valid split was found
+		int bin = 0;	// the plane sits at the upper side of this bin
+		Real position = 0.0;
+		double cost = std::numeric_limits<double>::infinity();
+		size_t leftCount = 0;	// references on each side, straddling ones counted on both
+		size_t rightCount = 0;
+	};
+
+	inline bool IsEmpty(const AABB& box)
+	{
+		return box.x.min > box.x.max || box.y.min > box.y.max || box.z.min > box.z.max;
+	}
+
+	inline AABB IntersectBounds(const AABB& a, const AABB& b)
+	{
+		Interval x(std::max(a.x.min, b.x.min), std::min(a.x.max, b.x.max));
+		Interval y(std::max(a.y.min, b.y.min), std::min(a.y.max, b.y.max));
+		Interval z(std::max(a.z.min, b.z.min), std::min(a.z.max, b.z.max));
+		if (x.min > x.max || y.min > y.max || z.min > z.max) {
+			return AABB::empty;
+		}
+		return AABB(x, y, z);
+	}
+
+	// Bounds of the part of triangle `v` inside the slab lo <= p[axis] <= hi, restricted to `bbox`.
+	// The clipped polygon's vertices are the triangle vertices inside the slab plus the points
+	// where its edges cross the two planes, so bounding those is exact.
+	template <typename Vertices>
+	AABB ClipTriangleToSlab(const Vertices& v, const AABB& bbox, int axis, Real lo, Real hi)
+	{
+		vec3 minCorner(Infinity);
+		vec3 maxCorner(-Infinity);
+		auto add = [&](const vec3& p) {
+			for (int i = 0; i < 3; ++i) {
+				minCorner[i] = std::min(minCorner[i], p[i]);
+				maxCorner[i] = std::max(maxCorner[i], p[i]);
+			}
+			};
+		for (int i = 0; i < 3; ++i) {
+			const vec3& a = v[i];
+			const vec3& b = v[(i + 1) % 3];
+			if (lo <= a[axis] && a[axis] <= hi) {
+				add(a);
+			}
+			for (Real plane : { lo, hi }) {
+				if ((a[axis] < plane && plane < b[axis]) || (b[axis] < plane && plane < a[axis])) {
+					Real t = (plane - a[axis]) / (b[axis] - a[axis]);
+					vec3 p = a + t * (b - a);
+					p[axis] = plane;
+					add(p);
+				}
+			}
+		}
+		if (minCorner.x > maxCorner.x) {
+			return AABB::empty;
+		}
+		return IntersectBounds(AABB(minCorner, maxCorner), bbox);
+	}
+
+	inline int SpatialBinIndex(const AABB& bounds, int axis, Real x)
+	{
+		const Interval& extent = bounds.GetAxisInterval(axis);
+		int bin = static_cast<int>(SpatialBinCount * (x - extent.min) / extent.Length());
+		return std::clamp(bin, 0, SpatialBinCount - 1);
+	}
+
+	inline Real SpatialBinBoundary(const AABB& bounds, int axis, int bin)
+	{
+		const Interval& extent = bounds.GetAxisInterval(axis);
+		return extent.min + extent.Length() * bin / SpatialBinCount;
+	}
+
+	// Evaluates the SAH for every spatial bin boundary on all three axes and returns the cheapest split.
+	// `BoxOf` maps an element of [begin, end) to its (already clipped) bounds, `ClipOf(element, axis, lo, hi)`
+	// to the bounds of its part inside that slab.
+	template <typename Iterator, typename BoxOf, typename ClipOf>
+	SpatialSplit FindSpatialSplit(Iterator begin, Iterator end, const AABB& bounds, BoxOf boxOf, ClipOf clipOf)
+	{
+		struct Bin {
+			AABB bbox = AABB::empty;
+			size_t entries = 0;
+			size_t exits = 0;
+		};
+
+		SpatialSplit best;
+		double invArea = 1.0 / bounds.SurfaceArea();
+
+		for (int axis = 0; axis < 3; ++axis) {
+			if (bounds.GetAxisInterval(axis).Length() <= 0.0) {
+				continue;
+			}
+			std::array<Bin, SpatialBinCount> bins;
+			for (Iterator it = begin; it != end; ++it) {
+				const AABB& box = boxOf(*it);
+				int firstBin = SpatialBinIndex(bounds, axis, box.GetAxisInterval(axis).min);
+				int lastBin = SpatialBinIndex(bounds, axis, box.GetAxisInterval(axis).max);
+				for (int bin = firstBin; bin <= lastBin; ++bin) {
+					AABB clipped = (firstBin == lastBin) ? box : clipOf(*it, axis,
+						SpatialBinBoundary(bounds, axis, bin), SpatialBinBoundary(bounds, axis, bin + 1));
+					if (!IsEmpty(clipped)) {
+						bins[bin].bbox = AABB(bins[bin].bbox, clipped);
+					}
+				}
+				++bins[firstBin].entries;
+				++bins[lastBin].exits;
+			}
+
+			std::array<double, SpatialBinCount - 1> rightArea;
+			std::array<size_t, SpatialBinCount - 1> rightCount;
+			AABB rightBox = AABB::empty;
+			size_t count = 0;
+			for (int i = SpatialBinCount - 1; i > 0; --i) {
+				rightBox = AABB(rightBox, bins[i].bbox);
+				count += bins[i].exits;
+				rightArea[i - 1] = rightBox.SurfaceArea();
+				rightCount[i - 1] = count;
+			}
+
+			AABB leftBox = AABB::empty;
+			size_t leftCount = 0;
+			for (int i = 0; i < SpatialBinCount - 1; ++i) {
+				leftBox = AABB(leftBox, bins[i].bbox);
+				leftCount += bins[i].entries;
+				if (leftCount == 0 || rightCount[i] == 0) {
+					continue;
+				}
+				double cost = SAHTraversalCost + SAHIntersectionCost *
+					(leftCount * leftBox.SurfaceArea() + rightCount[i] * rightArea[i]) * invArea;
+				if (cost < best.cost) {
+					best.axis = axis;
+					best.bin = i;
+					best.position = SpatialBinBoundary(bounds, axis, i + 1);
+					best.cost = cost;
+					best.leftCount = leftCount;
+					best.rightCount = rightCount[i];
+				}
+			}
+		}
+		return best;
+	}
+
+	// Maps an offset within the share `area` of a (possibly duplicated) primitive reference
+	// onto the primitive's whole area; the identity for unshared references.
+	template <typename Primitive>
+	Real ScaleToPrimitiveArea(Real p, Real area, const Primitive* primitive)
+	{
+		Real primitiveArea = primitive->GetArea();
+		return (area > 0.0 && area != primitiveArea) ? p * (primitiveArea / area) : p;
+	}
+
+	// Remembers the primitives one ray has already been tested against, so a primitive referenced
+	// from several leaves is intersected once. Direct-mapped: a collision only costs a repeated test,
+	// which is harmless because a repeated test can never produce a closer hit.
+	class Mailbox {
+	public:
+		// True the first time `primitive` is seen.
+		bool Visit(const Hittable* primitive) {
+			size_t slot = (reinterpret_cast<uintptr_t>(primitive) >> 4) & (slotNums - 1);
+			if (slots[slot] == primitive) {
+				return false;
+			}
+			slots[slot] = primitive;
+			return true;
+		}
+	private:
+		static constexpr size_t slotNums = 16;
+		const Hittable* slots[slotNums] = {};
+	};
+}
\ No newline at end of file
@@ -0,0 +1,538 @@
+#include "StreamedGeometry.h"
+#include "Logger.h"
+#include "Material.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace Pooraytracer {
+
+	namespace {
+		constexpr char chunkFileMagic[8] = { 'P', 'R', 'T', 'C', 'H', 'N', 'K', '2' };
+
+		// The chunk table and the source record follow the chunks.
+		struct GeometryChunkFileHeader {
+			char magic[8];
+			uint32_t chunkNums;
+			uint32_t materialNums;
+			uint64_t tableOffset;
+			uint64_t sourceOffset;
+			uint64_t sourceHash;
+		};
+
+		// A chunk skipped by a deferred ray.
+		struct SkippedChunk {
+			const Hittable* chunk;
+			bool bResident;		// when resumed
+			Ray ray;
+			uint32_t query;
+		};
+
+		// Deferral state of the calling thread.
+		struct DeferState {
+			bool bDefer = false;
+			std::vector<std::pair<const Hittable*, Ray>> skipped;	// by the ray being traced
+			std::vector<SkippedChunk> queue;
+		};
+		thread_local DeferState deferState;
+
+		// The mesh a chunk is loaded as; the writer builds the same one to measure bounds and area.
+		shared_ptr<Mesh> MakeChunkMesh(uint32_t chunkIdx, const std::vector<float>& positions, const std::vector<float>& normals,
+			const std::vector<float>& texCoords, std::vector<uint32_t> indices, shared_ptr<Material> material)
+		{
+			const size_t vertexNums = positions.size() / 3;
+			std::vector<vec3> meshPositions(vertexNums), meshNormals(vertexNums);
+			std::vector<vec2> meshTexCoords(vertexNums);
+			for (size_t i = 0; i < vertexNums; ++i) {
+				meshPositions[i] = vec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+				meshNormals[i] = vec3(normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]);
+				meshTexCoords[i] = vec2(texCoords[2 * i], texCoords[2 * i + 1]);
+			}
+			return std::make_shared<Mesh>("chunk " + std::to_string(chunkIdx), std::move(meshPositions), std::move(meshNormals),
+				std::move(meshTexCoords), std::move(indices), material);
+		}
+
+		template <typename T>
+		void WriteArray(std::ofstream& file, const std::vector<T>& values)
+		{
+			file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+		}
+
+		template <typename T>
+		bool ReadArray(std::ifstream& file, std::vector<T>& values)
+		{
+			return static_cast<bool>(file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T)));
+		}
+
+		// Strings as their length and bytes.
+		void WriteStrings(std::ofstream& file, const std::vector<std::string>& strings)
+		{
+			const uint32_t stringNums = static_cast<uint32_t>(strings.size());
+			file.write(reinterpret_cast<const char*>(&stringNums), sizeof(stringNums));
+			for (const std::string& string : strings) {
+				const uint32_t length = static_cast<uint32_t>(string.size());
+				file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+				file.write(string.data(), length);
+			}
+		}
+
+		bool ReadStrings(std::ifstream& file, std::vector<std::string>& strings)
+		{
+			uint32_t stringNums = 0;
+			if (!file.read(reinterpret_cast<char*>(&stringNums), sizeof(stringNums))) {
+				return false;
+			}
+			strings.clear();
+			for (uint32_t i = 0; i < stringNums; ++i) {
+				uint32_t length = 0;
+				if (!file.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+					return false;
+				}
+				std::string string(length, '\0');
+				if (!file.read(string.data(), length)) {
+					return false;
+				}
+				strings.push_back(std::move(string));
+			}
+			return true;
+		}
+
+		bool ReadHeader(std::ifstream& file, GeometryChunkFileHeader& header)
+		{
+			return file.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+				std::memcmp(header.magic, chunkFileMagic, sizeof(chunkFileMagic)) == 0;
+		}
+
+		// Interleaves the low 10 bits of x, y and z.
+		uint32_t MortonCode(uint32_t x, uint32_t y, uint32_t z)
+		{
+			uint32_t code = 0;
+			for (int bit = 0; bit < 10; ++bit) {
+				code |= ((x >> bit) & 1u) << (3 * bit) | ((y >> bit) & 1u) << (3 * bit + 1) | ((z >> bit) & 1u) << (3 * bit + 2);
+			}
+			return code;
+		}
+	}
+
+	GeometryChunkWriter::GeometryChunkWriter(const std::string& path, const std::vector<shared_ptr<Material>>& materials,
+		const GeometryChunkSource& source, uint32_t chunkTriangles) :
+		file(path, std::ios::binary | std::ios::trunc), materials(materials), source(source), chunkTriangles(std::max(chunkTriangles, 1u))
+	{
+		if (!file.is_open()) {
+			LOGE("Cannot open chunk file {} for writing", path);
+			return;
+		}
+		if (source.materialNames.size() != materials.size()) {
+			LOGE("Chunk file {}: {} material names for {} materials", path, source.materialNames.size(), materials.size());
+			file.close();
+			return;
+		}
+		// Filled in by Finish().
+		GeometryChunkFileHeader header{};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+
+	bool GeometryChunkWriter::Add(const Mesh& mesh)
+	{
+		if (!file.is_open()) {
+			return false;
+		}
+		auto materialIt = std::find(materials.begin(), materials.end(), mesh.material);
+		if (materialIt == materials.end()) {
+			LOGE("Mesh {}: its material is not in the chunk file's material table", mesh.name);
+			return false;
+		}
+		const uint32_t faceNums = static_cast<uint32_t>(mesh.GetFaceNums());
+		if (faceNums == 0) {
+			return true;
+		}
+
+		// Faces in Morton order of their centroids, quantized to 10 bits per axis within the mesh.
+		std::vector<vec3> centroids(faceNums);
+		vec3 centroidMin(Infinity), centroidMax(-Infinity);
+		for (uint32_t face = 0; face < faceNums; ++face) {
+			centroids[face] = (mesh.Position(face, 0) + mesh.Position(face, 1) + mesh.Position(face, 2)) / Real(3);
+			centroidMin = glm::min(centroidMin, centroids[face]);
+			centroidMax = glm::max(centroidMax, centroids[face]);
+		}
+		const vec3 extent = centroidMax - centroidMin;
+		std::vector<std::pair<uint32_t, uint32_t>> order(faceNums);
+		for (uint32_t face = 0; face < faceNums; ++face) {
+			uint32_t q[3];
+			for (int axis = 0; axis < 3; ++axis) {
+				Real t = extent[axis] > 0 ? (centroids[face][axis] - centroidMin[axis]) / extent[axis] : Real(0);
+				q[axis] = std::min(static_cast<uint32_t>(t * 1024), 1023u);
+			}
+			order[face] = { MortonCode(q[0], q[1], q[2]), face };
+		}
+		std::sort(order.begin(), order.end());
+
+		const bool bNormals = mesh.normals.size() == mesh.positions.size();
+		const bool bTexCoords = mesh.texCoords.size() == mesh.positions.size();
+		for (uint32_t start = 0; start < faceNums; start += chunkTriangles) {
+			const uint32_t end = std::min(start + chunkTriangles, faceNums);
+			std::unordered_map<uint32_t, uint32_t> chunkVertices;
+			std::vector<float> positions, normals, texCoords;
+			std::vector<uint32_t> indices;
+			indices.reserve(3 * size_t(end - start));
+			for (uint32_t i = start; i < end; ++i) {
+				const uint32_t face = order[i].second;
+				for (int corner = 0; corner < 3; ++corner) {
+					const uint32_t vertex = mesh.indices[3 * face + corner];
+					auto [it, bInserted] = chunkVertices.try_emplace(vertex, static_cast<uint32_t>(chunkVertices.size()));
+					if (bInserted) {
+						const vec3& p = mesh.positions[vertex];
+						const vec3 n = bNormals ? mesh.normals[vertex] : vec3(0.);
+						const vec2 uv = bTexCoords ? mesh.texCoords[vertex] : vec2(0.);
+						positions.insert(positions.end(), { float(p.x), float(p.y), float(p.z) });
+						normals.insert(normals.end(), { float(n.x), float(n.y), float(n.z) });
+						texCoords.insert(texCoords.end(), { float(uv.x), float(uv.y) });
+					}
+					indices.push_back(it->second);
+				}
+			}
+
+			GeometryChunkRecord record{};
+			record.offset = static_cast<uint64_t>(file.tellp());
+			record.vertexNums = static_cast<uint32_t>(chunkVertices.size());
+			record.faceNums = end - start;
+			record.material = static_cast<uint32_t>(materialIt - materials.begin());
+			// Measured on the chunk as it will be loaded, i.e. with float vertices.
+			shared_ptr<Mesh> chunkMesh = MakeChunkMesh(static_cast<uint32_t>(records.size()), positions, normals, texCoords, indices, mesh.material);
+			AABB bounds = AABB::empty;
+			for (const Triangle& triangle : chunkMesh->triangles) {
+				bounds = AABB(bounds, triangle.BoundingBox());
+				record.area += triangle.GetArea();
+			}
+			for (int axis = 0; axis < 3; ++axis) {
+				record.boundsMin[axis] = bounds.GetAxisInterval(axis).min;
+				record.boundsMax[axis] = bounds.GetAxisInterval(axis).max;
+			}
+			WriteArray(file, positions);
+			WriteArray(file, normals);
+			WriteArray(file, texCoords);
+			WriteArray(file, indices);
+			records.push_back(record);
+		}
+		return file.good();
+	}
+
+	bool GeometryChunkWriter::Finish()
+	{
+		if (!file.is_open()) {
+			return false;
+		}
+		GeometryChunkFileHeader header{};
+		std::memcpy(header.magic, chunkFileMagic, sizeof(chunkFileMagic));
+		header.chunkNums = static_cast<uint32_t>(records.size());
+		header.materialNums = static_cast<uint32_t>(materials.size());
+		header.tableOffset = static_cast<uint64_t>(file.tellp());
+		WriteArray(file, records);
+		header.sourceOffset = static_cast<uint64_t>(file.tellp());
+		header.sourceHash = source.hash;
+		WriteStrings(file, source.materialLibraries);
+		WriteStrings(file, source.materialNames);
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		bool bGood = file.good();
+		file.close();
+		if (!bGood) {
+			LOGE("Writing the chunk file failed");
+		}
+		return bGood;
+	}
+
+	StreamedGeometry::StreamedGeometry(const std::string& path, std::vector<shared_ptr<Material>> materials, size_t cacheBytes,
+		int threadNums) :
+		path(path), materials(std::move(materials)), cacheBytes(cacheBytes)
+	{
+		std::ifstream file(path, std::ios::binary);
+		GeometryChunkFileHeader header{};
+		if (!ReadHeader(file, header)) {
+			LOGE("{} is not a chunk file", path);
+			return;
+		}
+		chunks.resize(header.chunkNums);
+		file.seekg(header.tableOffset);
+		if (!ReadArray(file, chunks)) {
+			LOGE("Chunk file {} is truncated", path);
+			chunks.clear();
+			return;
+		}
+		for (const GeometryChunkRecord& record : chunks) {
+			if (record.material >= this->materials.size()) {
+				LOGE("Chunk file {} refers to material {}, only {} given", path, record.material, this->materials.size());
+				chunks.clear();
+				faceNums = 0;
+				return;
+			}
+			faceNums += record.faceNums;
+		}
+		if (chunks.empty()) {
+			return;
+		}
+
+		resident.resize(chunks.size());
+		lastUse = std::make_unique<std::atomic<uint64_t>[]>(chunks.size());
+		loadMutexes = std::make_unique<std::mutex[]>(chunks.size());
+		bLoadFailed = std::make_unique<std::atomic<bool>[]>(chunks.size());
+		proxies.reserve(chunks.size());
+		for (uint32_t chunkIdx = 0; chunkIdx < chunks.size(); ++chunkIdx) {
+			const GeometryChunkRecord& record = chunks[chunkIdx];
+			AABB chunkBounds(Interval(record.boundsMin[0], record.boundsMax[0]), Interval(record.boundsMin[1], record.boundsMax[1]),
+				Interval(record.boundsMin[2], record.boundsMax[2]));
+			proxies.push_back(std::make_shared<ChunkProxy>(this, chunkIdx, chunkBounds, static_cast<Real>(record.area)));
+		}
+		topLevel = std::make_shared<BVH8>(LinearBVH(proxies, BVHSplitMethod::SAH, threadNums));
+		bbox = topLevel->BoundingBox();
+		area = topLevel->GetArea();
+		LOGI("Streamed geometry {}: {} chunks, {} triangles, {:.2f} MB cache", path, chunks.size(), faceNums, cacheBytes / 1048576.0);
+	}
+
+	bool StreamedGeometry::ReadSource(const std::string& path, GeometryChunkSource& source)
+	{
+		std::ifstream file(path, std::ios::binary);
+		GeometryChunkFileHeader header{};
+		if (!ReadHeader(file, header) || header.sourceOffset == 0) {
+			return false;
+		}
+		file.seekg(header.sourceOffset);
+		if (!ReadStrings(file, source.materialLibraries) || !ReadStrings(file, source.materialNames) ||
+			source.materialNames.size() != header.materialNums) {
+			return false;
+		}
+		source.hash = header.sourceHash;
+		return true;
+	}
+
+	bool StreamedGeometry::Hit(const Ray& ray, Interval domain, HitRecord& record) const
+	{
+		return topLevel && topLevel->Hit(ray, domain, record);
+	}
+
+	bool StreamedGeometry::Occluded(const Ray& ray, Interval domain) const
+	{
+		return topLevel && topLevel->Occluded(ray, domain);
+	}
+
+	void StreamedGeometry::HitPacket(const RayPacket& packet, Interval domain, RayPacketHits& hits) const
+	{
+		if (topLevel) {
+			topLevel->HitPacket(packet, domain, hits);
+		}
+	}
+
+	void StreamedGeometry::Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		if (topLevel) {
+			topLevel->Sample(origin, samplePointRecord, pdf);
+		}
+	}
+
+	void StreamedGeometry::SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		if (topLevel) {
+			topLevel->SampleByArea(origin, p, samplePointRecord, pdf);
+		}
+	}
+
+	std::vector<shared_ptr<Hittable>> StreamedGeometry::GetEmissiveChunks() const
+	{
+		std::vector<shared_ptr<Hittable>> emissive;
+		for (uint32_t chunkIdx = 0; chunkIdx < chunks.size(); ++chunkIdx) {
+			if (materials[chunks[chunkIdx].material]->HasEmission()) {
+				emissive.push_back(proxies[chunkIdx]);
+			}
+		}
+		return emissive;
+	}
+
+	size_t StreamedGeometry::GetResidentBytes() const
+	{
+		std::shared_lock lock(residentMutex);
+		return residentBytes;
+	}
+
+	void StreamedGeometry::SetDeferMisses(bool bDefer)
+	{
+		deferState.bDefer = bDefer;
+	}
+
+	bool StreamedGeometry::TakeDeferred(uint32_t query)
+	{
+		if (deferState.skipped.empty()) {
+			return false;
+		}
+		for (const auto& [chunk, ray] : deferState.skipped) {
+			deferState.queue.push_back({ chunk, false, ray, query });
+		}
+		deferState.skipped.clear();
+		return true;
+	}
+
+	void StreamedGeometry::ResumeDeferred(const std::function<void(const Hittable& chunk, const Ray& ray, uint32_t query)>& test)
+	{
+		std::vector<SkippedChunk> queue;
+		queue.swap(deferState.queue);
+		for (SkippedChunk& skipped : queue) {
+			const ChunkProxy* proxy = static_cast<const ChunkProxy*>(skipped.chunk);
+			skipped.bResident = proxy->geometry->FindResident(proxy->chunkIdx) != nullptr;
+		}
+		// Resident chunks first, before loading the others can evict them; the others in file order.
+		std::stable_sort(queue.begin(), queue.end(), [](const SkippedChunk& a, const SkippedChunk& b) {
+			if (a.bResident != b.bResident) {
+				return a.bResident;
+			}
+			const ChunkProxy* proxyA = static_cast<const ChunkProxy*>(a.chunk);
+			const ChunkProxy* proxyB = static_cast<const ChunkProxy*>(b.chunk);
+			if (proxyA->geometry != proxyB->geometry) {
+				return std::less<const StreamedGeometry*>()(proxyA->geometry, proxyB->geometry);
+			}
+			return proxyA->chunkIdx < proxyB->chunkIdx;
+		});
+		for (const SkippedChunk& skipped : queue) {
+			test(*skipped.chunk, skipped.ray, skipped.query);
+		}
+	}
+
+	shared_ptr<const StreamedGeometry::LoadedChunk> StreamedGeometry::FindResident(uint32_t chunkIdx) const
+	{
+		std::shared_lock lock(residentMutex);
+		if (const shared_ptr<const LoadedChunk>& chunk = resident[chunkIdx]) {
+			// Only written when it changes, so hot chunks don't bounce a cache line between threads.
+			const uint64_t stamp = loadNums.load(std::memory_order_relaxed);
+			if (lastUse[chunkIdx].load(std::memory_order_relaxed) != stamp) {
+				lastUse[chunkIdx].store(stamp, std::memory_order_relaxed);
+			}
+			return chunk;
+		}
+		return nullptr;
+	}
+
+	shared_ptr<const StreamedGeometry::LoadedChunk> StreamedGeometry::Acquire(uint32_t chunkIdx, bool bMayDefer) const
+	{
+		if (shared_ptr<const LoadedChunk> chunk = FindResident(chunkIdx)) {
+			return chunk;
+		}
+		if (bLoadFailed[chunkIdx].load(std::memory_order_relaxed)) {
+			return nullptr;
+		}
+		if (bMayDefer && deferState.bDefer) {
+			return nullptr;
+		}
+		return Load(chunkIdx);
+	}
+
+	shared_ptr<const StreamedGeometry::LoadedChunk> StreamedGeometry::Load(uint32_t chunkIdx) const
+	{
+		std::lock_guard loadLock(loadMutexes[chunkIdx]);
+		{
+			// Another thread may have loaded it while this one waited.
+			std::shared_lock lock(residentMutex);
+			if (resident[chunkIdx]) {
+				return resident[chunkIdx];
+			}
+		}
+		if (bLoadFailed[chunkIdx].load(std::memory_order_relaxed)) {
+			return nullptr;
+		}
+		shared_ptr<const LoadedChunk> chunk = Read(chunkIdx);
+		if (!chunk) {
+			LOGE("Chunk {} of {} is left out of the render", chunkIdx, path);
+			bLoadFailed[chunkIdx].store(true, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		std::unique_lock lock(residentMutex);
+		resident[chunkIdx] = chunk;
+		residentChunks.push_back(chunkIdx);
+		residentBytes += chunk->bytes;
+		lastUse[chunkIdx].store(++loadNums, std::memory_order_relaxed);
+		peakResidentBytes = std::max<size_t>(peakResidentBytes, residentBytes);
+		// Evict least recently used chunks until the cache fits again. The new chunk has the
+		// newest stamp and comes last, so it is never the one picked.
+		while (residentBytes > cacheBytes && residentChunks.size() > 1) {
+			auto oldest = std::min_element(residentChunks.begin(), residentChunks.end(), [this](uint32_t a, uint32_t b) {
+				return lastUse[a].load(std::memory_order_relaxed) < lastUse[b].load(std::memory_order_relaxed);
+			});
+			residentBytes -= resident[*oldest]->bytes;
+			resident[*oldest].reset();
+			residentChunks.erase(oldest);
+			++evictionNums;
+		}
+		return chunk;
+	}
+
+	shared_ptr<const StreamedGeometry::LoadedChunk> StreamedGeometry::Read(uint32_t chunkIdx) const
+	{
+		const GeometryChunkRecord& record = chunks[chunkIdx];
+		std::vector<float> positions(3 * size_t(record.vertexNums)), normals(3 * size_t(record.vertexNums)), texCoords(2 * size_t(record.vertexNums));
+		std::vector<uint32_t> indices(3 * size_t(record.faceNums));
+		std::ifstream file(path, std::ios::binary);
+		file.seekg(record.offset);
+		if (!ReadArray(file, positions) || !ReadArray(file, normals) || !ReadArray(file, texCoords) || !ReadArray(file, indices)) {
+			LOGE("Reading chunk {} of {} failed", chunkIdx, path);
+			return nullptr;
+		}
+
+		auto chunk = std::make_shared<LoadedChunk>();
+		chunk->mesh = MakeChunkMesh(chunkIdx, positions, normals, texCoords, std::move(indices), materials[record.material]);
+		// On the render thread that wants it: single-threaded, the other threads keep rendering.
+		chunk->bvh = std::make_shared<BVH8>(LinearBVH(chunk->mesh, BVHSplitMethod::SAH, 1));
+		chunk->bytes = chunk->mesh->GetMemoryBytes() + chunk->bvh->GetMemoryBytes();
+		return chunk;
+	}
+
+	bool StreamedGeometry::ChunkProxy::Hit(const Ray& ray, Interval domain, HitRecord& record) const
+	{
+		shared_ptr<const LoadedChunk> chunk = geometry->Acquire(chunkIdx, true);
+		if (!chunk) {
+			// Skipped for later, unless it failed to load.
+			if (deferState.bDefer && !geometry->bLoadFailed[chunkIdx].load(std::memory_order_relaxed)) {
+				deferState.skipped.emplace_back(this, ray);
+			}
+			return false;
+		}
+		if (!chunk->bvh->Hit(ray, domain, record)) {
+			return false;
+		}
+		record.primitiveIndex = static_cast<const Triangle*>(record.primitive)->face;
+		record.primitive = this;
+		return true;
+	}
+
+	bool StreamedGeometry::ChunkProxy::Occluded(const Ray& ray, Interval domain) const
+	{
+		shared_ptr<const LoadedChunk> chunk = geometry->Acquire(chunkIdx, true);
+		if (!chunk) {
+			// Skipped for later, unless it failed to load.
+			if (deferState.bDefer && !geometry->bLoadFailed[chunkIdx].load(std::memory_order_relaxed)) {
+				deferState.skipped.emplace_back(this, ray);
+			}
+			return false;
+		}
+		return chunk->bvh->Occluded(ray, domain);
+	}
+
+	void StreamedGeometry::ChunkProxy::Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		if (shared_ptr<const LoadedChunk> chunk = geometry->Acquire(chunkIdx, false)) {
+			chunk->bvh->Sample(origin, samplePointRecord, pdf);
+		}
+	}
+
+	void StreamedGeometry::ChunkProxy::SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		if (shared_ptr<const LoadedChunk> chunk = geometry->Acquire(chunkIdx, false)) {
+			chunk->bvh->SampleByArea(origin, p, samplePointRecord, pdf);
+		}
+	}
+
+	void StreamedGeometry::ChunkProxy::SetHitRecord(const Ray& ray, HitRecord& record) const
+	{
+		// Reloaded if it was evicted since the hit.
+		if (shared_ptr<const LoadedChunk> chunk = geometry->Acquire(chunkIdx, false)) {
+			chunk->mesh->triangles[record.primitiveIndex].SetHitRecord(ray, record);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,179 @@
+#pragma once
+#include "Hittable.h"
+#include "HittableList.h"
+#include "Triangle.h"
+#include "WideBVH.h"
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace Pooraytracer {
+
+	// Table entry of a chunk file, one per chunk, stored at the end of the file.
+	struct GeometryChunkRecord {
+		uint64_t offset;			// of the chunk's vertex and index data
+		uint32_t vertexNums;
+		uint32_t faceNums;
+		uint32_t material;			// index into the materials the file is opened with
+		uint32_t reserved;
+		double boundsMin[3];		// union of the triangles' AABBs, as they are rebuilt when loading
+		double boundsMax[3];
+		double area;
+	};
+
+	// What a chunk file was converted from, stored in it: the material table by name and the .mtl
+	// files defining them, so the chunks can be rendered without parsing the model again, and a
+	// hash of the source files, to tell a stale conversion.
+	struct GeometryChunkSource {
+		std::vector<std::string> materialLibraries;
+		std::vector<std::string> materialNames;		// in the order chunk records refer to them
+		uint64_t hash = 0;
+	};
+
+	// Writes meshes to a chunk file: each mesh is cut into spatially coherent chunks of at most
+	// `chunkTriangles` faces (in Morton order of their centroids), stored one after another with
+	// positions, normals and uvs as floats. Meshes are added one at a time, so a converter only
+	// needs one of them in memory.
+	class GeometryChunkWriter {
+	public:
+		// `materials` is the table chunks refer to, named by `source.materialNames`; every added
+		// mesh's material has to be in it.
+		GeometryChunkWriter(const std::string& path, const std::vector<shared_ptr<Material>>& materials,
+			const GeometryChunkSource& source, uint32_t chunkTriangles = defaultChunkTriangles);
+
+		bool Add(const Mesh& mesh);
+		// Writes the chunk table; the file is only valid afterwards.
+		bool Finish();
+
+		size_t GetChunkNums() const { return records.size(); }
+
+	public:
+		static constexpr uint32_t defaultChunkTriangles = 1 << 14;
+
+	private:
+		std::ofstream file;
+		std::vector<shared_ptr<Material>> materials;
+		GeometryChunkSource source;
+		uint32_t chunkTriangles;
+		std::vector<GeometryChunkRecord> records;
+	};
+
+	// Out-of-core geometry: the chunks of a chunk file behind a resident top-level BVH over their
+	// bounds. A chunk's triangles and BVH are loaded when a ray first reaches it and kept in an
+	// LRU cache of at most `cacheBytes`. Different chunks load in parallel, a chunk wanted by
+	// several threads is loaded once. Chunks in use by a ray stay alive until it is done with
+	// them, so memory is bounded by the cache plus one chunk per render thread. A chunk that fails
+	// to load is reported once and renders as empty.
+	// Rays traced with deferral on (SetDeferMisses) do not wait for the disk: they skip the chunks
+	// that are not resident and get the closest hit among the others. The skipped chunks are then
+	// tested by ResumeDeferred() chunk by chunk, for all waiting rays at once, so a batch of rays
+	// loads each chunk at most once and needs only one of them at a time. Resumed hits are in the
+	// geometry's own space, so it is not to be placed under an Instance.
+	class StreamedGeometry :public Hittable {
+	public:
+		// `materials` in the order of the file's GeometryChunkSource::materialNames; `threadNums`
+		// builds the top-level BVH.
+		StreamedGeometry(const std::string& path, std::vector<shared_ptr<Material>> materials, size_t cacheBytes,
+			int threadNums = 1);
+		// The source record of a chunk file, without opening its chunks. False if it is not a
+		// complete chunk file.
+		static bool ReadSource(const std::string& path, GeometryChunkSource& source);
+		StreamedGeometry(const StreamedGeometry&) = delete;
+		StreamedGeometry& operator=(const StreamedGeometry&) = delete;
+
+		bool Hit(const Ray& ray, Interval domain, HitRecord& record) const override;
+		bool Occluded(const Ray& ray, Interval domain) const override;
+		void HitPacket(const RayPacket& packet, Interval domain, RayPacketHits& hits) const override;
+		AABB BoundingBox() const override { return bbox; }
+		Real GetArea() const override { return area; }
+		void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const override;
+		void SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const override;
+
+		// The chunks whose material emits, to build the lights list from. Sampling them loads them.
+		std::vector<shared_ptr<Hittable>> GetEmissiveChunks() const;
+
+		size_t GetChunkNums() const { return chunks.size(); }
+		size_t GetFaceNums() const { return faceNums; }
+		size_t GetResidentBytes() const;
+		size_t GetPeakResidentBytes() const { return peakResidentBytes; }
+		size_t GetLoadNums() const { return loadNums; }
+		size_t GetEvictionNums() const { return evictionNums; }
+
+		// Per thread: while on, rays reaching a chunk that is not resident skip it instead of waiting.
+		static void SetDeferMisses(bool bDefer);
+		// Queues the chunks the ray just traced on this thread skipped, under the caller's `query`
+		// id. Whether it skipped any, i.e. whether its result is incomplete.
+		static bool TakeDeferred(uint32_t query);
+		// Calls `test(chunk, ray, query)` for every queued chunk and the ray that skipped it, as the
+		// chunk saw it; grouped by chunk, resident ones first. `test` narrows the domain to the
+		// query's result so far, and finds the chunk loaded when it actually traces into it.
+		// Clears the queue.
+		static void ResumeDeferred(const std::function<void(const Hittable& chunk, const Ray& ray, uint32_t query)>& test);
+
+	private:
+		struct LoadedChunk {
+			shared_ptr<Mesh> mesh;
+			shared_ptr<BVH8> bvh;
+			size_t bytes;
+		};
+
+		// A chunk in the top-level BVH. Hits record the proxy and the face, so shading finds the
+		// triangle again even if the chunk was evicted in between.
+		class ChunkProxy :public Hittable {
+		public:
+			ChunkProxy(const StreamedGeometry* geometry, uint32_t chunkIdx, const AABB& bbox, Real area) :
+				geometry(geometry), chunkIdx(chunkIdx), bbox(bbox), area(area) {}
+
+			bool Hit(const Ray& ray, Interval domain, HitRecord& record) const override;
+			bool Occluded(const Ray& ray, Interval domain) const override;
+			AABB BoundingBox() const override { return bbox; }
+			Real GetArea() const override { return area; }
+			void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const override;
+			void SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const override;
+			void SetHitRecord(const Ray& ray, HitRecord& record) const override;
+
+		private:
+			friend class StreamedGeometry;
+			const StreamedGeometry* geometry;
+			uint32_t chunkIdx;
+			AABB bbox;
+			Real area;
+		};
+
+		std::string path;
+		std::vector<shared_ptr<Material>> materials;
+		std::vector<GeometryChunkRecord> chunks;
+		std::vector<shared_ptr<Hittable>> proxies;
+		shared_ptr<BVH8> topLevel;
+		AABB bbox = AABB::empty;
+		Real area = 0.0;
+		size_t faceNums = 0;
+		size_t cacheBytes;
+
+		// Residency. Chunks are stamped with the load count when used; eviction drops the one
+		// with the oldest stamp.
+		mutable std::shared_mutex residentMutex;
+		mutable std::vector<shared_ptr<const LoadedChunk>> resident;
+		mutable std::vector<uint32_t> residentChunks;
+		mutable std::unique_ptr<std::atomic<uint64_t>[]> lastUse;
+		mutable size_t residentBytes = 0;
+		mutable std::unique_ptr<std::mutex[]> loadMutexes;	// per chunk
+		mutable std::unique_ptr<std::atomic<bool>[]> bLoadFailed;	// per chunk
+		mutable std::atomic<size_t> loadNums = 0;
+		mutable std::atomic<size_t> evictionNums = 0;
+		mutable std::atomic<size_t> peakResidentBytes = 0;
+
+		// The chunk, loading it if needed; nullptr if it failed to load. With `bMayDefer` and
+		// deferral on, a missing chunk is skipped instead and nullptr returned.
+		shared_ptr<const LoadedChunk> Acquire(uint32_t chunkIdx, bool bMayDefer) const;
+		shared_ptr<const LoadedChunk> FindResident(uint32_t chunkIdx) const;
+		shared_ptr<const LoadedChunk> Load(uint32_t chunkIdx) const;
+		shared_ptr<const LoadedChunk> Read(uint32_t chunkIdx) const;
+	};
+}
\ No newline at end of file
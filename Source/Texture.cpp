@@ -19,23 +19,23 @@ namespace Pooraytracer {
 
 		stbi_image_free(rawData);
 	}
-	color ImageTexture::Value(double u, double v, const point3& p) const
+	color ImageTexture::Value(Real u, Real v, const point3& p) const
 	{
 		if (!data || data->empty()) return color(0., 1., 1.);
 
-		u = std::clamp(u, 0.0, 1.0);
-		v = std::clamp(v, 0.0, 1.0);
+		u = std::clamp(u, Real(0), Real(1));
+		v = std::clamp(v, Real(0), Real(1));
 
-		double x = u * (width - 1.);
-		double y = (1. - v) * (height - 1.);
+		Real x = u * (width - 1.);
+		Real y = (1. - v) * (height - 1.);
 
 		int x0 = static_cast<int>(x);
 		int y0 = static_cast<int>(y);
 		int x1 = std::min(x0 + 1, width - 1);
 		int y1 = std::min(y0 + 1, height - 1);
 
-		double tx = x - x0;
-		double ty = y - y0;
+		Real tx = x - x0;
+		Real ty = y - y0;
 
 		color c00 = GetPixel(x0, y0);
 		color c10 = GetPixel(x1, y0);
@@ -49,7 +49,7 @@ namespace Pooraytracer {
 	}
 	color ImageTexture::GetPixel(int x, int y) const
 	{
-		const double colorScale = 1.0 / 255.0;
+		const Real colorScale = 1.0 / 255.0;
 		int idx = (y * width + x) * channels;
 
 		if (channels >= 3) {
@@ -63,7 +63,7 @@ namespace Pooraytracer {
 			return color(colorScale * (*data)[idx]);
 		}
 	}
-	double ImageTexture::SRGBToLinear(double colorComponent) const
+	Real ImageTexture::SRGBToLinear(Real colorComponent) const
 	{
 		if (colorComponent <= 0.04045)
 			return colorComponent * (1. / 12.92);
@@ -2,27 +2,25 @@
 
 #include <string>
 #include <memory>
-#include <glm/vec3.hpp>
+#include "Real.h"
 
 namespace Pooraytracer {
 
-	using color = glm::dvec3;
-	using point3 = glm::dvec3;
-
 	class Texture {
 	public:
 		virtual ~Texture() = default;
 
-		virtual color Value(double u, double v, const point3& p) const = 0;
+		virtual color Value(Real u, Real v, const point3& p) const = 0;
 	};
 
 	class SolidColor : public Texture {
 	public:
 
 		SolidColor(const color& albedo) :albedo(albedo) {}
-		color Value(double u, double v, const point3& p) const override {
+		color Value(Real u, Real v, const point3& p) const override {
 			return albedo;
 		}
+		const color& GetColor() const { return albedo; }
 	private:
 		color albedo;
 	};
@@ -31,14 +29,35 @@ namespace Pooraytracer {
 
 	public:
 		ImageTexture(const std::string& imagePath);
-		color Value(double u, double v, const point3& p) const override;
+		color Value(Real u, Real v, const point3& p) const override;
 	private:
 		std::shared_ptr<std::vector<unsigned char>> data;
 		int width;
 		int height;
 		int channels;
 		color GetPixel(int x, int y) const;
-		double SRGBToLinear(double colorComponent) const;
+		Real SRGBToLinear(Real colorComponent) const;
+
+	};
 
+	// A material's color input. A constant color (or a SolidColor) is stored inline and read
+	// without a virtual call; any other texture is looked up through the Texture interface.
+	class TextureSlot {
+	public:
+		TextureSlot(const color& value) :value(value) {}
+		TextureSlot(std::shared_ptr<Texture> texture) {
+			if (const SolidColor* solid = dynamic_cast<const SolidColor*>(texture.get())) {
+				value = solid->GetColor();
+			}
+			else {
+				this->texture = std::move(texture);
+			}
+		}
+		color Value(Real u, Real v, const point3& p) const {
+			return texture ? texture->Value(u, v, p) : value;
+		}
+	private:
+		color value = color(0., 0., 0.);
+		std::shared_ptr<Texture> texture;	// null for a constant
 	};
 }
\ No newline at end of file
@@ -1,122 +1,146 @@
 #include "Triangle.h"
 #include "Material.h"
 #include "Ray.h"
+#include "TriangleBlock.h"
 #include <glm/geometric.hpp>
 #include <glm/gtx/norm.hpp>
+#include <cassert>
 
 namespace Pooraytracer {
 
 	using glm::normalize, glm::cross, glm::length, glm::dot;
 
-	Triangle::Triangle(const std::array<vec3, 3>& vertices, const std::array<vec3, 3>& normals, const std::array<vec2, 3>& texCoords, std::shared_ptr<Material> material) :
-		vertices(vertices), texCoords(texCoords), material(material)
+	std::array<vec3, 3> Triangle::Vertices() const
 	{
-		edges[0] = vertices[1] - vertices[0];
-		edges[1] = vertices[2] - vertices[0];
-
-		vec3 n = cross(edges[0], edges[1]);
-
-		normal = normalize(n);
+		return { mesh->Position(face, 0), mesh->Position(face, 1), mesh->Position(face, 2) };
+	}
+	std::array<vec2, 3> Triangle::TexCoords() const
+	{
+		const uint32_t* index = &mesh->indices[3 * face];
+		std::array<vec2, 3> texCoords = { mesh->texCoords[index[0]], mesh->texCoords[index[1]], mesh->texCoords[index[2]] };
+		// Coinciding texture coordinates leave the tangent undefined, such faces get a fixed parameterization.
+		if (texCoords[0] == texCoords[1] || texCoords[1] == texCoords[2] || texCoords[0] == texCoords[2])
+		{
+			texCoords = { vec2(0, 0), vec2(1, 0), vec2(1, 1) };
+		}
+		return texCoords;
+	}
+	vec3 Triangle::Normal() const
+	{
+		return Normal(Vertices());
+	}
+	vec3 Triangle::Normal(const std::array<vec3, 3>& vertices) const
+	{
+		vec3 normal = normalize(cross(vertices[1] - vertices[0], vertices[2] - vertices[0]));
 
 		if (glm::any(glm::isnan(normal)))
 		{
-			normal = normalize(normals[0] + normals[1] + normals[2]);
+			const uint32_t* index = &mesh->indices[3 * face];
+			normal = normalize(mesh->normals[index[0]] + mesh->normals[index[1]] + mesh->normals[index[2]]);
 			if (glm::any(glm::isnan(normal)))
 			{
-				LOGD("Triangle has an invalid normal.");
 				normal = vec3(0.0, 0.0, 1.0);
 			}
 		}
-
+		return normal;
+	}
+	vec3 Triangle::Tangent(const std::array<vec3, 3>& vertices, const std::array<vec2, 3>& texCoords, const vec3& normal) const
+	{
+		vec3 edge0 = vertices[1] - vertices[0];
+		vec3 edge1 = vertices[2] - vertices[0];
 		vec2 deltaUV0 = texCoords[1] - texCoords[0];
 		vec2 deltaUV1 = texCoords[2] - texCoords[0];
-		double f = 1.0 / (deltaUV0.x * deltaUV1.y - deltaUV1.x * deltaUV0.y);
-		tangent.x = f * (deltaUV1.y * edges[0].x - deltaUV0.y * edges[1].x);
-		tangent.y = f * (deltaUV1.y * edges[0].y - deltaUV0.y * edges[1].y);
-		tangent.z = f * (deltaUV1.y * edges[0].z - deltaUV0.y * edges[1].z);
+		Real f = 1.0 / (deltaUV0.x * deltaUV1.y - deltaUV1.x * deltaUV0.y);
+		vec3 tangent;
+		tangent.x = f * (deltaUV1.y * edge0.x - deltaUV0.y * edge1.x);
+		tangent.y = f * (deltaUV1.y * edge0.y - deltaUV0.y * edge1.y);
+		tangent.z = f * (deltaUV1.y * edge0.z - deltaUV0.y * edge1.z);
 		tangent = glm::normalize(tangent);
 
 		if (glm::any(glm::isnan(tangent)))
 		{
-			LOGD("Triangle has an invalid tangent.");
 			vec3 v = normal;
-			vec3 helper = (abs(v.x) < 0.9f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+			vec3 helper = (abs(v.x) < 0.9f) ? vec3(1, 0, 0) : vec3(0, 1, 0);
 			tangent = normalize(cross(v, helper));
 		}
-
-		area = length(n) * 0.5;
-
-		D = dot(normal, vertices[0]);
-		w = n / dot(n, n);
-		SetBoundingBox();
-
+		return tangent;
+	}
+	AABB Triangle::BoundingBox() const
+	{
+		const std::array<vec3, 3> vertices = Vertices();
+		AABB bboxEdge0 = AABB(vertices[0], vertices[1]);
+		AABB bboxEdge1 = AABB(vertices[0], vertices[2]);
+		return AABB(bboxEdge0, bboxEdge1);
+	}
+	Real Triangle::GetArea() const
+	{
+		const std::array<vec3, 3> vertices = Vertices();
+		return length(cross(vertices[1] - vertices[0], vertices[2] - vertices[0])) * 0.5;
 	}
 	bool Triangle::Hit(const Ray& ray, Interval domain, HitRecord& record) const
 	{
-		double denom = dot(normal, ray.direction);
-
-		// No hit if the ray is parallel to the plane.
-		if (std::fabs(denom) < 1e-8) {
+		const std::array<vec3, 3> vertices = Vertices();
+		Real t, alpha, beta;
+		if (!IntersectWatertight(ShearedRay(ray), vertices[0], vertices[1], vertices[2], domain.min, domain.max, t, alpha, beta)) {
 			return false;
 		}
-		// Return false if the hit point parameter t is outside the ray interval.
-		double t = (D - dot(normal, ray.origin)) / denom;
-		if (!domain.Contains(t)) {
-			return false;
-		}
-		// Determine if the hit point lies within the planar shape using its plane coordinates.
-		vec3 p = ray(t);
-		vec3 v0p = p - vertices[0];
-		double alpha = dot(w, cross(v0p, edges[1])); // barycentric of v1
-		double beta = dot(w, cross(edges[0], v0p));	// barycentric of v2
-		if (!IsInterior(alpha, beta, record)) {
-			return false;
-		}
-
-		record.position = p;
-		record.time = t;
-		record.material = material;
-		record.tangent = tangent;
-		record.SetFaceNormal(ray, normal);
-
+		RecordHit(t, alpha, beta, record);
 		return true;
 	}
-	void Triangle::Sample(const point3& origin, HitRecord& samplePointRecord, double& pdf) const
+	bool Triangle::Occluded(const Ray& ray, Interval domain) const
 	{
-		double x = std::sqrt(RandomDouble()), y = RandomDouble();
-		point3 p = vertices[0] * (1.0 - x) + vertices[1] * (x * (1.0 - y)) + vertices[2] * (x * y);
-		samplePointRecord.position = p;
-		vec3 direction = p - origin;
-		samplePointRecord.SetFaceNormal(Ray(origin, direction), normal);
-		samplePointRecord.material = material;
-		pdf = 1.0 / area;
+		const std::array<vec3, 3> vertices = Vertices();
+		Real t, alpha, beta;
+		return IntersectWatertight(ShearedRay(ray), vertices[0], vertices[1], vertices[2], domain.min, domain.max, t, alpha, beta);
 	}
-	void Triangle::SetBoundingBox()
+	void Triangle::SetHitRecord(const Ray& ray, HitRecord& record) const
 	{
-		AABB bboxEdge0 = AABB(vertices[0], vertices[1]);
-		AABB bboxEdge1 = AABB(vertices[0], vertices[2]);
-		bbox = AABB(bboxEdge0, bboxEdge1);
+		const std::array<vec3, 3> vertices = Vertices();
+		const std::array<vec2, 3> texCoords = TexCoords();
+		const vec3 normal = Normal(vertices);
+		Real alpha = record.alpha, beta = record.beta;
+		Real gamma = 1 - alpha - beta;
+		record.uv = gamma * texCoords[0] + alpha * texCoords[1] + beta * texCoords[2];
+		// Interpolated instead of ray(t): its error only depends on the vertices, not on the ray.
+		vec3 b0 = gamma * vertices[0], b1 = alpha * vertices[1], b2 = beta * vertices[2];
+		record.position = b0 + b1 + b2;
+		record.positionError = Gamma(7) * (glm::abs(b0) + glm::abs(b1) + glm::abs(b2));
+		record.material = mesh->material.get();
+		record.tangent = Tangent(vertices, texCoords, normal);
+		record.SetFaceNormal(ray, normal);
 	}
-	bool Triangle::IsInterior(double alpha, double beta, HitRecord& record) const
+	void Triangle::Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const
 	{
-		if (alpha != alpha || beta != beta)
-		{
-			LOGD("Triangle hit test produced NaN barycentrics.");
-			return false;
-		}
-
-		if ((alpha < 0) || (beta < 0) || (alpha + beta > 1))
-			return false;
-
-		record.uv = (1. - alpha - beta) * texCoords[0] + alpha * texCoords[1] + beta * texCoords[2];
-		return true;
+		const std::array<vec3, 3> vertices = Vertices();
+		// The position is the stratified part of a light sample; the choices above it must leave it two dimensions.
+		assert(ThreadSampleStream().HasDimensions(2));
+		vec2 u = Random2D();
+		Real x = std::sqrt(u.x), y = u.y;
+		vec3 b0 = vertices[0] * (1 - x), b1 = vertices[1] * (x * (1 - y)), b2 = vertices[2] * (x * y);
+		point3 p = b0 + b1 + b2;
+		samplePointRecord.position = p;
+		samplePointRecord.positionError = Gamma(6) * (glm::abs(b0) + glm::abs(b1) + glm::abs(b2));
+		vec3 direction = p - origin;
+		samplePointRecord.SetFaceNormal(Ray(origin, direction), Normal(vertices));
+		samplePointRecord.material = mesh->material.get();
+		pdf = 1.0 / GetArea();
 	}
-
-	Mesh::Mesh(const std::string& name, const std::vector<std::shared_ptr<Hittable>>& triangles, shared_ptr<Material> material) :name(name), material(material)
+	Mesh::Mesh(const std::string& name, std::vector<vec3> positions, std::vector<vec3> normals, std::vector<vec2> texCoords,
+		std::vector<uint32_t> indices, shared_ptr<Material> material) :
+		name(name), material(material), positions(std::move(positions)), normals(std::move(normals)),
+		texCoords(std::move(texCoords)), indices(std::move(indices))
 	{
-		for (const auto& primitive : triangles)
+		triangles.reserve(GetFaceNums());
+		objects.reserve(GetFaceNums());
+		for (uint32_t face = 0; face < GetFaceNums(); ++face)
 		{
-			Add(primitive);
+			// Aliasing an empty shared_ptr: the mesh owns the triangle.
+			Add(shared_ptr<Hittable>(shared_ptr<Hittable>(), &triangles.emplace_back(this, face)));
 		}
 	}
+	size_t Mesh::GetMemoryBytes() const
+	{
+		return sizeof(Mesh) + positions.capacity() * sizeof(vec3) + normals.capacity() * sizeof(vec3) + texCoords.capacity() * sizeof(vec2) +
+			indices.capacity() * sizeof(uint32_t) + triangles.capacity() * sizeof(Triangle) + objects.capacity() * sizeof(shared_ptr<Hittable>);
+	}
 }
\ No newline at end of file
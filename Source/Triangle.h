@@ -1,44 +1,78 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include "Hittable.h"
 #include "HittableList.h"
 
 namespace Pooraytracer {
 
-	class Triangle :public Hittable {
+	class Mesh;
+
+	// One face of a Mesh: a pointer to the mesh and the face's position in its index buffer.
+	// Vertices are read from the mesh's shared buffers; the normal, tangent, area and bounds are
+	// derived from them when needed, so a triangle costs 24 bytes and moves with its mesh.
+	class Triangle final :public Hittable {
 
 	public:
-		Triangle(const std::array<vec3, 3>& vertices, const std::array<vec3, 3>& normals, const std::array<vec2, 3>& texCoords, std::shared_ptr<Material> material);
+		Triangle(const Mesh* mesh, uint32_t face) :mesh(mesh), face(face) {}
 		bool Hit(const Ray& ray, Interval domain, HitRecord& record) const override;
-		AABB BoundingBox() const override { return bbox; }
-		double GetArea() const override { return area; }
-		void Sample(const point3& origin, HitRecord& samplePointRecord, double& pdf) const override;
+		bool Occluded(const Ray& ray, Interval domain) const override;
+		AABB BoundingBox() const override;
+		Real GetArea() const override;
+		void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const override;
+		void SetHitRecord(const Ray& ray, HitRecord& record) const override;
+		// Records a hit found by the watertight test, also for intersectors that test several
+		// triangles at once.
+		void RecordHit(Real t, Real alpha, Real beta, HitRecord& record) const {
+			record.time = t;
+			record.alpha = alpha;
+			record.beta = beta;
+			record.primitive = this;
+			record.instance = nullptr;
+		}
+
+		// Vertices v0, v1, v2, right-handed coordinate system
+		std::array<vec3, 3> Vertices() const;
+		std::array<vec2, 3> TexCoords() const;
+		vec3 Normal() const;
 
 	public:
-		std::array<vec3, 3> vertices; // vertices v0, v1, v2, right-handed coordinate system
-		std::array<vec3, 2> edges;	  // e0: v1-v0, e1: v2-v0 
-		std::array<vec2, 3> texCoords;// texture coords
-		vec3 normal;
-		vec3 tangent;
-		double area;
-		AABB bbox;
-		std::shared_ptr<Material> material; // [TODO]
+		const Mesh* mesh;
+		uint32_t face;
 
 	private:
-		double D;
-		vec3 w;
-		void SetBoundingBox();
-		bool IsInterior(double alpha, double beta, HitRecord& record) const;
+		vec3 Normal(const std::array<vec3, 3>& vertices) const;
+		vec3 Tangent(const std::array<vec3, 3>& vertices, const std::array<vec2, 3>& texCoords, const vec3& normal) const;
 	};
 
+	// Indexed triangle mesh: vertex attributes are stored once and shared by every face using
+	// them, faces are index triples. The triangles are stored contiguously in `triangles`, and
+	// `objects` refers to them with non-owning pointers (no control blocks, no reference counts).
+	// Triangles point back into the mesh, so a mesh is neither copied nor moved and must outlive
+	// the structures built over its triangles. Moving vertices is done through `positions`; the
+	// structures containing the mesh then need a Refit().
 	class Mesh : public HittableList {
 	public:
 		Mesh() = default;
-		Mesh(const std::string& name, const std::vector<std::shared_ptr<Hittable>>& triangles, shared_ptr<Material> material);
+		Mesh(const std::string& name, std::vector<vec3> positions, std::vector<vec3> normals, std::vector<vec2> texCoords,
+			std::vector<uint32_t> indices, shared_ptr<Material> material);
+		Mesh(const Mesh&) = delete;
+		Mesh& operator=(const Mesh&) = delete;
+
+		size_t GetFaceNums() const { return indices.size() / 3; }
+		const vec3& Position(uint32_t face, int corner) const { return positions[indices[3 * face + corner]]; }
+		size_t GetMemoryBytes() const;
+
 	public:
 		std::string name;
 		std::shared_ptr<Material> material;
+		std::vector<vec3> positions;
+		std::vector<vec3> normals;		// per vertex; a face with a degenerate geometric normal falls back to their sum
+		std::vector<vec2> texCoords;
+		std::vector<uint32_t> indices;	// three per face, into all three vertex buffers
+		std::vector<Triangle> triangles;	// one per face, referenced by `objects`
 	};
 }
\ No newline at end of file
@@ -0,0 +1,223 @@
+#include "TriangleBlock.h"
+#include "Triangle.h"
+
+namespace Pooraytracer {
+
+	void PackTriangleBlock(TriangleBlock& block, const Triangle* const* triangles, int triangleNums, uint32_t primitivesOffset)
+	{
+		block.primitivesOffset = primitivesOffset;
+		block.triangleNums = static_cast<uint8_t>(triangleNums);
+		for (int lane = 0; lane < TriangleBlock::width; ++lane) {
+			for (int vertex = 0; vertex < 3; ++vertex) {
+				// Unused lanes hold a degenerate triangle, which no ray hits (det == 0).
+				const vec3 position = lane < triangleNums ? triangles[lane]->mesh->Position(triangles[lane]->face, vertex) : vec3(0);
+				for (int axis = 0; axis < 3; ++axis) {
+					block.vertices[vertex][axis][lane] = position[axis];
+				}
+			}
+		}
+	}
+
+	// The vector tests repeat IntersectWatertight operation by operation (no FMA contraction,
+	// NaN handled through the same ordered comparisons), so every variant returns the same hits.
+
+	static uint32_t TriangleBlockTestScalar(const TriangleBlock& block, const ShearedRay& ray, Real tMin, Real tMax,
+		Real* t, Real* alpha, Real* beta)
+	{
+		uint32_t hitMask = 0;
+		for (int lane = 0; lane < block.triangleNums; ++lane) {
+			vec3 v[3];
+			for (int vertex = 0; vertex < 3; ++vertex) {
+				v[vertex] = vec3(block.vertices[vertex][0][lane], block.vertices[vertex][1][lane], block.vertices[vertex][2][lane]);
+			}
+			if (IntersectWatertight(ray, v[0], v[1], v[2], tMin, tMax, t[lane], alpha[lane], beta[lane])) {
+				hitMask |= 1u << lane;
+			}
+		}
+		return hitMask;
+	}
+
+	// Double lanes: SSE2 tests two triangles per instruction, AVX2 the whole block.
+#if defined(POORAYTRACER_X86) && !defined(POORAYTRACER_FLOAT_PRECISION)
+	POORAYTRACER_TARGET_SSE2
+	static uint32_t TriangleBlockTestSSE2(const TriangleBlock& block, const ShearedRay& ray, Real tMin, Real tMax,
+		Real* t, Real* alpha, Real* beta)
+	{
+		const __m128d originX = _mm_set1_pd(ray.origin[ray.kx]);
+		const __m128d originY = _mm_set1_pd(ray.origin[ray.ky]);
+		const __m128d originZ = _mm_set1_pd(ray.origin[ray.kz]);
+		const __m128d shearX = _mm_set1_pd(ray.shearX);
+		const __m128d shearY = _mm_set1_pd(ray.shearY);
+		const __m128d shearZ = _mm_set1_pd(ray.shearZ);
+		const __m128d zero = _mm_setzero_pd();
+		const __m128d signMask = _mm_set1_pd(-0.0);
+		auto absMax = [&](const __m128d* c) POORAYTRACER_TARGET_SSE2 {
+			return _mm_max_pd(_mm_max_pd(_mm_andnot_pd(signMask, c[0]), _mm_andnot_pd(signMask, c[1])), _mm_andnot_pd(signMask, c[2]));
+			};
+		uint32_t hitMask = 0;
+		for (int base = 0; base < TriangleBlock::width; base += 2) {
+			__m128d x[3], y[3], z[3];
+			for (int vertex = 0; vertex < 3; ++vertex) {
+				__m128d dx = _mm_sub_pd(_mm_load_pd(&block.vertices[vertex][ray.kx][base]), originX);
+				__m128d dy = _mm_sub_pd(_mm_load_pd(&block.vertices[vertex][ray.ky][base]), originY);
+				__m128d dz = _mm_sub_pd(_mm_load_pd(&block.vertices[vertex][ray.kz][base]), originZ);
+				x[vertex] = _mm_sub_pd(dx, _mm_mul_pd(shearX, dz));
+				y[vertex] = _mm_sub_pd(dy, _mm_mul_pd(shearY, dz));
+				z[vertex] = _mm_mul_pd(shearZ, dz);
+			}
+			__m128d u = _mm_sub_pd(_mm_mul_pd(x[2], y[1]), _mm_mul_pd(y[2], x[1]));
+			__m128d v = _mm_sub_pd(_mm_mul_pd(x[0], y[2]), _mm_mul_pd(y[0], x[2]));
+			__m128d w = _mm_sub_pd(_mm_mul_pd(x[1], y[0]), _mm_mul_pd(y[1], x[0]));
+			__m128d negative = _mm_or_pd(_mm_or_pd(_mm_cmplt_pd(u, zero), _mm_cmplt_pd(v, zero)), _mm_cmplt_pd(w, zero));
+			__m128d positive = _mm_or_pd(_mm_or_pd(_mm_cmpgt_pd(u, zero), _mm_cmpgt_pd(v, zero)), _mm_cmpgt_pd(w, zero));
+			__m128d det = _mm_add_pd(_mm_add_pd(u, v), w);
+			__m128d scaledT = _mm_add_pd(_mm_add_pd(_mm_mul_pd(u, z[0]), _mm_mul_pd(v, z[1])), _mm_mul_pd(w, z[2]));
+			__m128d tHit = _mm_div_pd(scaledT, det);
+			__m128d inRange = _mm_and_pd(_mm_cmpge_pd(tHit, _mm_set1_pd(tMin)), _mm_cmple_pd(tHit, _mm_set1_pd(tMax)));
+			__m128d maxX = absMax(x), maxY = absMax(y), maxZ = absMax(z);
+			__m128d uvw[3] = { u, v, w };
+			__m128d maxE = absMax(uvw);
+			__m128d deltaX = _mm_mul_pd(_mm_set1_pd(Gamma(5)), _mm_add_pd(maxX, maxZ));
+			__m128d deltaY = _mm_mul_pd(_mm_set1_pd(Gamma(5)), _mm_add_pd(maxY, maxZ));
+			__m128d deltaZ = _mm_mul_pd(_mm_set1_pd(Gamma(3)), maxZ);
+			__m128d deltaE = _mm_mul_pd(_mm_set1_pd(2.0), _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_mul_pd(_mm_set1_pd(Gamma(2)), maxX), maxY),
+				_mm_mul_pd(deltaY, maxX)), _mm_mul_pd(deltaX, maxY)));
+			__m128d deltaT = _mm_div_pd(_mm_mul_pd(_mm_set1_pd(3.0), _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_mul_pd(_mm_set1_pd(Gamma(3)), maxE), maxZ),
+				_mm_mul_pd(deltaE, maxZ)), _mm_mul_pd(deltaZ, maxE))), _mm_andnot_pd(signMask, det));
+			inRange = _mm_and_pd(inRange, _mm_cmpgt_pd(tHit, deltaT));
+			__m128d hit = _mm_andnot_pd(_mm_and_pd(negative, positive), _mm_and_pd(_mm_cmpneq_pd(det, zero), inRange));
+			hitMask |= static_cast<uint32_t>(_mm_movemask_pd(hit)) << base;
+			_mm_storeu_pd(t + base, tHit);
+			_mm_storeu_pd(alpha + base, _mm_div_pd(v, det));
+			_mm_storeu_pd(beta + base, _mm_div_pd(w, det));
+		}
+		return hitMask & ((1u << block.triangleNums) - 1);
+	}
+
+	POORAYTRACER_TARGET_AVX2
+	static uint32_t TriangleBlockTestAVX2(const TriangleBlock& block, const ShearedRay& ray, Real tMin, Real tMax,
+		Real* t, Real* alpha, Real* beta)
+	{
+		const __m256d originX = _mm256_set1_pd(ray.origin[ray.kx]);
+		const __m256d originY = _mm256_set1_pd(ray.origin[ray.ky]);
+		const __m256d originZ = _mm256_set1_pd(ray.origin[ray.kz]);
+		const __m256d shearX = _mm256_set1_pd(ray.shearX);
+		const __m256d shearY = _mm256_set1_pd(ray.shearY);
+		const __m256d shearZ = _mm256_set1_pd(ray.shearZ);
+		const __m256d zero = _mm256_setzero_pd();
+		__m256d x[3], y[3], z[3];
+		for (int vertex = 0; vertex < 3; ++vertex) {
+			__m256d dx = _mm256_sub_pd(_mm256_load_pd(block.vertices[vertex][ray.kx]), originX);
+			__m256d dy = _mm256_sub_pd(_mm256_load_pd(block.vertices[vertex][ray.ky]), originY);
+			__m256d dz = _mm256_sub_pd(_mm256_load_pd(block.vertices[vertex][ray.kz]), originZ);
+			x[vertex] = _mm256_sub_pd(dx, _mm256_mul_pd(shearX, dz));
+			y[vertex] = _mm256_sub_pd(dy, _mm256_mul_pd(shearY, dz));
+			z[vertex] = _mm256_mul_pd(shearZ, dz);
+		}
+		__m256d u = _mm256_sub_pd(_mm256_mul_pd(x[2], y[1]), _mm256_mul_pd(y[2], x[1]));
+		__m256d v = _mm256_sub_pd(_mm256_mul_pd(x[0], y[2]), _mm256_mul_pd(y[0], x[2]));
+		__m256d w = _mm256_sub_pd(_mm256_mul_pd(x[1], y[0]), _mm256_mul_pd(y[1], x[0]));
+		__m256d negative = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(u, zero, _CMP_LT_OQ), _mm256_cmp_pd(v, zero, _CMP_LT_OQ)),
+			_mm256_cmp_pd(w, zero, _CMP_LT_OQ));
+		__m256d positive = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(u, zero, _CMP_GT_OQ), _mm256_cmp_pd(v, zero, _CMP_GT_OQ)),
+			_mm256_cmp_pd(w, zero, _CMP_GT_OQ));
+		__m256d det = _mm256_add_pd(_mm256_add_pd(u, v), w);
+		__m256d scaledT = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(u, z[0]), _mm256_mul_pd(v, z[1])), _mm256_mul_pd(w, z[2]));
+		__m256d tHit = _mm256_div_pd(scaledT, det);
+		__m256d inRange = _mm256_and_pd(_mm256_cmp_pd(tHit, _mm256_set1_pd(tMin), _CMP_GE_OQ),
+			_mm256_cmp_pd(tHit, _mm256_set1_pd(tMax), _CMP_LE_OQ));
+		const __m256d signMask = _mm256_set1_pd(-0.0);
+		auto absMax = [&](__m256d a, __m256d b, __m256d c) POORAYTRACER_TARGET_AVX2 {
+			return _mm256_max_pd(_mm256_max_pd(_mm256_andnot_pd(signMask, a), _mm256_andnot_pd(signMask, b)), _mm256_andnot_pd(signMask, c));
+			};
+		__m256d maxX = absMax(x[0], x[1], x[2]), maxY = absMax(y[0], y[1], y[2]), maxZ = absMax(z[0], z[1], z[2]);
+		__m256d maxE = absMax(u, v, w);
+		__m256d deltaX = _mm256_mul_pd(_mm256_set1_pd(Gamma(5)), _mm256_add_pd(maxX, maxZ));
+		__m256d deltaY = _mm256_mul_pd(_mm256_set1_pd(Gamma(5)), _mm256_add_pd(maxY, maxZ));
+		__m256d deltaZ = _mm256_mul_pd(_mm256_set1_pd(Gamma(3)), maxZ);
+		__m256d deltaE = _mm256_mul_pd(_mm256_set1_pd(2.0), _mm256_add_pd(_mm256_add_pd(
+			_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(Gamma(2)), maxX), maxY), _mm256_mul_pd(deltaY, maxX)), _mm256_mul_pd(deltaX, maxY)));
+		__m256d deltaT = _mm256_div_pd(_mm256_mul_pd(_mm256_set1_pd(3.0), _mm256_add_pd(_mm256_add_pd(
+			_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(Gamma(3)), maxE), maxZ), _mm256_mul_pd(deltaE, maxZ)), _mm256_mul_pd(deltaZ, maxE))),
+			_mm256_andnot_pd(signMask, det));
+		inRange = _mm256_and_pd(inRange, _mm256_cmp_pd(tHit, deltaT, _CMP_GT_OQ));
+		// det != 0 is unordered-or-not-equal, like the scalar `det == 0.0` rejection.
+		__m256d hit = _mm256_andnot_pd(_mm256_and_pd(negative, positive),
+			_mm256_and_pd(_mm256_cmp_pd(det, zero, _CMP_NEQ_UQ), inRange));
+		_mm256_storeu_pd(t, tHit);
+		_mm256_storeu_pd(alpha, _mm256_div_pd(v, det));
+		_mm256_storeu_pd(beta, _mm256_div_pd(w, det));
+		return static_cast<uint32_t>(_mm256_movemask_pd(hit)) & ((1u << block.triangleNums) - 1);
+	}
+#elif defined(POORAYTRACER_X86)
+	// Float lanes: one SSE register holds the whole block, so this single kernel serves AVX2 as well.
+	POORAYTRACER_TARGET_SSE2
+	static uint32_t TriangleBlockTestSSE2(const TriangleBlock& block, const ShearedRay& ray, Real tMin, Real tMax,
+		Real* t, Real* alpha, Real* beta)
+	{
+		static_assert(TriangleBlock::width == 4, "a float block fills one SSE register");
+		const __m128 originX = _mm_set1_ps(ray.origin[ray.kx]);
+		const __m128 originY = _mm_set1_ps(ray.origin[ray.ky]);
+		const __m128 originZ = _mm_set1_ps(ray.origin[ray.kz]);
+		const __m128 shearX = _mm_set1_ps(ray.shearX);
+		const __m128 shearY = _mm_set1_ps(ray.shearY);
+		const __m128 shearZ = _mm_set1_ps(ray.shearZ);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 x[3], y[3], z[3];
+		for (int vertex = 0; vertex < 3; ++vertex) {
+			__m128 dx = _mm_sub_ps(_mm_load_ps(block.vertices[vertex][ray.kx]), originX);
+			__m128 dy = _mm_sub_ps(_mm_load_ps(block.vertices[vertex][ray.ky]), originY);
+			__m128 dz = _mm_sub_ps(_mm_load_ps(block.vertices[vertex][ray.kz]), originZ);
+			x[vertex] = _mm_sub_ps(dx, _mm_mul_ps(shearX, dz));
+			y[vertex] = _mm_sub_ps(dy, _mm_mul_ps(shearY, dz));
+			z[vertex] = _mm_mul_ps(shearZ, dz);
+		}
+		__m128 u = _mm_sub_ps(_mm_mul_ps(x[2], y[1]), _mm_mul_ps(y[2], x[1]));
+		__m128 v = _mm_sub_ps(_mm_mul_ps(x[0], y[2]), _mm_mul_ps(y[0], x[2]));
+		__m128 w = _mm_sub_ps(_mm_mul_ps(x[1], y[0]), _mm_mul_ps(y[1], x[0]));
+		// Edge functions of zero are recomputed in double by IntersectWatertight; rare enough to
+		// leave the whole block to the scalar test.
+		__m128 zeroEdge = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(u, zero), _mm_cmpeq_ps(v, zero)), _mm_cmpeq_ps(w, zero));
+		if (_mm_movemask_ps(zeroEdge) & ((1 << block.triangleNums) - 1)) {
+			return TriangleBlockTestScalar(block, ray, tMin, tMax, t, alpha, beta);
+		}
+		__m128 negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmplt_ps(v, zero)), _mm_cmplt_ps(w, zero));
+		__m128 positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(u, zero), _mm_cmpgt_ps(v, zero)), _mm_cmpgt_ps(w, zero));
+		__m128 det = _mm_add_ps(_mm_add_ps(u, v), w);
+		__m128 scaledT = _mm_add_ps(_mm_add_ps(_mm_mul_ps(u, z[0]), _mm_mul_ps(v, z[1])), _mm_mul_ps(w, z[2]));
+		__m128 tHit = _mm_div_ps(scaledT, det);
+		__m128 inRange = _mm_and_ps(_mm_cmpge_ps(tHit, _mm_set1_ps(tMin)), _mm_cmple_ps(tHit, _mm_set1_ps(tMax)));
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		auto absMax = [&](__m128 a, __m128 b, __m128 c) POORAYTRACER_TARGET_SSE2 {
+			return _mm_max_ps(_mm_max_ps(_mm_andnot_ps(signMask, a), _mm_andnot_ps(signMask, b)), _mm_andnot_ps(signMask, c));
+			};
+		__m128 maxX = absMax(x[0], x[1], x[2]), maxY = absMax(y[0], y[1], y[2]), maxZ = absMax(z[0], z[1], z[2]);
+		__m128 maxE = absMax(u, v, w);
+		__m128 deltaX = _mm_mul_ps(_mm_set1_ps(Gamma(5)), _mm_add_ps(maxX, maxZ));
+		__m128 deltaY = _mm_mul_ps(_mm_set1_ps(Gamma(5)), _mm_add_ps(maxY, maxZ));
+		__m128 deltaZ = _mm_mul_ps(_mm_set1_ps(Gamma(3)), maxZ);
+		__m128 deltaE = _mm_mul_ps(_mm_set1_ps(2.0f), _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(Gamma(2)), maxX), maxY),
+			_mm_mul_ps(deltaY, maxX)), _mm_mul_ps(deltaX, maxY)));
+		__m128 deltaT = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(Gamma(3)), maxE), maxZ),
+			_mm_mul_ps(deltaE, maxZ)), _mm_mul_ps(deltaZ, maxE))), _mm_andnot_ps(signMask, det));
+		inRange = _mm_and_ps(inRange, _mm_cmpgt_ps(tHit, deltaT));
+		// det != 0 is unordered-or-not-equal, like the scalar `det == 0.0` rejection.
+		__m128 hit = _mm_andnot_ps(_mm_and_ps(negative, positive), _mm_and_ps(_mm_cmpneq_ps(det, zero), inRange));
+		_mm_storeu_ps(t, tHit);
+		_mm_storeu_ps(alpha, _mm_div_ps(v, det));
+		_mm_storeu_ps(beta, _mm_div_ps(w, det));
+		return static_cast<uint32_t>(_mm_movemask_ps(hit)) & ((1u << block.triangleNums) - 1);
+	}
+#endif
+
+	TriangleBlockTestFunc SelectTriangleBlockTest(SIMDLevel level)
+	{
+#if defined(POORAYTRACER_X86) && !defined(POORAYTRACER_FLOAT_PRECISION)
+		if (level == SIMDLevel::AVX2) return TriangleBlockTestAVX2;
+		if (level == SIMDLevel::SSE2) return TriangleBlockTestSSE2;
+#elif defined(POORAYTRACER_X86)
+		if (level != SIMDLevel::Scalar) return TriangleBlockTestSSE2;
+#endif
+		return TriangleBlockTestScalar;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+#include "Ray.h"
+#include "SIMD.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace Pooraytracer {
+
+	class Triangle;
+
+	// Watertight ray/triangle test (Woop et al. 2013) on vertices in world space. Writes the hit
+	// distance and the barycentrics of v1 and v2; the single definition every intersector shares,
+	// so the SIMD block tests below agree bit for bit with Triangle::Hit.
+	inline bool IntersectWatertight(const ShearedRay& ray, const vec3& v0, const vec3& v1, const vec3& v2,
+		Real tMin, Real tMax, Real& t, Real& alpha, Real& beta)
+	{
+		// Vertices relative to the ray origin, sheared so that the ray runs along +z.
+		const vec3 a = v0 - ray.origin, b = v1 - ray.origin, c = v2 - ray.origin;
+		const Real ax = a[ray.kx] - ray.shearX * a[ray.kz], ay = a[ray.ky] - ray.shearY * a[ray.kz];
+		const Real bx = b[ray.kx] - ray.shearX * b[ray.kz], by = b[ray.ky] - ray.shearY * b[ray.kz];
+		const Real cx = c[ray.kx] - ray.shearX * c[ray.kz], cy = c[ray.ky] - ray.shearY * c[ray.kz];
+
+		// Scaled barycentrics: 2D edge functions, all of one sign inside the triangle.
+		Real u = cx * by - cy * bx;
+		Real v = ax * cy - ay * cx;
+		Real w = bx * ay - by * ax;
+#ifdef POORAYTRACER_FLOAT_PRECISION
+		// A zero may be a rounded tiny value of either sign. In double the products of floats are
+		// exact and the difference is rounded once, which keeps its sign (as pbrt does).
+		if (u == 0.0 || v == 0.0 || w == 0.0) {
+			u = static_cast<Real>(double(cx) * double(by) - double(cy) * double(bx));
+			v = static_cast<Real>(double(ax) * double(cy) - double(ay) * double(cx));
+			w = static_cast<Real>(double(bx) * double(ay) - double(by) * double(ax));
+		}
+#endif
+		if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0)) {
+			return false;
+		}
+		const Real det = u + v + w;
+		if (det == 0.0) {
+			return false;
+		}
+		const Real az = ray.shearZ * a[ray.kz], bz = ray.shearZ * b[ray.kz], cz = ray.shearZ * c[ray.kz];
+		const Real scaledT = u * az + v * bz + w * cz;
+		t = scaledT / det;
+		if (!(tMin <= t && t <= tMax)) {
+			return false;
+		}
+		// Reject t within its own rounding error of zero (pbrt's conservative bound): together with
+		// the offset origins of HitRecord::SpawnRay, a ray never finds the surface it leaves.
+		const Real maxX = std::max(std::max(std::fabs(ax), std::fabs(bx)), std::fabs(cx));
+		const Real maxY = std::max(std::max(std::fabs(ay), std::fabs(by)), std::fabs(cy));
+		const Real maxZ = std::max(std::max(std::fabs(az), std::fabs(bz)), std::fabs(cz));
+		const Real maxE = std::max(std::max(std::fabs(u), std::fabs(v)), std::fabs(w));
+		const Real deltaX = Gamma(5) * (maxX + maxZ), deltaY = Gamma(5) * (maxY + maxZ), deltaZ = Gamma(3) * maxZ;
+		const Real deltaE = 2 * (Gamma(2) * maxX * maxY + deltaY * maxX + deltaX * maxY);
+		const Real deltaT = 3 * (Gamma(3) * maxE * maxZ + deltaE * maxZ + deltaZ * maxE) / std::fabs(det);
+		if (t <= deltaT) {
+			return false;
+		}
+		alpha = v / det;
+		beta = w / det;
+		return true;
+	}
+
+	// Up to four triangles of one leaf in structure-of-arrays layout, vertices[vertex][axis][lane],
+	// so that one watertight test covers all of them (double: AVX2 4 per instruction, SSE2 2;
+	// float: 4 on either).
+	// Only the geometry is packed; shading data is fetched from the winning Triangle afterwards.
+	struct alignas(64) TriangleBlock {
+		static constexpr int width = 4;
+		Real vertices[3][3][width];
+		uint32_t primitivesOffset;	// lane i is primitive primitivesOffset + i of the owning BVH
+		uint8_t triangleNums;
+	};
+
+	void PackTriangleBlock(TriangleBlock& block, const Triangle* const* triangles, int triangleNums, uint32_t primitivesOffset);
+
+	// Returns a bit mask of the lanes hit within [tMin, tMax] and writes their distances and barycentrics.
+	using TriangleBlockTestFunc = uint32_t(*)(const TriangleBlock& block, const ShearedRay& ray, Real tMin, Real tMax,
+		Real* t, Real* alpha, Real* beta);
+	TriangleBlockTestFunc SelectTriangleBlockTest(SIMDLevel level);
+}
\ No newline at end of file
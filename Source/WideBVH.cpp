@@ -0,0 +1,953 @@
+#include "WideBVH.h"
+#include "Logger.h"
+#include "Ray.h"
+#include "RandomNumberGenerator.h"
+#include "Triangle.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+namespace Pooraytracer {
+
+	// All three slab tests follow AABB::Hit operation by operation (including its NaN behaviour,
+	// through ordered comparisons), so they agree bit for bit with the scalar box test.
+	// Both node formats share them through the bound loaders. Quantized bounds are decoded with the
+	// same double expression (DecodeMin/DecodeMax) in every variant, so all see the same boxes; the
+	// decode itself rounds, which Quantize() allows for by checking the decoded planes.
+
+	template <int N>
+	static Real ChildMin(const WideBVHNode<N>& node, int axis, int child) { return node.boundsMin[axis][child]; }
+	template <int N>
+	static Real ChildMax(const WideBVHNode<N>& node, int axis, int child) { return node.boundsMax[axis][child]; }
+	template <int N>
+	static double ChildMin(const QuantizedWideBVHNode<N>& node, int axis, int child) { return node.DecodeMin(axis, child); }
+	template <int N>
+	static double ChildMax(const QuantizedWideBVHNode<N>& node, int axis, int child) { return node.DecodeMax(axis, child); }
+
+	template <int N, template <int> class Node>
+	static uint32_t SlabTestScalar(const Node<N>& node, const RayQuery& query, Real tMin, Real tMax, Real* tNear)
+	{
+		uint32_t hitMask = 0;
+		for (int child = 0; child < node.childNums; ++child) {
+			Real intervalMin = tMin, intervalMax = tMax;
+			for (int axis = 0; axis < 3; ++axis) {
+				Real t0 = (ChildMin(node, axis, child) - query.origin[axis]) * query.invDirection[axis];
+				Real t1 = (ChildMax(node, axis, child) - query.origin[axis]) * query.invDirection[axis];
+				if (t0 < t1) {
+					if (t0 > intervalMin) intervalMin = t0;
+					if (t1 < intervalMax) intervalMax = t1;
+				}
+				else {
+					if (t1 > intervalMin) intervalMin = t1;
+					if (t0 < intervalMax) intervalMax = t0;
+				}
+			}
+			if (!(intervalMax <= intervalMin)) {
+				hitMask |= 1u << child;
+				tNear[child] = intervalMin;
+			}
+		}
+		return hitMask;
+	}
+
+	// Double lanes: SSE2 tests two children per instruction, AVX2 four.
+#if defined(POORAYTRACER_X86) && !defined(POORAYTRACER_FLOAT_PRECISION)
+	template <int N>
+	POORAYTRACER_TARGET_SSE2
+	static void LoadBoundsSSE2(const WideBVHNode<N>& node, int axis, int base, __m128d& boundsMin, __m128d& boundsMax)
+	{
+		boundsMin = _mm_load_pd(&node.boundsMin[axis][base]);
+		boundsMax = _mm_load_pd(&node.boundsMax[axis][base]);
+	}
+
+	template <int N>
+	POORAYTRACER_TARGET_SSE2
+	static void LoadBoundsSSE2(const QuantizedWideBVHNode<N>& node, int axis, int base, __m128d& boundsMin, __m128d& boundsMax)
+	{
+		// Two bytes widened to two doubles; SSE2 has no direct u8 -> i32 extension.
+		auto decode = [&](const uint8_t* q) POORAYTRACER_TARGET_SSE2 {
+			__m128i zero = _mm_setzero_si128();
+			__m128i bytes = _mm_cvtsi32_si128(q[0] | (q[1] << 8));
+			__m128i ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+			return _mm_add_pd(_mm_set1_pd(node.origin[axis]), _mm_mul_pd(_mm_cvtepi32_pd(ints), _mm_set1_pd(node.Scale(axis))));
+			};
+		boundsMin = decode(&node.childMin[axis][base]);
+		boundsMax = decode(&node.childMax[axis][base]);
+	}
+
+	template <int N, template <int> class Node>
+	POORAYTRACER_TARGET_SSE2
+	static uint32_t SlabTestSSE2(const Node<N>& node, const RayQuery& query, Real tMin, Real tMax, Real* tNear)
+	{
+		// SSE2 has no blendv: select(a, b, mask) = (mask & b) | (~mask & a).
+		auto select = [](__m128d a, __m128d b, __m128d mask) POORAYTRACER_TARGET_SSE2 {
+			return _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, a));
+			};
+		uint32_t hitMask = 0;
+		for (int base = 0; base < N; base += 2) {
+			__m128d lo = _mm_set1_pd(tMin);
+			__m128d hi = _mm_set1_pd(tMax);
+			for (int axis = 0; axis < 3; ++axis) {
+				__m128d origin = _mm_set1_pd(query.origin[axis]);
+				__m128d invDirection = _mm_set1_pd(query.invDirection[axis]);
+				__m128d boundsMin, boundsMax;
+				LoadBoundsSSE2(node, axis, base, boundsMin, boundsMax);
+				__m128d t0 = _mm_mul_pd(_mm_sub_pd(boundsMin, origin), invDirection);
+				__m128d t1 = _mm_mul_pd(_mm_sub_pd(boundsMax, origin), invDirection);
+				__m128d ordered = _mm_cmplt_pd(t0, t1);
+				__m128d tEnter = select(t1, t0, ordered);
+				__m128d tExit = select(t0, t1, ordered);
+				lo = select(lo, tEnter, _mm_cmpgt_pd(tEnter, lo));
+				hi = select(hi, tExit, _mm_cmplt_pd(tExit, hi));
+			}
+			int miss = _mm_movemask_pd(_mm_cmple_pd(hi, lo));
+			hitMask |= static_cast<uint32_t>(~miss & 0x3) << base;
+			_mm_storeu_pd(tNear + base, lo);
+		}
+		return hitMask & ((1u << node.childNums) - 1);
+	}
+
+	template <int N>
+	POORAYTRACER_TARGET_AVX2
+	static void LoadBoundsAVX2(const WideBVHNode<N>& node, int axis, int base, __m256d& boundsMin, __m256d& boundsMax)
+	{
+		boundsMin = _mm256_load_pd(&node.boundsMin[axis][base]);
+		boundsMax = _mm256_load_pd(&node.boundsMax[axis][base]);
+	}
+
+	template <int N>
+	POORAYTRACER_TARGET_AVX2
+	static void LoadBoundsAVX2(const QuantizedWideBVHNode<N>& node, int axis, int base, __m256d& boundsMin, __m256d& boundsMax)
+	{
+		auto decode = [&](const uint8_t* q) POORAYTRACER_TARGET_AVX2 {
+			int32_t bytes;
+			std::memcpy(&bytes, q, sizeof(bytes));
+			__m256d values = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+			return _mm256_add_pd(_mm256_set1_pd(node.origin[axis]), _mm256_mul_pd(values, _mm256_set1_pd(node.Scale(axis))));
+			};
+		boundsMin = decode(&node.childMin[axis][base]);
+		boundsMax = decode(&node.childMax[axis][base]);
+	}
+
+	template <int N, template <int> class Node>
+	POORAYTRACER_TARGET_AVX2
+	static uint32_t SlabTestAVX2(const Node<N>& node, const RayQuery& query, Real tMin, Real tMax, Real* tNear)
+	{
+		uint32_t hitMask = 0;
+		for (int base = 0; base < N; base += 4) {
+			__m256d lo = _mm256_set1_pd(tMin);
+			__m256d hi = _mm256_set1_pd(tMax);
+			for (int axis = 0; axis < 3; ++axis) {
+				__m256d origin = _mm256_set1_pd(query.origin[axis]);
+				__m256d invDirection = _mm256_set1_pd(query.invDirection[axis]);
+				__m256d boundsMin, boundsMax;
+				LoadBoundsAVX2(node, axis, base, boundsMin, boundsMax);
+				__m256d t0 = _mm256_mul_pd(_mm256_sub_pd(boundsMin, origin), invDirection);
+				__m256d t1 = _mm256_mul_pd(_mm256_sub_pd(boundsMax, origin), invDirection);
+				__m256d ordered = _mm256_cmp_pd(t0, t1, _CMP_LT_OQ);
+				__m256d tEnter = _mm256_blendv_pd(t1, t0, ordered);
+				__m256d tExit = _mm256_blendv_pd(t0, t1, ordered);
+				lo = _mm256_blendv_pd(lo, tEnter, _mm256_cmp_pd(tEnter, lo, _CMP_GT_OQ));
+				hi = _mm256_blendv_pd(hi, tExit, _mm256_cmp_pd(tExit, hi, _CMP_LT_OQ));
+			}
+			int miss = _mm256_movemask_pd(_mm256_cmp_pd(hi, lo, _CMP_LE_OQ));
+			hitMask |= static_cast<uint32_t>(~miss & 0xF) << base;
+			_mm256_storeu_pd(tNear + base, lo);
+		}
+		return hitMask & ((1u << node.childNums) - 1);
+	}
+#elif defined(POORAYTRACER_X86)
+	// Float lanes: SSE2 tests four children per instruction, AVX2 eight. The loaders return the
+	// slab distances themselves: quantized bounds decode in double, like ChildMin / ChildMax, and
+	// the distances are rounded to float only once, as the scalar test does by storing them in Real.
+	template <int N>
+	POORAYTRACER_TARGET_SSE2
+	static void SlabDistancesSSE2(const WideBVHNode<N>& node, const RayQuery& query, int axis, int base, __m128& t0, __m128& t1)
+	{
+		__m128 origin = _mm_set1_ps(query.origin[axis]);
+		__m128 invDirection = _mm_set1_ps(query.invDirection[axis]);
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.boundsMin[axis][base]), origin), invDirection);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.boundsMax[axis][base]), origin), invDirection);
+	}
+
+	template <int N>
+	POORAYTRACER_TARGET_SSE2
+	static void SlabDistancesSSE2(const QuantizedWideBVHNode<N>& node, const RayQuery& query, int axis, int base, __m128& t0, __m128& t1)
+	{
+		const __m128d nodeOrigin = _mm_set1_pd(node.origin[axis]);
+		const __m128d scale = _mm_set1_pd(node.Scale(axis));
+		const __m128d origin = _mm_set1_pd(query.origin[axis]);
+		const __m128d invDirection = _mm_set1_pd(query.invDirection[axis]);
+		// Four bytes widened to four ints, then converted two doubles at a time.
+		auto distances = [&](const uint8_t* q) POORAYTRACER_TARGET_SSE2 {
+			int32_t bytes;
+			std::memcpy(&bytes, q, sizeof(bytes));
+			__m128i zero = _mm_setzero_si128();
+			__m128i ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+			__m128d low = _mm_add_pd(nodeOrigin, _mm_mul_pd(_mm_cvtepi32_pd(ints), scale));
+			__m128d high = _mm_add_pd(nodeOrigin, _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(ints, _MM_SHUFFLE(3, 2, 3, 2))), scale));
+			low = _mm_mul_pd(_mm_sub_pd(low, origin), invDirection);
+			high = _mm_mul_pd(_mm_sub_pd(high, origin), invDirection);
+			return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+			};
+		t0 = distances(&node.childMin[axis][base]);
+		t1 = distances(&node.childMax[axis][base]);
+	}
+
+	template <int N, template <int> class Node>
+	POORAYTRACER_TARGET_SSE2
+	static uint32_t SlabTestSSE2(const Node<N>& node, const RayQuery& query, Real tMin, Real tMax, Real* tNear)
+	{
+		// SSE2 has no blendv: select(a, b, mask) = (mask & b) | (~mask & a).
+		auto select = [](__m128 a, __m128 b, __m128 mask) POORAYTRACER_TARGET_SSE2 {
+			return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+			};
+		uint32_t hitMask = 0;
+		for (int base = 0; base < N; base += 4) {
+			__m128 lo = _mm_set1_ps(tMin);
+			__m128 hi = _mm_set1_ps(tMax);
+			for (int axis = 0; axis < 3; ++axis) {
+				__m128 t0, t1;
+				SlabDistancesSSE2(node, query, axis, base, t0, t1);
+				__m128 ordered = _mm_cmplt_ps(t0, t1);
+				__m128 tEnter = select(t1, t0, ordered);
+				__m128 tExit = select(t0, t1, ordered);
+				lo = select(lo, tEnter, _mm_cmpgt_ps(tEnter, lo));
+				hi = select(hi, tExit, _mm_cmplt_ps(tExit, hi));
+			}
+			int miss = _mm_movemask_ps(_mm_cmple_ps(hi, lo));
+			hitMask |= static_cast<uint32_t>(~miss & 0xF) << base;
+			_mm_storeu_ps(tNear + base, lo);
+		}
+		return hitMask & ((1u << node.childNums) - 1);
+	}
+
+	template <int N>
+	POORAYTRACER_TARGET_AVX2
+	static void SlabDistancesAVX2(const WideBVHNode<N>& node, const RayQuery& query, int axis, int base, __m256& t0, __m256& t1)
+	{
+		__m256 origin = _mm256_set1_ps(query.origin[axis]);
+		__m256 invDirection = _mm256_set1_ps(query.invDirection[axis]);
+		t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&node.boundsMin[axis][base]), origin), invDirection);
+		t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&node.boundsMax[axis][base]), origin), invDirection);
+	}
+
+	template <int N>
+	POORAYTRACER_TARGET_AVX2
+	static void SlabDistancesAVX2(const QuantizedWideBVHNode<N>& node, const RayQuery& query, int axis, int base, __m256& t0, __m256& t1)
+	{
+		const __m256d nodeOrigin = _mm256_set1_pd(node.origin[axis]);
+		const __m256d scale = _mm256_set1_pd(node.Scale(axis));
+		const __m256d origin = _mm256_set1_pd(query.origin[axis]);
+		const __m256d invDirection = _mm256_set1_pd(query.invDirection[axis]);
+		auto distances = [&](const uint8_t* q) POORAYTRACER_TARGET_AVX2 {
+			__m256i ints = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q)));
+			__m256d low = _mm256_add_pd(nodeOrigin, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(ints)), scale));
+			__m256d high = _mm256_add_pd(nodeOrigin, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(ints, 1)), scale));
+			low = _mm256_mul_pd(_mm256_sub_pd(low, origin), invDirection);
+			high = _mm256_mul_pd(_mm256_sub_pd(high, origin), invDirection);
+			return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+			};
+		t0 = distances(&node.childMin[axis][base]);
+		t1 = distances(&node.childMax[axis][base]);
+	}
+
+	template <int N, template <int> class Node>
+	POORAYTRACER_TARGET_AVX2
+	static uint32_t SlabTestAVX2(const Node<N>& node, const RayQuery& query, Real tMin, Real tMax, Real* tNear)
+	{
+		static_assert(N == 8, "eight float lanes hold the children of a BVH8 node");
+		__m256 lo = _mm256_set1_ps(tMin);
+		__m256 hi = _mm256_set1_ps(tMax);
+		for (int axis = 0; axis < 3; ++axis) {
+			__m256 t0, t1;
+			SlabDistancesAVX2(node, query, axis, 0, t0, t1);
+			__m256 ordered = _mm256_cmp_ps(t0, t1, _CMP_LT_OQ);
+			__m256 tEnter = _mm256_blendv_ps(t1, t0, ordered);
+			__m256 tExit = _mm256_blendv_ps(t0, t1, ordered);
+			lo = _mm256_blendv_ps(lo, tEnter, _mm256_cmp_ps(tEnter, lo, _CMP_GT_OQ));
+			hi = _mm256_blendv_ps(hi, tExit, _mm256_cmp_ps(tExit, hi, _CMP_LT_OQ));
+		}
+		int miss = _mm256_movemask_ps(_mm256_cmp_ps(hi, lo, _CMP_LE_OQ));
+		_mm256_storeu_ps(tNear, lo);
+		return static_cast<uint32_t>(~miss & 0xFF) & ((1u << node.childNums) - 1);
+	}
+#endif
+
+	template <int N, template <int> class Node>
+	static typename WideBVH<N>::template SlabTestFunc<Node<N>> SelectSlabTest(SIMDLevel level)
+	{
+#if defined(POORAYTRACER_X86)
+		// Four float children fill an SSE register already, so a float BVH4 stays on SSE2.
+		if constexpr (N * sizeof(Real) >= 32) {
+			if (level == SIMDLevel::AVX2) return SlabTestAVX2<N, Node>;
+		}
+		if (level != SIMDLevel::Scalar) return SlabTestSSE2<N, Node>;
+#endif
+		return SlabTestScalar<N, Node>;
+	}
+
+	template <int N>
+	WideBVH<N>::WideBVH(const LinearBVH& bvh, WideBVHNodeFormat nodeFormat, WideBVHNodeLayout nodeLayout) :
+		bQuantized(nodeFormat == WideBVHNodeFormat::Quantized), primitives(bvh.primitives), primitivePtrs(bvh.primitivePtrs),
+		primitiveAreas(bvh.primitiveAreas), bSpatialSplits(bvh.bSpatialSplits),
+		bbox(bvh.BoundingBox()), area(bvh.GetArea())
+	{
+		SIMDLevel level = GetSIMDLevel();
+		slabTest = SelectSlabTest<N, WideBVHNode>(level);
+		quantizedSlabTest = SelectSlabTest<N, QuantizedWideBVHNode>(level);
+		triangleTest = SelectTriangleBlockTest(level);
+		if (bvh.nodes.empty()) {
+			return;
+		}
+		nodes.reserve(bvh.nodes.size() / (N - 1) + 1);
+		// The root is opened like any other node; a single-leaf tree becomes a root with one child.
+		Collapse(bvh, { 0 });
+		nodes.shrink_to_fit();
+		Reorder(nodeLayout);
+		PackTriangleBlocks();
+		if (bQuantized) {
+			Quantize();
+		}
+
+		size_t childSlots = 0;
+		for (const auto& node : nodes) {
+			childSlots += node.childNums;
+		}
+		LOGD("BVH{}: {} -> {} nodes ({} KB traversed{}, {} KB held), {:.2f} children per node, {} triangle blocks",
+			N, bvh.nodes.size(), nodes.size(), GetTraversalNodeBytes() / 1024, bQuantized ? ", quantized" : "", GetMemoryBytes() / 1024,
+			double(childSlots) / nodes.size(), blocks.size());
+	}
+
+	template <int N>
+	void WideBVH<N>::Reorder(WideBVHNodeLayout layout)
+	{
+		if (layout == WideBVHNodeLayout::DepthFirst || nodes.size() < 2) {
+			return;
+		}
+		std::vector<uint32_t> order;	// new position -> current index
+		order.reserve(nodes.size());
+		if (layout == WideBVHNodeLayout::Treelet) {
+			TreeletOrder(order);
+		}
+		else {
+			// Levels of the tallest path; children come after their parent, so a backward pass suffices.
+			std::vector<int> heights(nodes.size(), 1);
+			for (size_t nodeIdx = nodes.size(); nodeIdx-- > 0;) {
+				const WideBVHNode<N>& node = nodes[nodeIdx];
+				for (int child = 0; child < node.childNums; ++child) {
+					if (node.childPrimitiveNums[child] == 0) {
+						heights[nodeIdx] = std::max(heights[nodeIdx], heights[node.childOffset[child]] + 1);
+					}
+				}
+			}
+			VanEmdeBoasOrder(0, heights[0], order);
+		}
+
+		std::vector<uint32_t> newIndices(nodes.size());
+		for (uint32_t i = 0; i < order.size(); ++i) {
+			newIndices[order[i]] = i;
+		}
+		std::vector<WideBVHNode<N>> reordered(nodes.size());
+		for (uint32_t i = 0; i < order.size(); ++i) {
+			reordered[i] = nodes[order[i]];
+			WideBVHNode<N>& node = reordered[i];
+			for (int child = 0; child < node.childNums; ++child) {
+				if (node.childPrimitiveNums[child] == 0) {
+					node.childOffset[child] = newIndices[node.childOffset[child]];
+				}
+			}
+		}
+		nodes.swap(reordered);
+	}
+
+	template <int N>
+	void WideBVH<N>::TreeletOrder(std::vector<uint32_t>& order) const
+	{
+		// A treelet fills one page of the nodes traversal reads. It grows from its root by always
+		// taking the frontier node with the largest surface area, the one a random ray is most
+		// likely to enter; whatever is left on the frontier roots the next treelets.
+		const size_t nodeBytes = bQuantized ? sizeof(QuantizedWideBVHNode<N>) : sizeof(WideBVHNode<N>);
+		const size_t treeletNodes = std::max<size_t>(1, treeletBytes / nodeBytes);
+		std::vector<uint32_t> roots{ 0 };
+		for (size_t rootIdx = 0; rootIdx < roots.size(); ++rootIdx) {
+			std::priority_queue<std::pair<double, uint32_t>> frontier;
+			frontier.push({ std::numeric_limits<double>::infinity(), roots[rootIdx] });
+			for (size_t count = 0; count < treeletNodes && !frontier.empty(); ++count) {
+				uint32_t nodeIdx = frontier.top().second;
+				frontier.pop();
+				order.push_back(nodeIdx);
+				const WideBVHNode<N>& node = nodes[nodeIdx];
+				for (int child = 0; child < node.childNums; ++child) {
+					if (node.childPrimitiveNums[child] == 0) {
+						frontier.push({ ChildBounds(node, child).SurfaceArea(), node.childOffset[child] });
+					}
+				}
+			}
+			for (; !frontier.empty(); frontier.pop()) {
+				roots.push_back(frontier.top().second);
+			}
+		}
+	}
+
+	template <int N>
+	void WideBVH<N>::VanEmdeBoasOrder(uint32_t nodeIdx, int levels, std::vector<uint32_t>& order) const
+	{
+		if (levels == 1) {
+			order.push_back(nodeIdx);
+			return;
+		}
+		// The top half of the levels first, then every subtree hanging below it.
+		int topLevels = levels / 2;
+		VanEmdeBoasOrder(nodeIdx, topLevels, order);
+		std::vector<uint32_t> level{ nodeIdx }, nextLevel;
+		for (int depth = 0; depth < topLevels; ++depth) {
+			nextLevel.clear();
+			for (uint32_t idx : level) {
+				const WideBVHNode<N>& node = nodes[idx];
+				for (int child = 0; child < node.childNums; ++child) {
+					if (node.childPrimitiveNums[child] == 0) {
+						nextLevel.push_back(node.childOffset[child]);
+					}
+				}
+			}
+			level.swap(nextLevel);
+		}
+		for (uint32_t idx : level) {
+			VanEmdeBoasOrder(idx, levels - topLevels, order);
+		}
+	}
+
+	template <int N>
+	void WideBVH<N>::Quantize()
+	{
+		quantizedNodes.resize(nodes.size());
+		for (size_t nodeIdx = 0; nodeIdx < nodes.size(); ++nodeIdx) {
+			const WideBVHNode<N>& node = nodes[nodeIdx];
+			QuantizedWideBVHNode<N>& quantized = quantizedNodes[nodeIdx];
+			quantized = {};
+			quantized.childNums = node.childNums;
+			for (int child = 0; child < N; ++child) {
+				quantized.childOffset[child] = node.childOffset[child];
+				quantized.childPrimitiveNums[child] = node.childPrimitiveNums[child];
+			}
+			for (int axis = 0; axis < 3; ++axis) {
+				double boundsMin = std::numeric_limits<double>::infinity();
+				double boundsMax = -std::numeric_limits<double>::infinity();
+				for (int child = 0; child < node.childNums; ++child) {
+					boundsMin = std::min<double>(boundsMin, node.boundsMin[axis][child]);
+					boundsMax = std::max<double>(boundsMax, node.boundsMax[axis][child]);
+				}
+				// Smallest power of two that spans the node in 255 steps.
+				int exponent;
+				std::frexp((boundsMax - boundsMin) / 255.0, &exponent);
+				quantized.origin[axis] = boundsMin;
+				quantized.exponent[axis] = static_cast<int16_t>(std::max(exponent, -1022));
+				while (quantized.origin[axis] + 255.0 * quantized.Scale(axis) < boundsMax && quantized.exponent[axis] < 1023) {
+					++quantized.exponent[axis];
+				}
+				double scale = quantized.Scale(axis);
+				for (int child = 0; child < node.childNums; ++child) {
+					// Round outwards, then step further out wherever the decoded plane still cuts into the box:
+					// q * scale is exact but adding the origin rounds, possibly inwards.
+					double qMin = std::clamp(std::floor((node.boundsMin[axis][child] - boundsMin) / scale), 0.0, 255.0);
+					double qMax = std::clamp(std::ceil((node.boundsMax[axis][child] - boundsMin) / scale), 0.0, 255.0);
+					quantized.childMin[axis][child] = static_cast<uint8_t>(qMin);
+					quantized.childMax[axis][child] = static_cast<uint8_t>(qMax);
+					while (quantized.childMin[axis][child] > 0 && quantized.DecodeMin(axis, child) > node.boundsMin[axis][child]) {
+						--quantized.childMin[axis][child];
+					}
+					while (quantized.childMax[axis][child] < 255 && quantized.DecodeMax(axis, child) < node.boundsMax[axis][child]) {
+						++quantized.childMax[axis][child];
+					}
+				}
+			}
+		}
+	}
+
+	template <int N>
+	void WideBVH<N>::PackTriangleBlocks()
+	{
+		for (const Hittable* primitive : primitivePtrs) {
+			if (!dynamic_cast<const Triangle*>(primitive)) {
+				return;
+			}
+		}
+		bTriangleBlocks = true;
+		for (auto& node : nodes) {
+			for (int child = 0; child < node.childNums; ++child) {
+				uint16_t primitiveNums = node.childPrimitiveNums[child];
+				if (primitiveNums == 0) {
+					continue;
+				}
+				uint32_t primitivesOffset = node.childOffset[child];
+				node.childOffset[child] = static_cast<uint32_t>(blocks.size());
+				for (uint32_t i = 0; i < primitiveNums; i += TriangleBlock::width) {
+					blocks.emplace_back().primitivesOffset = primitivesOffset + i;
+					blocks.back().triangleNums = static_cast<uint8_t>(std::min<uint32_t>(TriangleBlock::width, primitiveNums - i));
+				}
+			}
+		}
+		RepackTriangleBlocks();
+	}
+
+	template <int N>
+	void WideBVH<N>::RepackTriangleBlocks()
+	{
+		for (TriangleBlock& block : blocks) {
+			const Triangle* triangles[TriangleBlock::width];
+			for (int lane = 0; lane < block.triangleNums; ++lane) {
+				triangles[lane] = static_cast<const Triangle*>(primitivePtrs[block.primitivesOffset + lane]);
+			}
+			PackTriangleBlock(block, triangles, block.triangleNums, block.primitivesOffset);
+		}
+	}
+
+	template <int N>
+	uint32_t WideBVH<N>::Collapse(const LinearBVH& bvh, std::vector<uint32_t> slots)
+	{
+		// Open the interior child with the largest surface area until the node is full.
+		// Opening replaces a child by its two children in place, so leaves keep their
+		// depth-first order (and light sampling picks the same leaf as in the binary tree).
+		while (slots.size() < N) {
+			int openIdx = -1;
+			Real openArea = -1.0;
+			for (int i = 0; i < static_cast<int>(slots.size()); ++i) {
+				const LinearBVHNode& binaryNode = bvh.nodes[slots[i]];
+				if (binaryNode.primitiveNums == 0 && binaryNode.bbox.SurfaceArea() > openArea) {
+					openIdx = i;
+					openArea = binaryNode.bbox.SurfaceArea();
+				}
+			}
+			if (openIdx < 0) {
+				break;
+			}
+			uint32_t opened = slots[openIdx];
+			slots[openIdx] = opened + 1;
+			slots.insert(slots.begin() + openIdx + 1, bvh.nodes[opened].secondChildOffset);
+		}
+
+		uint32_t nodeIdx = static_cast<uint32_t>(nodes.size());
+		nodes.emplace_back();
+		{
+			WideBVHNode<N>& node = nodes[nodeIdx];
+			node.childNums = static_cast<uint8_t>(slots.size());
+			for (int child = 0; child < N; ++child) {
+				// Unused slots get a valid empty box; they are masked out by childNums anyway.
+				AABB childBox = child < node.childNums ? bvh.nodes[slots[child]].bbox : AABB(vec3(0.), vec3(0.));
+				for (int axis = 0; axis < 3; ++axis) {
+					node.boundsMin[axis][child] = childBox.GetAxisInterval(axis).min;
+					node.boundsMax[axis][child] = childBox.GetAxisInterval(axis).max;
+				}
+				node.childArea[child] = child < node.childNums ? bvh.nodes[slots[child]].area : 0.0;
+				node.childOffset[child] = 0;
+				node.childPrimitiveNums[child] = 0;
+			}
+		}
+		for (int child = 0; child < static_cast<int>(slots.size()); ++child) {
+			const LinearBVHNode& binaryNode = bvh.nodes[slots[child]];
+			uint32_t childOffset = binaryNode.primitiveNums > 0 ? binaryNode.primitivesOffset
+				: Collapse(bvh, { slots[child] + 1, binaryNode.secondChildOffset });
+			// `nodes` may have grown, so index again.
+			nodes[nodeIdx].childOffset[child] = childOffset;
+			nodes[nodeIdx].childPrimitiveNums[child] = binaryNode.primitiveNums;
+		}
+		return nodeIdx;
+	}
+
+	template <int N>
+	void WideBVH<N>::Refit()
+	{
+		if (nodes.empty()) {
+			return;
+		}
+		// Primitive areas change with the primitives; duplicated references share theirs as in LinearBVH.
+		std::unordered_map<const Hittable*, uint32_t> referenceNums;
+		if (bSpatialSplits) {
+			for (const Hittable* primitive : primitivePtrs) {
+				++referenceNums[primitive];
+			}
+		}
+		for (size_t i = 0; i < primitivePtrs.size(); ++i) {
+			primitiveAreas[i] = primitivePtrs[i]->GetArea() / (bSpatialSplits ? referenceNums[primitivePtrs[i]] : 1);
+		}
+		if (bTriangleBlocks) {
+			RepackTriangleBlocks();
+		}
+		// Interior children always come after their parent, so a backward pass is bottom-up.
+		for (size_t nodeIdx = nodes.size(); nodeIdx-- > 0;) {
+			WideBVHNode<N>& node = nodes[nodeIdx];
+			for (int child = 0; child < node.childNums; ++child) {
+				AABB childBox = AABB::empty;
+				Real childArea = 0.0;
+				if (node.childPrimitiveNums[child] > 0) {
+					uint32_t primitivesOffset = LeafPrimitivesOffset(node, child);
+					for (uint32_t i = primitivesOffset; i < primitivesOffset + node.childPrimitiveNums[child]; ++i) {
+						childBox = AABB(childBox, primitivePtrs[i]->BoundingBox());
+						childArea += primitiveAreas[i];
+					}
+				}
+				else {
+					const WideBVHNode<N>& childNode = nodes[node.childOffset[child]];
+					for (int grandchild = 0; grandchild < childNode.childNums; ++grandchild) {
+						childBox = AABB(childBox, ChildBounds(childNode, grandchild));
+						childArea += childNode.childArea[grandchild];
+					}
+				}
+				for (int axis = 0; axis < 3; ++axis) {
+					node.boundsMin[axis][child] = childBox.GetAxisInterval(axis).min;
+					node.boundsMax[axis][child] = childBox.GetAxisInterval(axis).max;
+				}
+				node.childArea[child] = childArea;
+			}
+		}
+
+		if (bQuantized) {
+			Quantize();
+		}
+
+		bbox = AABB::empty;
+		area = 0.0;
+		const WideBVHNode<N>& root = nodes[0];
+		for (int child = 0; child < root.childNums; ++child) {
+			bbox = AABB(bbox, ChildBounds(root, child));
+			area += root.childArea[child];
+		}
+	}
+
+	template <int N>
+	bool WideBVH<N>::Hit(const Ray& ray, Interval domain, HitRecord& record) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		return bQuantized ? HitNodes(quantizedNodes, quantizedSlabTest, ray, domain, record) : HitNodes(nodes, slabTest, ray, domain, record);
+	}
+
+	template <int N>
+	template <typename Node>
+	bool WideBVH<N>::HitNodes(const std::vector<Node>& traversalNodes, SlabTestFunc<Node> test, const Ray& ray, Interval domain, HitRecord& record) const
+	{
+		const RayQuery query(ray);
+		const ShearedRay shearedRay(ray);
+		Mailbox mailbox;
+
+		struct StackEntry {
+			Real tNear;
+			uint32_t offset;
+			uint16_t primitiveNums;
+		};
+		// Every level pushes at most N - 1 siblings.
+		StackEntry toVisit[LinearBVH::maxDepth * (N - 1) + 1];
+		int toVisitOffset = 0;
+		toVisit[toVisitOffset++] = { -Infinity, 0, 0 };
+
+		bool bHitAnything = false;
+		Real closest = domain.max;
+		// Closest packed triangle so far; it is recorded once traversal is done.
+		uint32_t closestPrimitive = 0;
+		Real closestAlpha = 0.0, closestBeta = 0.0;
+		while (toVisitOffset > 0) {
+			const StackEntry entry = toVisit[--toVisitOffset];
+			if (entry.tNear > closest) {
+				continue;
+			}
+			if (entry.primitiveNums > 0 && bTriangleBlocks) {
+				// Duplicated references need no mailbox here: retesting a triangle is cheap in a block
+				// and can never produce a closer hit.
+				uint32_t lastBlock = entry.offset + (entry.primitiveNums + TriangleBlock::width - 1) / TriangleBlock::width;
+				for (uint32_t blockIdx = entry.offset; blockIdx < lastBlock; ++blockIdx) {
+					const TriangleBlock& block = blocks[blockIdx];
+					alignas(32) Real t[TriangleBlock::width], alpha[TriangleBlock::width], beta[TriangleBlock::width];
+					uint32_t hitMask = triangleTest(block, shearedRay, domain.min, closest, t, alpha, beta);
+					// Lanes in order with an inclusive bound, as if Triangle::Hit had been called on each.
+					for (int lane = 0; hitMask != 0; ++lane, hitMask >>= 1) {
+						if ((hitMask & 1u) && t[lane] <= closest) {
+							bHitAnything = true;
+							closest = t[lane];
+							closestPrimitive = block.primitivesOffset + lane;
+							closestAlpha = alpha[lane];
+							closestBeta = beta[lane];
+						}
+					}
+				}
+				continue;
+			}
+			if (entry.primitiveNums > 0) {
+				for (uint32_t i = 0; i < entry.primitiveNums; ++i) {
+					const Hittable* primitive = primitivePtrs[entry.offset + i];
+					if (bSpatialSplits && !mailbox.Visit(primitive)) {
+						continue;
+					}
+					if (primitive->Hit(ray, Interval(domain.min, closest), record)) {
+						bHitAnything = true;
+						closest = record.time;
+					}
+				}
+				continue;
+			}
+
+			const Node& node = traversalNodes[entry.offset];
+			alignas(32) Real tNear[N];
+			uint32_t hitMask = test(node, query, domain.min, closest, tNear);
+
+			// Sort the hit children far to near, then push them so the nearest is popped first.
+			int order[N];
+			int hitNums = 0;
+			for (int child = 0; child < N; ++child) {
+				if (!(hitMask & (1u << child))) continue;
+				int i = hitNums++;
+				while (i > 0 && tNear[order[i - 1]] < tNear[child]) {
+					order[i] = order[i - 1];
+					--i;
+				}
+				order[i] = child;
+			}
+			for (int i = 0; i < hitNums; ++i) {
+				int child = order[i];
+				toVisit[toVisitOffset++] = { tNear[child], node.childOffset[child], node.childPrimitiveNums[child] };
+			}
+		}
+		if (bHitAnything && bTriangleBlocks) {
+			static_cast<const Triangle*>(primitivePtrs[closestPrimitive])->RecordHit(closest, closestAlpha, closestBeta, record);
+		}
+		return bHitAnything;
+	}
+
+	template <int N>
+	void WideBVH<N>::HitPacket(const RayPacket& packet, Interval domain, RayPacketHits& hits) const
+	{
+		if (nodes.empty()) {
+			return;
+		}
+		if (!packet.bCoherent) {
+			Hittable::HitPacket(packet, domain, hits);
+			return;
+		}
+		if (bQuantized) {
+			HitPacketNodes(quantizedNodes, packet, domain, hits);
+		}
+		else {
+			HitPacketNodes(nodes, packet, domain, hits);
+		}
+	}
+
+	template <int N>
+	template <typename Node>
+	void WideBVH<N>::HitPacketNodes(const std::vector<Node>& traversalNodes, const RayPacket& packet, Interval domain, RayPacketHits& hits) const
+	{
+		const int rayNums = packet.rayNums;
+		RayQuery queries[RayPacket::maxRays];
+		ShearedRay shearedRays[RayPacket::maxRays];
+		for (int r = 0; r < rayNums; ++r) {
+			queries[r] = RayQuery(packet.rays[r]);
+			if (bTriangleBlocks) {
+				shearedRays[r] = ShearedRay(packet.rays[r]);
+			}
+		}
+		// Closest packed triangle per ray; recorded once traversal is done.
+		bool bBlockHit[RayPacket::maxRays] = {};
+		uint32_t closestPrimitive[RayPacket::maxRays];
+		Real closestAlpha[RayPacket::maxRays], closestBeta[RayPacket::maxRays];
+		auto packetFarthest = [&]() {
+			return *std::max_element(hits.closest, hits.closest + rayNums);
+			};
+		Real farthest = packetFarthest();
+
+		struct StackEntry {
+			Real tEnter;		// lower bound over the packet
+			uint32_t nodeIdx;	// parent node and slot of the child to visit
+			uint8_t child;
+			uint8_t firstActive;	// rays before this one are known to miss the parent
+		};
+		StackEntry toVisit[LinearBVH::maxDepth * (N - 1) + N];
+		int toVisitOffset = 0;
+
+		auto pushChildren = [&](uint32_t nodeIdx, int firstActive) {
+			const Node& node = traversalNodes[nodeIdx];
+			Real tEnter[N];
+			int order[N];
+			int hitNums = 0;
+			for (int child = 0; child < node.childNums; ++child) {
+				if (!packet.MayHit(ChildBounds(node, child), domain.min, farthest, tEnter[child])) continue;
+				// Far to near, so that the nearest child is popped first.
+				int i = hitNums++;
+				while (i > 0 && tEnter[order[i - 1]] < tEnter[child]) {
+					order[i] = order[i - 1];
+					--i;
+				}
+				order[i] = child;
+			}
+			for (int i = 0; i < hitNums; ++i) {
+				toVisit[toVisitOffset++] = { tEnter[order[i]], nodeIdx, static_cast<uint8_t>(order[i]), static_cast<uint8_t>(firstActive) };
+			}
+			};
+
+		pushChildren(0, 0);
+		while (toVisitOffset > 0) {
+			const StackEntry entry = toVisit[--toVisitOffset];
+			if (entry.tEnter > farthest) {
+				continue;
+			}
+			const Node& node = traversalNodes[entry.nodeIdx];
+			const AABB box = ChildBounds(node, entry.child);
+			// Skip the rays that miss this box up front; once none is left the packet is done here.
+			int firstActive = entry.firstActive;
+			while (firstActive < rayNums && !box.Hit(queries[firstActive], Interval(domain.min, hits.closest[firstActive]))) {
+				++firstActive;
+			}
+			if (firstActive == rayNums) {
+				continue;
+			}
+			uint32_t offset = node.childOffset[entry.child];
+			uint16_t primitiveNums = node.childPrimitiveNums[entry.child];
+			if (primitiveNums == 0) {
+				pushChildren(offset, firstActive);
+				continue;
+			}
+
+			if (bTriangleBlocks) {
+				uint32_t lastBlock = offset + (primitiveNums + TriangleBlock::width - 1) / TriangleBlock::width;
+				for (int r = firstActive; r < rayNums; ++r) {
+					if (r != firstActive && !box.Hit(queries[r], Interval(domain.min, hits.closest[r]))) {
+						continue;
+					}
+					for (uint32_t blockIdx = offset; blockIdx < lastBlock; ++blockIdx) {
+						const TriangleBlock& block = blocks[blockIdx];
+						alignas(32) Real t[TriangleBlock::width], alpha[TriangleBlock::width], beta[TriangleBlock::width];
+						uint32_t hitMask = triangleTest(block, shearedRays[r], domain.min, hits.closest[r], t, alpha, beta);
+						for (int lane = 0; hitMask != 0; ++lane, hitMask >>= 1) {
+							if ((hitMask & 1u) && t[lane] <= hits.closest[r]) {
+								hits.closest[r] = t[lane];
+								bBlockHit[r] = true;
+								closestPrimitive[r] = block.primitivesOffset + lane;
+								closestAlpha[r] = alpha[lane];
+								closestBeta[r] = beta[lane];
+							}
+						}
+					}
+				}
+			}
+			else {
+				// Each primitive gets the whole packet: an instance continues with packet traversal
+				// in its own BVH, where the rays that miss are dropped again.
+				for (uint32_t i = 0; i < primitiveNums; ++i) {
+					primitivePtrs[offset + i]->HitPacket(packet, domain, hits);
+				}
+			}
+			farthest = packetFarthest();
+		}
+
+		for (int r = 0; r < rayNums; ++r) {
+			if (bBlockHit[r]) {
+				static_cast<const Triangle*>(primitivePtrs[closestPrimitive[r]])->RecordHit(hits.closest[r], closestAlpha[r], closestBeta[r], hits.records[r]);
+				hits.bUpdated[r] = true;
+			}
+		}
+	}
+
+	template <int N>
+	bool WideBVH<N>::Occluded(const Ray& ray, Interval domain) const
+	{
+		if (nodes.empty()) {
+			return false;
+		}
+		return bQuantized ? OccludedNodes(quantizedNodes, quantizedSlabTest, ray, domain) : OccludedNodes(nodes, slabTest, ray, domain);
+	}
+
+	template <int N>
+	template <typename Node>
+	bool WideBVH<N>::OccludedNodes(const std::vector<Node>& traversalNodes, SlabTestFunc<Node> test, const Ray& ray, Interval domain) const
+	{
+		const RayQuery query(ray);
+		const ShearedRay shearedRay(ray);
+		Mailbox mailbox;
+
+		// Any hit will do, so children are pushed in slot order without sorting.
+		struct StackEntry {
+			uint32_t offset;
+			uint16_t primitiveNums;
+		};
+		StackEntry toVisit[LinearBVH::maxDepth * (N - 1) + 1];
+		int toVisitOffset = 0;
+		toVisit[toVisitOffset++] = { 0, 0 };
+
+		while (toVisitOffset > 0) {
+			const StackEntry entry = toVisit[--toVisitOffset];
+			if (entry.primitiveNums > 0 && bTriangleBlocks) {
+				uint32_t lastBlock = entry.offset + (entry.primitiveNums + TriangleBlock::width - 1) / TriangleBlock::width;
+				for (uint32_t blockIdx = entry.offset; blockIdx < lastBlock; ++blockIdx) {
+					alignas(32) Real t[TriangleBlock::width], alpha[TriangleBlock::width], beta[TriangleBlock::width];
+					if (triangleTest(blocks[blockIdx], shearedRay, domain.min, domain.max, t, alpha, beta) != 0) {
+						return true;
+					}
+				}
+				continue;
+			}
+			if (entry.primitiveNums > 0) {
+				for (uint32_t i = 0; i < entry.primitiveNums; ++i) {
+					const Hittable* primitive = primitivePtrs[entry.offset + i];
+					if (bSpatialSplits && !mailbox.Visit(primitive)) {
+						continue;
+					}
+					if (primitive->Occluded(ray, domain)) {
+						return true;
+					}
+				}
+				continue;
+			}
+
+			const Node& node = traversalNodes[entry.offset];
+			alignas(32) Real tNear[N];
+			uint32_t hitMask = test(node, query, domain.min, domain.max, tNear);
+			for (int child = 0; child < N; ++child) {
+				if (hitMask & (1u << child)) {
+					toVisit[toVisitOffset++] = { node.childOffset[child], node.childPrimitiveNums[child] };
+				}
+			}
+		}
+		return false;
+	}
+
+	template <int N>
+	void WideBVH<N>::Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		Real p = std::sqrt(RandomDouble()) * GetArea();
+		SampleByArea(origin, p, samplePointRecord, pdf);
+		pdf /= GetArea();
+	}
+
+	template <int N>
+	void WideBVH<N>::SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const
+	{
+		uint32_t nodeIdx = 0;
+		while (true) {
+			const WideBVHNode<N>& node = nodes[nodeIdx];
+			int child = 0;
+			for (; child < node.childNums - 1; ++child) {
+				if (p < node.childArea[child]) break;
+				p -= node.childArea[child];
+			}
+			if (node.childPrimitiveNums[child] == 0) {
+				nodeIdx = node.childOffset[child];
+				continue;
+			}
+			uint32_t primitivesOffset = LeafPrimitivesOffset(node, child);
+			uint16_t primitiveNums = node.childPrimitiveNums[child];
+			for (uint32_t i = 0; i < primitiveNums; ++i) {
+				const Hittable* primitive = primitivePtrs[primitivesOffset + i];
+				Real area = primitiveAreas[primitivesOffset + i];
+				if (p < area || i + 1 == primitiveNums) {
+					primitive->SampleByArea(origin, ScaleToPrimitiveArea(p, area, primitive), samplePointRecord, pdf);
+					return;
+				}
+				p -= area;
+			}
+		}
+	}
+
+	template class WideBVH<4>;
+	template class WideBVH<8>;
+}
\ No newline at end of file
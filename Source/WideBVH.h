@@ -0,0 +1,158 @@
+#pragma once
+#include "LinearBVH.h"
+#include "SIMD.h"
+#include "TriangleBlock.h"
+#include "Ray.h"
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace Pooraytracer {
+
+	// Children bounds are stored structure-of-arrays so that one slab test covers several
+	// boxes: boundsMin[axis][child]. Bounds are stored in the renderer's precision, which keeps
+	// every box decision identical to AABB::Hit.
+	template <int N>
+	struct alignas(64) WideBVHNode {
+		Real boundsMin[3][N];
+		Real boundsMax[3][N];
+		Real childArea[N];
+		uint32_t childOffset[N];		// interior child: node index, leaf child: primitive offset (first block when packed)
+		uint16_t childPrimitiveNums[N];	// 0 -> interior child
+		uint8_t childNums;
+	};
+
+	// Compressed node: each child box is stored in 8 bits per plane relative to the node's own
+	// bounds, on a power-of-two grid (scale = 2^exponent). Decoding (origin + q * scale) rounds,
+	// so Quantize() checks every decoded plane against the original box and steps it outwards until
+	// the quantized box contains the original one. 128 bytes for BVH8 instead of 512, for BVH4 128
+	// instead of 256; that is what traversal reads, but the full nodes are kept next to them (see
+	// WideBVHNodeFormat), so the tree as a whole grows by these bytes per node.
+	template <int N>
+	struct alignas(64) QuantizedWideBVHNode {
+		double origin[3];
+		int16_t exponent[3];			// scale = 2^exponent per axis
+		uint8_t childNums;
+		uint8_t childMin[3][N];
+		uint8_t childMax[3][N];
+		uint32_t childOffset[N];
+		uint16_t childPrimitiveNums[N];
+
+		double Scale(int axis) const {
+			return std::bit_cast<double>(static_cast<uint64_t>(exponent[axis] + 1023) << 52);
+		}
+		double DecodeMin(int axis, int child) const { return origin[axis] + childMin[axis][child] * Scale(axis); }
+		double DecodeMax(int axis, int child) const { return origin[axis] + childMax[axis][child] * Scale(axis); }
+	};
+
+	static_assert(sizeof(QuantizedWideBVHNode<8>) == 128, "QuantizedWideBVHNode<8> should fill two cache lines");
+
+	enum class WideBVHNodeFormat
+	{
+		Full,		// child bounds at full precision
+		Quantized	// QuantizedWideBVHNode for traversal, stored next to the full nodes refitting and light sampling read
+	};
+
+	// Order of the nodes in memory. Every layout keeps the root first and parents before their
+	// children, so any of them can be refit with one backward pass.
+	enum class WideBVHNodeLayout
+	{
+		DepthFirst,		// as collapsed: every subtree contiguous, the first child right after its parent
+		Treelet,		// page-sized treelets grown from their root by surface area, i.e. by visit probability
+		VanEmdeBoas		// top half of the levels, then each bottom subtree, recursively: cache-oblivious
+	};
+
+	// BVH4 / BVH8 collapsed from a binary LinearBVH. Children are slab tested together
+	// (AVX2: 4 boxes per instruction, SSE2: 2, twice that in a float build; dispatched at runtime)
+	// and visited nearest first.
+	// When every primitive is a Triangle, leaves are packed into TriangleBlocks and intersected
+	// four at a time without virtual calls; only the closest hit's shading data is fetched.
+	// With WideBVHNodeFormat::Quantized, traversal reads the compressed nodes instead, which
+	// trades a few extra box hits for a quarter (BVH8) or half (BVH4) of the node traffic. The
+	// full nodes are kept, so the tree holds more node memory than with WideBVHNodeFormat::Full.
+	template <int N>
+	class WideBVH :public Hittable {
+		static_assert(N == 4 || N == 8, "WideBVH supports 4 or 8 children per node");
+
+	public:
+		WideBVH(const LinearBVH& bvh, WideBVHNodeFormat nodeFormat = WideBVHNodeFormat::Full,
+			WideBVHNodeLayout nodeLayout = WideBVHNodeLayout::DepthFirst);
+
+		bool Hit(const Ray& ray, Interval domain, HitRecord& record) const override;
+		bool Occluded(const Ray& ray, Interval domain) const override;
+		// Packet traversal: children are culled for the whole packet by interval arithmetic and
+		// entered only if one of the packet's rays really hits them; leaves test the rays still active.
+		void HitPacket(const RayPacket& packet, Interval domain, RayPacketHits& hits) const override;
+		AABB BoundingBox() const override { return bbox; }
+		Real GetArea() const override { return area; }
+		void Sample(const point3& origin, HitRecord& samplePointRecord, Real& pdf) const override;
+		void SampleByArea(const point3& origin, Real p, HitRecord& samplePointRecord, Real& pdf) const override;
+		// Refit the children bounds bottom-up in O(n), keeping the topology. For a partial rebuild,
+		// Update() the source LinearBVH and collapse it again; the tree does not keep its source,
+		// so whoever may need that has to hold on to it.
+		void Refit() override;
+
+		size_t GetNodeNums() const { return nodes.size(); }
+		// Bytes of node data traversal reads from; with quantized nodes less than the nodes held.
+		size_t GetTraversalNodeBytes() const {
+			return bQuantized ? quantizedNodes.size() * sizeof(QuantizedWideBVHNode<N>) : nodes.size() * sizeof(WideBVHNode<N>);
+		}
+		// Bytes held by the structure, the primitives themselves excluded.
+		size_t GetMemoryBytes() const {
+			return sizeof(*this) + nodes.capacity() * sizeof(WideBVHNode<N>) + quantizedNodes.capacity() * sizeof(QuantizedWideBVHNode<N>) +
+				primitives.capacity() * sizeof(shared_ptr<Hittable>) + primitivePtrs.capacity() * sizeof(const Hittable*) +
+				primitiveAreas.capacity() * sizeof(Real) + blocks.capacity() * sizeof(TriangleBlock);
+		}
+
+	public:
+		static constexpr size_t treeletBytes = 4096;
+		// Returns a bit mask of the children whose box overlaps [tMin, tMax] and writes their entry distances.
+		template <typename Node>
+		using SlabTestFunc = uint32_t(*)(const Node& node, const RayQuery& query, Real tMin, Real tMax, Real* tNear);
+
+	private:
+		std::vector<WideBVHNode<N>> nodes;
+		std::vector<QuantizedWideBVHNode<N>> quantizedNodes;	// same indices as `nodes`
+		bool bQuantized = false;
+		std::vector<shared_ptr<Hittable>> primitives;
+		std::vector<const Hittable*> primitivePtrs;
+		std::vector<Real> primitiveAreas;
+		bool bSpatialSplits;
+		AABB bbox;
+		Real area = 0.0;
+		SlabTestFunc<WideBVHNode<N>> slabTest;
+		SlabTestFunc<QuantizedWideBVHNode<N>> quantizedSlabTest;
+		std::vector<TriangleBlock> blocks;	// leaf triangles, ceil(primitiveNums / 4) blocks per leaf
+		bool bTriangleBlocks = false;
+		TriangleBlockTestFunc triangleTest;
+
+		uint32_t Collapse(const LinearBVH& bvh, std::vector<uint32_t> slots);
+		void Reorder(WideBVHNodeLayout layout);
+		void TreeletOrder(std::vector<uint32_t>& order) const;
+		void VanEmdeBoasOrder(uint32_t nodeIdx, int levels, std::vector<uint32_t>& order) const;
+		void Quantize();
+		// Traversal over either node format; the public queries dispatch on bQuantized.
+		template <typename Node>
+		bool HitNodes(const std::vector<Node>& traversalNodes, SlabTestFunc<Node> test, const Ray& ray, Interval domain, HitRecord& record) const;
+		template <typename Node>
+		bool OccludedNodes(const std::vector<Node>& traversalNodes, SlabTestFunc<Node> test, const Ray& ray, Interval domain) const;
+		template <typename Node>
+		void HitPacketNodes(const std::vector<Node>& traversalNodes, const RayPacket& packet, Interval domain, RayPacketHits& hits) const;
+		void PackTriangleBlocks();
+		void RepackTriangleBlocks();
+		static AABB ChildBounds(const WideBVHNode<N>& node, int child) {
+			return AABB(vec3(node.boundsMin[0][child], node.boundsMin[1][child], node.boundsMin[2][child]),
+				vec3(node.boundsMax[0][child], node.boundsMax[1][child], node.boundsMax[2][child]));
+		}
+		static AABB ChildBounds(const QuantizedWideBVHNode<N>& node, int child) {
+			return AABB(vec3(node.DecodeMin(0, child), node.DecodeMin(1, child), node.DecodeMin(2, child)),
+				vec3(node.DecodeMax(0, child), node.DecodeMax(1, child), node.DecodeMax(2, child)));
+		}
+		uint32_t LeafPrimitivesOffset(const WideBVHNode<N>& node, int child) const {
+			return bTriangleBlocks ? blocks[node.childOffset[child]].primitivesOffset : node.childOffset[child];
+		}
+	};
+
+	using BVH4 = WideBVH<4>;
+	using BVH8 = WideBVH<8>;
+}
\ No newline at end of file
@@ -1,7 +1,27 @@
 #include "Source/Logger.h"
 #include "Source/Model.h"
 #include "Source/BVH.h"
+#include "Source/LinearBVH.h"
+#include "Source/WideBVH.h"
+#include "Source/Instance.h"
 #include "Source/Camera.h"
+#include "Source/StreamedGeometry.h"
+
+#include <algorithm>
+#include <filesystem>
+
+// Sizes and modification times of the files, to notice that any of them changed without reading them.
+static uint64_t HashFileStamps(const std::vector<std::string>& paths)
+{
+	uint64_t hash = 0;
+	for (const std::string& path : paths) {
+		std::error_code error;
+		const uint64_t stamp[2] = { std::filesystem::file_size(path, error),
+			static_cast<uint64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count()) };
+		hash = Pooraytracer::HashBytes(stamp, sizeof(stamp), hash);
+	}
+	return hash;
+}
 
 int main(void)
 {
@@ -11,6 +31,9 @@ int main(void)
 	using namespace Pooraytracer;
 
 	LOGI("Hello Pooraytracer!");
+	// Mesh, material, BVH and instance objects live as long as the scene; the arrays they own are
+	// heap allocations of their own. Declared first, so it is destroyed after everything allocated from it.
+	Arena sceneArena;
 	// cornell-box
 	// veach-mis
 	// bathroom2
@@ -18,6 +41,16 @@ int main(void)
 	const std::string filePath = RESOURCES_DIR + fileName;
 	// .obj file path filePath/fileName.obj
 	// .xml file path filePath/fileName.xml
+	// Out of core: render the meshes from a chunk file (filePath/fileName.chunks, converted on the
+	// first run) through a cache of streamCacheBytes, instead of keeping them all in memory.
+	const bool bStreamGeometry = false;
+	const size_t streamCacheBytes = size_t(512) << 20;
+	// Split method of the mesh BVHs. SpatialSAH splits long, thin triangles (bathroom2's trims and
+	// planks) at the cost of duplicated references and a longer build.
+	const BVHSplitMethod meshSplitMethod = BVHSplitMethod::SAH;
+	// Keep the binary BVH each mesh BVH is collapsed from, for meshes that deform beyond what a
+	// Refit() handles: Update() the binary BVH, then collapse it into the mesh BVH again.
+	const bool bDeformableMeshes = false;
 	LOGI("{}", fileName);
 	LOGI("{}", filePath);
 
@@ -26,30 +59,129 @@ int main(void)
 	camera.russianRoulette = 0.8;
 	camera.samplesPerPixel = 100;
 	camera.maxDepth = 100;
+	// Adaptive sampling, e.g. 0.01: pixels stop once their standard error is within 1% of their value.
+	camera.adaptiveRelativeError = 0.0;
+	// Progressive rendering, e.g. 4 samples per pass: the render can be cut off by a time budget in
+	// seconds, and the image so far is written to the snapshot every minute.
+	camera.progressiveSamples = 0;
+	camera.timeBudgetSeconds = 0.0;
+	camera.snapshotPath = PROJECT_ROOT"Results/" + fileName + "_progress.png";
+	// Checkpoints, e.g. PROJECT_ROOT"Results/" + fileName + ".checkpoint", to resume a render that was
+	// stopped, crashed or cut off by the time budget. They are written between passes, so set
+	// progressiveSamples too; a single-pass render is only checkpointed at its end.
+	camera.checkpointPath = "";
+	camera.bResumeFromCheckpoint = false;
+	camera.sceneHash = HashFileStamps({ filePath + "/" + fileName + ".obj", filePath + "/" + fileName + ".mtl",
+		filePath + "/" + fileName + ".xml" });
 	camera.threadNums = 16;
 	camera.background = color(0.0, 0.0, 0.0);
 	camera.SetViewParametersByXmlFile(filePath + "/" + fileName + ".xml");
 
-	std::shared_ptr<Model> model = std::make_shared<Pooraytracer::Model>(filePath, fileName);
-
 	LOGI("Building BVH...");
+	LOGI("SIMD: {}", GetSIMDLevelName(GetSIMDLevel()));
+	auto buildStartTime = std::chrono::steady_clock::now();
 	HittableList world;
 	HittableList lights;
-	for (auto& mesh : model->meshes) {
-		world.Add(make_shared<BVHNode>(mesh));
-		if (mesh->material->HasEmission()) {
-			lights.Add(make_shared<BVHNode>(mesh));
+	size_t triangleNums = 0;
+	shared_ptr<StreamedGeometry> streamed;
+	std::unordered_map<const Mesh*, shared_ptr<BVH8>> meshBVHs;
+	std::unordered_map<const Mesh*, shared_ptr<LinearBVH>> meshSourceBVHs;	// with bDeformableMeshes
+	if (bStreamGeometry) {
+		const std::string chunkPath = filePath + "/" + fileName + ".chunks";
+		auto HashSources = [&](const std::vector<std::string>& materialLibraries) {
+			std::vector<std::string> paths = { filePath + "/" + fileName + ".obj", filePath + "/" + fileName + ".xml" };
+			for (const std::string& library : materialLibraries) {
+				paths.push_back(filePath + "/" + library);
+			}
+			return HashFileStamps(paths);
+			};
+		// Converted again when the model's files changed; otherwise only the materials are loaded,
+		// by the names the chunk file stores, and the model is not parsed at all.
+		GeometryChunkSource source;
+		if (!StreamedGeometry::ReadSource(chunkPath, source) || source.hash != HashSources(source.materialLibraries)) {
+			LOGI("Converting {} to chunks...", fileName);
+			Model model(filePath, fileName);
+			std::vector<shared_ptr<Material>> modelMaterials;
+			source = GeometryChunkSource{ model.GetMaterialLibraries(), {}, HashSources(model.GetMaterialLibraries()) };
+			for (const auto& [name, material] : model.GetMaterials()) {
+				source.materialNames.push_back(name);
+				modelMaterials.push_back(material);
+			}
+			GeometryChunkWriter writer(chunkPath, modelMaterials, source);
+			bool bWritten = true;
+			for (auto& mesh : model.meshes) {
+				bWritten = bWritten && writer.Add(*mesh);
+			}
+			bWritten = writer.Finish() && bWritten;
+			if (!bWritten) {
+				std::filesystem::remove(chunkPath);
+				return 1;
+			}
+		}
+		const auto materialInstances = Model::LoadMaterials(filePath, fileName, source.materialLibraries, &sceneArena);
+		std::vector<shared_ptr<Material>> materials;
+		for (const std::string& name : source.materialNames) {
+			auto it = materialInstances.find(name);
+			if (it == materialInstances.end()) {
+				LOGE("Material {} of {} is not in its .mtl files", name, chunkPath);
+				return 1;
+			}
+			materials.push_back(it->second);
 		}
+		streamed = std::make_shared<StreamedGeometry>(chunkPath, materials, streamCacheBytes, camera.threadNums);
+		triangleNums = streamed->GetFaceNums();
+		world.Add(streamed);
+		for (auto& chunk : streamed->GetEmissiveChunks()) {
+			lights.Add(chunk);
+		}
+		lights = HittableList(sceneArena.MakeShared<BVH8>(LinearBVH(lights, BVHSplitMethod::SAH, camera.threadNums)));
+		camera.bWavefront = true;
+	}
+	else {
+		std::shared_ptr<Model> model = std::make_shared<Pooraytracer::Model>(filePath, fileName, &sceneArena);
+
+		// Node format and layout of the mesh BVHs, which hold nearly all nodes. Quantized nodes cut the
+		// node traffic of traversal but are stored next to the full ones, so they cost memory. Treelet
+		// and VanEmdeBoas layouts order the nodes for the cache instead of depth first.
+		const WideBVHNodeFormat meshNodeFormat = WideBVHNodeFormat::Full;
+		const WideBVHNodeLayout meshNodeLayout = WideBVHNodeLayout::DepthFirst;
+
+		// Two levels: one bottom-level BVH per unique mesh, shared by every instance of it and by the lights list.
+		for (auto& mesh : model->meshes) {
+			shared_ptr<BVH8>& meshBVH = meshBVHs[mesh.get()];
+			if (!meshBVH) {
+				triangleNums += mesh->objects.size();
+				auto sourceBVH = MakeShared<LinearBVH>(bDeformableMeshes ? &sceneArena : nullptr, mesh, meshSplitMethod, camera.threadNums);
+				meshBVH = sceneArena.MakeShared<BVH8>(*sourceBVH, meshNodeFormat, meshNodeLayout);
+				if (bDeformableMeshes) {
+					meshSourceBVHs[mesh.get()] = sourceBVH;
+				}
+			}
+			auto instance = sceneArena.MakeShared<Instance>(meshBVH);
+			world.Add(instance);
+			if (mesh->material->HasEmission()) {
+				lights.Add(instance);
+			}
+		}
+		world = HittableList(sceneArena.MakeShared<BVH8>(LinearBVH(world, BVHSplitMethod::SAH, camera.threadNums)));
+		lights = HittableList(sceneArena.MakeShared<BVH8>(LinearBVH(lights, BVHSplitMethod::SAH, camera.threadNums)));
 	}
-	world = HittableList(make_shared<BVHNode>(world));
-	lights = HittableList(make_shared<BVHNode>(lights));
-	LOGI("Building BVH End...");
+	double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStartTime).count();
+	LOGI("Building BVH End... {} triangles in {:.1f} ms ({:.2f} M triangles/s, {} threads)",
+		triangleNums, buildSeconds * 1000.0, buildSeconds > 0.0 ? triangleNums / buildSeconds / 1e6 : 0.0, camera.threadNums);
+	LOGI("Scene arena: {:.2f} MB used, {:.2f} MB reserved", sceneArena.GetUsedBytes() / 1048576.0, sceneArena.GetReservedBytes() / 1048576.0);
 
 	auto startTime = std::chrono::steady_clock::now();
 	camera.Render(world, lights);
 	std::string executionTime = GetExecutionTimeInMinutes(startTime);
+	if (streamed) {
+		LOGI("Streamed geometry: {} loads, {} evictions, {:.2f} MB peak resident", streamed->GetLoadNums(), streamed->GetEvictionNums(),
+			streamed->GetPeakResidentBytes() / 1048576.0);
+	}
 
-	camera.WriteColorAttachment(PROJECT_ROOT"Results/" + fileName + "_" + GetTimestamp() + "_" + camera.GetParametersStr() + "_" + executionTime + ".png");
+	const std::string outputPath = PROJECT_ROOT"Results/" + fileName + "_" + GetTimestamp() + "_" + camera.GetParametersStr() + "_" + executionTime + ".png";
+	camera.WriteColorAttachment(outputPath);
+	camera.WriteAOVs(outputPath);
 
 	return 0;
 }
\ No newline at end of file